@@ -52,7 +52,7 @@ case $4 in
         ;;
 esac
 
-# Apply buffersize
+# Apply buffersize (for ZWALs these are only defaults, see zenfs mkfs --wal_*)
 sed -i "s/#define SPARSE_BUFFER_SIZE_IN_KB.*/#define SPARSE_BUFFER_SIZE_IN_KB ${2}UL/g" plugin/zenfs/fs/io_zenfs.h
 # set WAL max depth
 sed -i "s/NAMELESS_WAL_DEPTH.*/NAMELESS_WAL_DEPTH ${3}/g" plugin/zenfs/fs/zbd_zenfs.h
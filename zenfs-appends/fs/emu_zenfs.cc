@@ -0,0 +1,545 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "emu_zenfs.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "rocksdb/env.h"
+#include "rocksdb/io_status.h"
+
+namespace ROCKSDB_NAMESPACE {
+
+/* Backing file header, followed by the write pointers of the zones */
+struct EmuHeader {
+  char magic[8];
+  uint32_t block_size;
+  uint32_t nr_zones;
+  uint64_t zone_size;
+};
+
+static const uint64_t kEmuWpOffset = 64;
+
+IOStatus EmuOptions::Parse(const std::string &spec, EmuOptions *options) {
+  std::stringstream ss(spec);
+  std::string kv;
+
+  std::getline(ss, options->path, ',');
+  if (options->path.empty())
+    return IOStatus::InvalidArgument("Emulated device needs a backing file");
+
+  while (std::getline(ss, kv, ',')) {
+    if (kv.empty()) continue;
+    size_t eq = kv.find('=');
+    if (eq == std::string::npos)
+      return IOStatus::InvalidArgument("Malformed emulator option: " + kv);
+
+    std::string key = kv.substr(0, eq);
+    uint64_t value;
+    try {
+      value = std::stoull(kv.substr(eq + 1));
+    } catch (...) {
+      return IOStatus::InvalidArgument("Malformed emulator option value: " +
+                                       kv);
+    }
+
+    if (key == "zones") {
+      options->nr_zones = value;
+    } else if (key == "zone_mb") {
+      options->zone_size = value * 1024 * 1024;
+    } else if (key == "block") {
+      options->block_size = value;
+    } else if (key == "open") {
+      options->max_open_zones = value;
+    } else if (key == "active") {
+      options->max_active_zones = value;
+    } else if (key == "read_us") {
+      options->read_us = value;
+    } else if (key == "write_us") {
+      options->write_us = value;
+    } else if (key == "append_us") {
+      options->append_us = value;
+    } else if (key == "reorder") {
+      options->reorder = value;
+    } else if (key == "seed") {
+      options->seed = value;
+    } else {
+      return IOStatus::InvalidArgument("Unknown emulator option: " + key);
+    }
+  }
+
+  if (options->block_size == 0 || options->zone_size == 0 ||
+      options->zone_size % options->block_size)
+    return IOStatus::InvalidArgument(
+        "Emulated zone size must be a multiple of the block size");
+  return IOStatus::OK();
+}
+
+EmuBackend::EmuBackend(std::string spec) : spec_(spec) {
+  options_status_ = EmuOptions::Parse(spec, &options_);
+}
+
+EmuBackend::~EmuBackend() {
+  if (fd_ >= 0) close(fd_);
+}
+
+IOStatus EmuBackend::Open(bool readonly, bool exclusive,
+                          unsigned int *max_active_zones,
+                          unsigned int *max_open_zones) {
+  if (!options_status_.ok()) return options_status_;
+
+  block_sz_ = options_.block_size;
+  zone_sz_ = options_.zone_size;
+  nr_zones_ = options_.nr_zones;
+
+  std::vector<uint64_t> wps;
+
+  if (options_.path != "mem") {
+    fd_ = open(options_.path.c_str(), readonly ? O_RDONLY : O_RDWR | O_CREAT,
+               0644);
+    if (fd_ < 0)
+      return IOStatus::InvalidArgument("Failed to open emulator backing file " +
+                                       options_.path + ": " + strerror(errno));
+    if (exclusive && flock(fd_, LOCK_EX | LOCK_NB))
+      return IOStatus::Busy("Emulator backing file is in use");
+
+    struct stat st;
+    EmuHeader header;
+    if (fstat(fd_, &st)) return IOStatus::IOError(strerror(errno));
+
+    if (st.st_size == 0) {
+      if (readonly)
+        return IOStatus::InvalidArgument("Empty emulator backing file");
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, EMU_MAGIC, sizeof(header.magic));
+      header.block_size = block_sz_;
+      header.nr_zones = nr_zones_;
+      header.zone_size = zone_sz_;
+      for (uint32_t i = 0; i < nr_zones_; i++) wps.push_back(i * zone_sz_);
+      ssize_t sz = wps.size() * sizeof(uint64_t);
+      if (pwrite(fd_, &header, sizeof(header), 0) != sizeof(header) ||
+          pwrite(fd_, wps.data(), sz, kEmuWpOffset) != sz)
+        return IOStatus::IOError("Failed to write emulator header");
+    } else {
+      if (pread(fd_, &header, sizeof(header), 0) != sizeof(header) ||
+          memcmp(header.magic, EMU_MAGIC, sizeof(header.magic)))
+        return IOStatus::Corruption("Not an emulator backing file");
+      block_sz_ = header.block_size;
+      nr_zones_ = header.nr_zones;
+      zone_sz_ = header.zone_size;
+      wps.resize(nr_zones_);
+      ssize_t sz = wps.size() * sizeof(uint64_t);
+      if (pread(fd_, wps.data(), sz, kEmuWpOffset) != sz)
+        return IOStatus::Corruption("Truncated emulator backing file");
+    }
+
+    data_offset_ = kEmuWpOffset + nr_zones_ * sizeof(uint64_t);
+    if (data_offset_ % block_sz_)
+      data_offset_ += block_sz_ - data_offset_ % block_sz_;
+    if (!readonly && ftruncate(fd_, data_offset_ + nr_zones_ * zone_sz_))
+      return IOStatus::IOError("Failed to size emulator backing file");
+  } else {
+    for (uint32_t i = 0; i < nr_zones_; i++) wps.push_back(i * zone_sz_);
+    mem_zones_.resize(nr_zones_);
+  }
+
+  zones_.resize(nr_zones_);
+  for (uint32_t i = 0; i < nr_zones_; i++) {
+    EmuZoneInfo &z = zones_[i];
+    z.start = i * zone_sz_;
+    z.capacity = zone_sz_;
+    z.wp = wps[i];
+    if (z.wp == z.start) {
+      z.cond = EmuZoneCond::kEmpty;
+    } else if (z.wp >= z.start + z.capacity) {
+      z.cond = EmuZoneCond::kFull;
+    } else {
+      z.cond = EmuZoneCond::kClosed;
+      nr_active_++;
+    }
+  }
+
+  *max_active_zones = options_.max_active_zones;
+  *max_open_zones = options_.max_open_zones;
+  return IOStatus::OK();
+}
+
+std::unique_ptr<ZoneList> EmuBackend::ListZones() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  EmuZoneInfo *z = (EmuZoneInfo *)calloc(nr_zones_, sizeof(EmuZoneInfo));
+  if (!z) return nullptr;
+
+  std::copy(zones_.begin(), zones_.end(), z);
+  return std::unique_ptr<ZoneList>(new ZoneList((void *)z, nr_zones_));
+}
+
+void EmuBackend::Delay(uint32_t us) {
+  if (us) std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+/* Writing an empty or closed zone opens it implicitly. Like a ZNS device, the
+ * oldest open zone is closed when the open limit is reached, while the active
+ * limit fails the write. */
+int EmuBackend::OpenZone(uint32_t zone) {
+  EmuZoneInfo &z = zones_[zone];
+
+  if (z.cond == EmuZoneCond::kOpen) return 0;
+  if (z.cond == EmuZoneCond::kEmpty) {
+    if (options_.max_active_zones && nr_active_ >= options_.max_active_zones) {
+      errno = EBUSY;
+      return -1;
+    }
+    nr_active_++;
+  }
+
+  if (options_.max_open_zones && open_zones_.size() >= options_.max_open_zones) {
+    zones_[open_zones_.front()].cond = EmuZoneCond::kClosed;
+    open_zones_.pop_front();
+  }
+  z.cond = EmuZoneCond::kOpen;
+  open_zones_.push_back(zone);
+  return 0;
+}
+
+/* The zone is no longer active (reset or full) */
+void EmuBackend::ReleaseZone(uint32_t zone) {
+  EmuZoneInfo &z = zones_[zone];
+
+  if (z.cond == EmuZoneCond::kOpen)
+    open_zones_.erase(std::find(open_zones_.begin(), open_zones_.end(), zone));
+  if (z.cond == EmuZoneCond::kOpen || z.cond == EmuZoneCond::kClosed)
+    nr_active_--;
+}
+
+void EmuBackend::PersistWp(uint32_t zone) {
+  if (fd_ < 0) return;
+  ssize_t ret = pwrite(fd_, &zones_[zone].wp, sizeof(uint64_t),
+                       kEmuWpOffset + zone * sizeof(uint64_t));
+  (void)ret;
+}
+
+uint64_t EmuBackend::ZoneWritePointer(uint64_t zone) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return zones_[zone].wp;
+}
+
+int EmuBackend::WriteData(const char *data, uint32_t size, uint64_t pos) {
+  uint32_t zone = pos / zone_sz_;
+
+  if (zone >= nr_zones_) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  EmuZoneInfo &z = zones_[zone];
+  if (pos != z.wp || size > z.start + z.capacity - z.wp) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (OpenZone(zone)) return -1;
+
+  if (fd_ >= 0) {
+    uint32_t done = 0;
+    while (done < size) {
+      ssize_t ret =
+          pwrite(fd_, data + done, size - done, data_offset_ + pos + done);
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      done += ret;
+    }
+  } else {
+    if (!mem_zones_[zone]) mem_zones_[zone].reset(new char[zone_sz_]);
+    memcpy(mem_zones_[zone].get() + (pos - z.start), data, size);
+  }
+
+  z.wp += size;
+  if (z.wp == z.start + z.capacity) {
+    ReleaseZone(zone);
+    z.cond = EmuZoneCond::kFull;
+  }
+  PersistWp(zone);
+  return size;
+}
+
+int EmuBackend::Write(char *data, uint32_t size, uint64_t pos) {
+  int ret;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    ret = WriteData(data, size, pos);
+  }
+  Delay(options_.write_us);
+  return ret;
+}
+
+/* The data lands at the write pointer of the zone when the append is
+ * serviced */
+int EmuBackend::ZoneAppend(char *data, uint32_t size, uint64_t zone_start,
+                           uint64_t *pos) {
+  int ret;
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    uint32_t zone = zone_start / zone_sz_;
+    if (zone >= nr_zones_) {
+      errno = EINVAL;
+      return -1;
+    }
+    *pos = zones_[zone].wp;
+    ret = WriteData(data, size, *pos);
+  }
+  Delay(options_.append_us);
+  return ret;
+}
+
+int EmuBackend::Append(char *data, uint32_t size, ZoneAppendLog *wal) {
+  if (wal->AsyncAppend(data, size, nullptr) != SZD::SZDStatus::Success) {
+    errno = EIO;
+    return -1;
+  }
+  return size;
+}
+
+/* Unwritten blocks read as zeros */
+int EmuBackend::Read(char *buf, int size, uint64_t pos, bool /*direct*/) {
+  uint64_t end = (uint64_t)nr_zones_ * zone_sz_;
+  int ret = 0;
+
+  if (pos >= end) return 0;
+  if (pos + size > end) size = end - pos;
+
+  if (fd_ >= 0) {
+    while (ret < size) {
+      ssize_t r = pread(fd_, buf + ret, size - ret, data_offset_ + pos + ret);
+      if (r < 0) {
+        if (errno == EINTR) continue;
+        return -1;
+      }
+      if (r == 0) break;
+      ret += r;
+    }
+  } else {
+    std::lock_guard<std::mutex> lock(mtx_);
+    while (ret < size) {
+      uint32_t zone = (pos + ret) / zone_sz_;
+      uint64_t off = (pos + ret) % zone_sz_;
+      int n = std::min((uint64_t)(size - ret), zone_sz_ - off);
+      if (mem_zones_[zone])
+        memcpy(buf + ret, mem_zones_[zone].get() + off, n);
+      else
+        memset(buf + ret, 0, n);
+      ret += n;
+    }
+  }
+
+  Delay(options_.read_us);
+  return ret;
+}
+
+IOStatus EmuBackend::Reset(uint64_t start, bool *offline,
+                           uint64_t *max_capacity) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint32_t zone = start / zone_sz_;
+  EmuZoneInfo &z = zones_[zone];
+
+  ReleaseZone(zone);
+  z.cond = EmuZoneCond::kEmpty;
+  z.wp = z.start;
+  if (!mem_zones_.empty()) mem_zones_[zone].reset();
+  PersistWp(zone);
+
+  *offline = false;
+  *max_capacity = z.capacity;
+  return IOStatus::OK();
+}
+
+IOStatus EmuBackend::Finish(uint64_t start) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint32_t zone = start / zone_sz_;
+  EmuZoneInfo &z = zones_[zone];
+
+  ReleaseZone(zone);
+  z.cond = EmuZoneCond::kFull;
+  z.wp = z.start + z.capacity;
+  PersistWp(zone);
+  return IOStatus::OK();
+}
+
+IOStatus EmuBackend::Close(uint64_t start) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint32_t zone = start / zone_sz_;
+  EmuZoneInfo &z = zones_[zone];
+
+  if (z.cond != EmuZoneCond::kOpen) return IOStatus::OK();
+  open_zones_.erase(std::find(open_zones_.begin(), open_zones_.end(), zone));
+  if (z.wp == z.start) {
+    nr_active_--;
+    z.cond = EmuZoneCond::kEmpty;
+  } else {
+    z.cond = EmuZoneCond::kClosed;
+  }
+  return IOStatus::OK();
+}
+
+EmuAppendLog::EmuAppendLog(EmuBackend *be, uint64_t min_zone,
+                           uint64_t max_zone)
+    : be_(be),
+      min_lba_(min_zone * (be->GetZoneSize() / be->GetBlockSize())),
+      max_lba_(max_zone * (be->GetZoneSize() / be->GetBlockSize())),
+      head_(min_lba_),
+      tail_(min_lba_),
+      rng_(be->GetOptions().seed) {}
+
+EmuAppendLog::~EmuAppendLog() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  LandQueued();
+}
+
+/* Appends are padded to the block size and may cross into the next zone */
+SZD::SZDStatus EmuAppendLog::Land(const char *data, size_t size) {
+  uint64_t bs = be_->GetBlockSize();
+  uint64_t zone_sz = be_->GetZoneSize();
+  std::string padded;
+
+  if (size % bs) {
+    padded.assign(data, size);
+    padded.resize(size + bs - size % bs, '\0');
+    data = padded.data();
+    size = padded.size();
+  }
+
+  while (size) {
+    if (head_ >= max_lba_) return SZD::SZDStatus::IOError;
+
+    uint64_t pos = head_ * bs;
+    size_t n = std::min((uint64_t)size, zone_sz - pos % zone_sz);
+    int ret;
+    {
+      std::lock_guard<std::mutex> lock(be_->mtx_);
+      ret = be_->WriteData(data, n, pos);
+    }
+    if (ret < 0) return SZD::SZDStatus::IOError;
+
+    head_ += n / bs;
+    data += n;
+    size -= n;
+  }
+  return SZD::SZDStatus::Success;
+}
+
+SZD::SZDStatus EmuAppendLog::LandQueued() {
+  SZD::SZDStatus s = SZD::SZDStatus::Success;
+
+  if (queued_.empty()) return s;
+  std::shuffle(queued_.begin(), queued_.end(), rng_);
+  for (const std::string &append : queued_) {
+    s = Land(append.data(), append.size());
+    if (s != SZD::SZDStatus::Success) break;
+  }
+  queued_.clear();
+  be_->Delay(be_->GetOptions().append_us);
+  return s;
+}
+
+SZD::SZDStatus EmuAppendLog::AsyncAppend(const char *data, size_t size,
+                                         uint64_t *lbas) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint32_t reorder = be_->GetOptions().reorder;
+
+  if (reorder <= 1) {
+    if (lbas) *lbas = head_;
+    SZD::SZDStatus s = Land(data, size);
+    be_->Delay(be_->GetOptions().append_us);
+    return s;
+  }
+
+  queued_.emplace_back(data, size);
+  if (queued_.size() < reorder) return SZD::SZDStatus::Success;
+  return LandQueued();
+}
+
+SZD::SZDStatus EmuAppendLog::Sync() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return LandQueued();
+}
+
+SZD::SZDStatus EmuAppendLog::Read(uint64_t lba, char *data, uint64_t size,
+                                  bool /*aligned*/) {
+  uint64_t pos = lba * be_->GetBlockSize();
+  uint64_t done = 0;
+
+  while (done < size) {
+    int ret = be_->Read(data + done, size - done, pos + done, false);
+    if (ret <= 0) return SZD::SZDStatus::IOError;
+    done += ret;
+  }
+  return SZD::SZDStatus::Success;
+}
+
+SZD::SZDStatus EmuAppendLog::ResetAll() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint64_t zone_sz = be_->GetZoneSize();
+  uint64_t zone_lbas = zone_sz / be_->GetBlockSize();
+  bool offline;
+  uint64_t max_capacity;
+
+  queued_.clear();
+  for (uint64_t zone = min_lba_ / zone_lbas; zone < max_lba_ / zone_lbas;
+       zone++) {
+    if (!be_->Reset(zone * zone_sz, &offline, &max_capacity).ok())
+      return SZD::SZDStatus::IOError;
+  }
+  head_ = tail_ = min_lba_;
+  return SZD::SZDStatus::Success;
+}
+
+/* The log fills its zones in order, the head is the write pointer of the last
+ * zone that was written to */
+SZD::SZDStatus EmuAppendLog::RecoverPointers() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint64_t zone_sz = be_->GetZoneSize();
+  uint64_t bs = be_->GetBlockSize();
+  uint64_t zone_lbas = zone_sz / bs;
+
+  head_ = tail_ = min_lba_;
+  for (uint64_t zone = min_lba_ / zone_lbas; zone < max_lba_ / zone_lbas;
+       zone++) {
+    uint64_t wp = be_->ZoneWritePointer(zone);
+    if (wp == zone * zone_sz) break;
+    head_ = wp / bs;
+    if (wp < (zone + 1) * zone_sz) break;
+  }
+  return SZD::SZDStatus::Success;
+}
+
+uint64_t EmuAppendLog::GetWriteHead() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return head_;
+}
+
+uint64_t EmuAppendLog::GetWriteTail() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return tail_;
+}
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
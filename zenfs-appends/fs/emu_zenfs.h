@@ -0,0 +1,201 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rocksdb/io_status.h"
+#include "zbd_zenfs.h"
+
+// APPEND-DOC, defaults of the emulated zoned device, see EmuOptions
+#define EMU_DEFAULT_NR_ZONES (128)
+#define EMU_DEFAULT_ZONE_SIZE_MB (64)
+#define EMU_DEFAULT_BLOCK_SIZE (4096)
+#define EMU_DEFAULT_MAX_OPEN_ZONES (14)
+#define EMU_DEFAULT_MAX_ACTIVE_ZONES (14)
+/* APPEND-DOC, the backing file starts with this header, then the zone wps */
+#define EMU_MAGIC "ZENFSEMU"
+
+namespace ROCKSDB_NAMESPACE {
+
+// APPEND-DOC, geometry and timing of the emulated device. Parsed from
+// "<backing file>[,key=value...]", a backing file "mem" keeps the zones in
+// memory, e.g. "/tmp/zns.img,zones=256,zone_mb=64,append_us=20,reorder=8".
+// The geometry of an existing backing file is taken from its header.
+struct EmuOptions {
+  std::string path;
+  uint32_t nr_zones = EMU_DEFAULT_NR_ZONES;
+  uint64_t zone_size = EMU_DEFAULT_ZONE_SIZE_MB * 1024 * 1024;
+  uint32_t block_size = EMU_DEFAULT_BLOCK_SIZE;
+  uint32_t max_open_zones = EMU_DEFAULT_MAX_OPEN_ZONES; /* 0 = no limit */
+  uint32_t max_active_zones = EMU_DEFAULT_MAX_ACTIVE_ZONES; /* 0 = no limit */
+  uint32_t read_us = 0;   /* latency of a read */
+  uint32_t write_us = 0;  /* latency of a write */
+  uint32_t append_us = 0; /* latency of a batch of WAL appends, or of a
+                             zone append of SST data */
+  uint32_t reorder = 0;   /* zone appends that complete out of order */
+  uint32_t seed = 0;      /* seed of the completion order */
+
+  static IOStatus Parse(const std::string &spec, EmuOptions *options);
+};
+
+enum class EmuZoneCond { kEmpty, kOpen, kClosed, kFull };
+
+struct EmuZoneInfo {
+  uint64_t start;
+  uint64_t capacity;
+  uint64_t wp;
+  EmuZoneCond cond;
+};
+
+class EmuBackend;
+
+// APPEND-DOC, stand-in for the SZD once log of a WAL on the emulated device.
+// Appends are queued and land in batches of EmuOptions::reorder, in a random
+// order, like zone appends in flight on a ZNS device. Sync lands the queued
+// appends. The LBAs of queued appends are not known, lbas is only set for
+// appends that land right away.
+class EmuAppendLog : public ZoneAppendLog {
+  EmuBackend *be_;
+  uint64_t min_lba_;
+  uint64_t max_lba_;
+  uint64_t head_;
+  uint64_t tail_;
+  std::vector<std::string> queued_;
+  std::mt19937 rng_;
+  std::mutex mtx_;
+
+ public:
+  EmuAppendLog(EmuBackend *be, uint64_t min_zone, uint64_t max_zone);
+  ~EmuAppendLog();
+
+  SZD::SZDStatus AsyncAppend(const char *data, size_t size,
+                             uint64_t *lbas) override;
+  SZD::SZDStatus Sync() override;
+  SZD::SZDStatus Read(uint64_t lba, char *data, uint64_t size,
+                      bool aligned) override;
+  SZD::SZDStatus ResetAll() override;
+  SZD::SZDStatus RecoverPointers() override;
+  uint64_t GetWriteHead() override;
+  uint64_t GetWriteTail() override;
+  /* Queued appends are copies, the others land before AsyncAppend returns */
+  bool CopiesAppends() override { return true; }
+
+ private:
+  /* Must hold mtx_ */
+  SZD::SZDStatus Land(const char *data, size_t size);
+  SZD::SZDStatus LandQueued();
+};
+
+// APPEND-DOC, a zoned block device emulated in a regular file or in memory.
+// It models zone write pointers, conditions and open/active limits, the
+// latencies of reads, writes and zone appends, and the completion order of
+// zone appends. Benchmarks and regression runs of ZWAL then do not need a ZNS
+// SSD or FEMU. The WAL logs are EmuAppendLogs, no SZD device is opened.
+class EmuBackend : public ZonedBlockDeviceBackend {
+ private:
+  EmuOptions options_;
+  IOStatus options_status_;
+  std::string spec_;
+  int fd_ = -1;
+  uint64_t data_offset_ = 0; /* backing file offset of zone 0 */
+  std::vector<EmuZoneInfo> zones_;
+  std::vector<std::unique_ptr<char[]>> mem_zones_;
+  std::deque<uint32_t> open_zones_; /* implicitly opened, oldest first */
+  uint32_t nr_active_ = 0;
+  std::mutex mtx_;
+
+  friend class EmuAppendLog;
+
+ public:
+  explicit EmuBackend(std::string spec);
+  ~EmuBackend();
+
+  IOStatus Open(bool readonly, bool exclusive, unsigned int *max_active_zones,
+                unsigned int *max_open_zones);
+  std::unique_ptr<ZoneList> ListZones();
+  IOStatus Reset(uint64_t start, bool *offline, uint64_t *max_capacity);
+  IOStatus Finish(uint64_t start);
+  IOStatus Close(uint64_t start);
+  int Read(char *buf, int size, uint64_t pos, bool direct);
+  int Write(char *data, uint32_t size, uint64_t pos);
+  uint32_t ZoneAppendMax() {
+    return std::min<uint64_t>(zone_sz_, UINT32_MAX - block_sz_ + 1);
+  }
+  int ZoneAppend(char *data, uint32_t size, uint64_t zone_start,
+                 uint64_t *pos);
+  int Append(char *data, uint32_t size, ZoneAppendLog *wal);
+  int AppendSync(ZoneAppendLog * /*wal*/) { return 0; }
+  bool OwnsAppendLogs() { return true; }
+  ZoneAppendLog *NewAppendLog(uint64_t min_zone, uint64_t max_zone) {
+    return new EmuAppendLog(this, min_zone, max_zone);
+  }
+
+  int InvalidateCache(uint64_t /*pos*/, uint64_t /*size*/) { return 0; }
+
+  bool ZoneIsSwr(std::unique_ptr<ZoneList> & /*zones*/,
+                 unsigned int /*idx*/) {
+    return true;
+  }
+  bool ZoneIsOffline(std::unique_ptr<ZoneList> & /*zones*/,
+                     unsigned int /*idx*/) {
+    return false;
+  }
+  bool ZoneIsWritable(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return Info(zones, idx)->cond != EmuZoneCond::kFull;
+  }
+  bool ZoneIsActive(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    EmuZoneCond cond = Info(zones, idx)->cond;
+    return cond == EmuZoneCond::kOpen || cond == EmuZoneCond::kClosed;
+  }
+  bool ZoneIsOpen(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return Info(zones, idx)->cond == EmuZoneCond::kOpen;
+  }
+  uint64_t ZoneStart(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return Info(zones, idx)->start;
+  }
+  uint64_t ZoneMaxCapacity(std::unique_ptr<ZoneList> &zones,
+                           unsigned int idx) {
+    return Info(zones, idx)->capacity;
+  }
+  uint64_t ZoneWp(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return Info(zones, idx)->wp;
+  }
+
+  std::string GetFilename() { return "emu:" + spec_; }
+  const EmuOptions &GetOptions() { return options_; }
+
+  /* Write pointer of a zone, for the append logs */
+  uint64_t ZoneWritePointer(uint64_t zone);
+
+ private:
+  EmuZoneInfo *Info(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return &((EmuZoneInfo *)zones->GetData())[idx];
+  }
+  /* Must hold mtx_ */
+  int OpenZone(uint32_t zone);
+  void ReleaseZone(uint32_t zone);
+  int WriteData(const char *data, uint32_t size, uint64_t pos);
+  void PersistWp(uint32_t zone);
+  void Delay(uint32_t us);
+};
+
+}  // namespace ROCKSDB_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
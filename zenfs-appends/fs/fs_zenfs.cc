@@ -8,6 +8,7 @@
 
 #include "fs_zenfs.h"
 
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -16,6 +17,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <set>
 #include <sstream>
 #include <utility>
@@ -53,6 +56,16 @@ Status Superblock::DecodeFrom(Slice* input) {
   input->remove_prefix(sizeof(aux_fs_path_));
   memcpy(&zenfs_version_, input->data(), sizeof(zenfs_version_));
   input->remove_prefix(sizeof(zenfs_version_));
+  GetFixed32(input, &wal_buffer_size_kb_);
+  GetFixed32(input, &wal_barrier_size_kb_);
+  GetFixed32(input, &wal_depth_);
+  GetFixed32(input, &wal_channels_);
+  GetFixed32(input, &wal_barrier_min_kb_);
+  GetFixed32(input, &wal_barrier_max_kb_);
+  GetFixed32(input, &reserve_io_zones_);
+  GetFixed32(input, &reserve_wal_ranges_);
+  GetFixed32(input, &gc_threads_);
+  GetFixed32(input, &gc_bandwidth_mb_);
   memcpy(&reserved_, input->data(), sizeof(reserved_));
   input->remove_prefix(sizeof(reserved_));
   assert(input->size() == 0);
@@ -84,6 +97,16 @@ void Superblock::EncodeTo(std::string* output) {
   PutFixed32(output, finish_treshold_);
   output->append(aux_fs_path_, sizeof(aux_fs_path_));
   output->append(zenfs_version_, sizeof(zenfs_version_));
+  PutFixed32(output, wal_buffer_size_kb_);
+  PutFixed32(output, wal_barrier_size_kb_);
+  PutFixed32(output, wal_depth_);
+  PutFixed32(output, wal_channels_);
+  PutFixed32(output, wal_barrier_min_kb_);
+  PutFixed32(output, wal_barrier_max_kb_);
+  PutFixed32(output, reserve_io_zones_);
+  PutFixed32(output, reserve_wal_ranges_);
+  PutFixed32(output, gc_threads_);
+  PutFixed32(output, gc_bandwidth_mb_);
   output->append(reserved_, sizeof(reserved_));
   assert(output->length() == ENCODED_SIZE);
 }
@@ -109,6 +132,27 @@ void Superblock::GetReport(std::string* reportString) {
   reportString->append(std::to_string(finish_treshold_));
   reportString->append("\nGarbage Collection Enabled:\t");
   reportString->append(std::to_string(!!(flags_ & FLAGS_ENABLE_GC)));
+  reportString->append("\nSST Zone Appends Enabled:\t");
+  reportString->append(std::to_string(!!(flags_ & FLAGS_SST_ZONE_APPENDS)));
+  reportString->append("\nWAL Buffer Size [KiB]:\t\t");
+  reportString->append(std::to_string(wal_buffer_size_kb_));
+  reportString->append("\nWAL Barrier Size [KiB]:\t\t");
+  reportString->append(std::to_string(wal_barrier_size_kb_));
+  reportString->append("\nWAL Adaptive Barrier [KiB]:\t");
+  reportString->append(std::to_string(wal_barrier_min_kb_) + "-" +
+                       std::to_string(wal_barrier_max_kb_));
+  reportString->append("\nWAL Queue Depth:\t\t");
+  reportString->append(std::to_string(wal_depth_));
+  reportString->append("\nWAL Channels:\t\t\t");
+  reportString->append(std::to_string(wal_channels_));
+  reportString->append("\nReserved IO Zones:\t\t");
+  reportString->append(std::to_string(reserve_io_zones_));
+  reportString->append("\nReserved WAL Zone Ranges:\t");
+  reportString->append(std::to_string(reserve_wal_ranges_));
+  reportString->append("\nGC Threads:\t\t\t");
+  reportString->append(std::to_string(gc_threads_));
+  reportString->append("\nGC Bandwidth [MiB/s]:\t\t");
+  reportString->append(std::to_string(gc_bandwidth_mb_));
   reportString->append("\nAuxiliary FS Path:\t\t");
   reportString->append(aux_fs_path_);
   reportString->append("\nZenFS Version:\t\t\t");
@@ -132,39 +176,212 @@ Status Superblock::CompatibleWith(ZonedBlockDevice* zbd) {
   return Status::OK();
 }
 
-IOStatus ZenMetaLog::AddRecord(const Slice& slice) {
-  uint32_t record_sz = slice.size();
-  const char* data = slice.data();
-  size_t phys_sz;
-  uint32_t crc = 0;
-  char* buffer;
-  int ret;
-  IOStatus s;
+/* APPEND-DOC, fill in the compile-time defaults for unset ZWAL options */
+static Status ResolveWALOptions(ZWALOptions* wal_options) {
+  if (wal_options->buffer_size_kb == 0)
+    wal_options->buffer_size_kb = SPARSE_BUFFER_SIZE_IN_KB;
+  if (wal_options->depth == 0) wal_options->depth = NAMELESS_WAL_DEPTH;
+  if (wal_options->depth > NAMELESS_WAL_MAX_DEPTH)
+    return Status::InvalidArgument("WAL depth exceeds " +
+                                   std::to_string(NAMELESS_WAL_MAX_DEPTH));
+  if ((wal_options->buffer_size_kb * KiB) % SPARSE_BLOCK_SIZE != 0)
+    return Status::InvalidArgument(
+        "WAL buffer size must be a multiple of " +
+        std::to_string(SPARSE_BLOCK_SIZE / KiB) + " KiB");
+  if (wal_options->channels == 0) wal_options->channels = NAMELESS_WAL_CHANNELS;
+  if (wal_options->reserve_io_zones == 0)
+    wal_options->reserve_io_zones = ZENFS_RESERVE_IO_ZONES;
+  if (wal_options->reserve_wal_ranges == 0)
+    wal_options->reserve_wal_ranges = ZENFS_RESERVE_WAL_RANGES;
+  if (wal_options->gc_threads == 0) wal_options->gc_threads = ZENFS_GC_THREADS;
+#ifdef WAL_BARRIERS
+  if (wal_options->barrier_size_kb == 0)
+    wal_options->barrier_size_kb = WAL_BARRIER_SIZE_IN_KB;
+  if (wal_options->barrier_size_kb % wal_options->buffer_size_kb != 0)
+    return Status::InvalidArgument(
+        "WAL barrier size must be a multiple of the WAL buffer size");
+  /* Adaptive barriers start at the barrier size */
+  if (wal_options->barrier_max_kb) {
+    if (wal_options->barrier_min_kb == 0)
+      wal_options->barrier_min_kb = wal_options->buffer_size_kb;
+    if (wal_options->barrier_min_kb % wal_options->buffer_size_kb != 0 ||
+        wal_options->barrier_max_kb % wal_options->buffer_size_kb != 0)
+      return Status::InvalidArgument(
+          "WAL barrier bounds must be multiples of the WAL buffer size");
+    if (wal_options->barrier_min_kb > wal_options->barrier_size_kb ||
+        wal_options->barrier_size_kb > wal_options->barrier_max_kb)
+      return Status::InvalidArgument(
+          "WAL barrier size must be within the adaptive barrier bounds");
+  }
+#else
+  if (wal_options->barrier_size_kb == 0)
+    wal_options->barrier_size_kb = wal_options->buffer_size_kb;
+  wal_options->barrier_min_kb = 0;
+  wal_options->barrier_max_kb = 0;
+#endif
+  return Status::OK();
+}
 
-  phys_sz = record_sz + zMetaHeaderSize;
+// APPEND-DOC, a decimal uint32_t, without sign, spaces or trailing characters
+static bool ParseUInt32(const std::string& str, uint32_t* value) {
+  if (str.empty() || str.size() > 10 ||
+      !std::all_of(str.begin(), str.end(), ::isdigit))
+    return false;
+
+  uint64_t v = std::stoull(str);
+  if (v > UINT32_MAX) return false;
+  *value = v;
+  return true;
+}
+
+// APPEND-DOC, tenant=<path prefix>:<open>:<active>:<wal zones>:<channels>
+static Status ParseTenant(const std::string& value, ZenFSTenantList* tenants) {
+  std::stringstream ss(value);
+  std::string prefix, field;
+  std::vector<uint32_t> budget;
+
+  std::getline(ss, prefix, ':');
+  if (prefix.empty() || prefix[0] != '/')
+    return Status::InvalidArgument("Tenant needs an absolute path: " + value);
+  while (std::getline(ss, field, ':')) {
+    uint32_t v;
+    if (!ParseUInt32(field, &v))
+      return Status::InvalidArgument("Malformed tenant budget: " + value);
+    budget.push_back(v);
+  }
+  if (budget.size() > 4)
+    return Status::InvalidArgument("Malformed tenant budget: " + value);
+  budget.resize(4, 0);
+
+  ZenFSTenantOptions options;
+  options.max_open_zones = budget[0];
+  options.max_active_zones = budget[1];
+  options.max_wal_zones = budget[2];
+  options.write_channels = budget[3];
+  tenants->push_back(std::make_pair(prefix, options));
+  return Status::OK();
+}
 
-  if (phys_sz % bs_) phys_sz += bs_ - phys_sz % bs_;
+/* APPEND-DOC, parse ZWAL options from a URI query,
+ * e.g. "wal_buffer_kb=16&wal_barrier_kb=1024&wal_depth=32&wal_channels=16" */
+static Status ParseURIOptions(const std::string& query,
+                              ZWALOptions* wal_options,
+                              ZenFSTenantList* tenants) {
+  std::stringstream ss(query);
+  std::string kv;
 
-  assert(data != nullptr);
-  assert((phys_sz % bs_) == 0);
+  while (std::getline(ss, kv, '&')) {
+    if (kv.empty()) continue;
+    size_t eq = kv.find('=');
+    if (eq == std::string::npos)
+      return Status::InvalidArgument("Malformed URI option: " + kv);
+
+    std::string key = kv.substr(0, eq);
+    if (key == "tenant") {
+      Status s = ParseTenant(kv.substr(eq + 1), tenants);
+      if (!s.ok()) return s;
+      continue;
+    }
+
+    uint32_t value;
+    if (!ParseUInt32(kv.substr(eq + 1), &value))
+      return Status::InvalidArgument("Malformed URI option value: " + kv);
+
+    if (key == "wal_buffer_kb") {
+      wal_options->buffer_size_kb = value;
+    } else if (key == "wal_barrier_kb") {
+      wal_options->barrier_size_kb = value;
+    } else if (key == "wal_barrier_min_kb") {
+      wal_options->barrier_min_kb = value;
+    } else if (key == "wal_barrier_max_kb") {
+      wal_options->barrier_max_kb = value;
+    } else if (key == "wal_depth") {
+      wal_options->depth = value;
+    } else if (key == "wal_channels") {
+      wal_options->channels = value;
+    } else if (key == "reserve_io_zones") {
+      wal_options->reserve_io_zones = value;
+    } else if (key == "reserve_wal_ranges") {
+      wal_options->reserve_wal_ranges = value;
+    } else if (key == "gc_threads") {
+      wal_options->gc_threads = value;
+    } else if (key == "gc_bandwidth_mb") {
+      wal_options->gc_bandwidth_mb = value;
+    } else if (key == "sst_zone_appends") {
+      wal_options->sst_zone_appends = value != 0;
+    } else {
+      return Status::InvalidArgument("Unknown URI option: " + key);
+    }
+  }
+  return Status::OK();
+}
+
+IOStatus ZenMetaLog::ReserveBuffer(size_t size) {
+  if (size <= buffer_sz_) return IOStatus::OK();
+
+  free(buffer_);
+  buffer_sz_ = 0;
+  if (posix_memalign((void**)&buffer_, sysconf(_SC_PAGESIZE), size)) {
+    buffer_ = nullptr;
+    return IOStatus::IOError("Failed to allocate memory");
+  }
+  buffer_sz_ = size;
+  return IOStatus::OK();
+}
+
+size_t ZenMetaLog::PhysicalSize(size_t record_sz) {
+  size_t phys_sz = record_sz + zMetaHeaderSize;
 
-  ret = posix_memalign((void**)&buffer, sysconf(_SC_PAGESIZE), phys_sz);
-  if (ret) return IOStatus::IOError("Failed to allocate memory");
+  if (phys_sz % bs_) phys_sz += bs_ - phys_sz % bs_;
+  return phys_sz;
+}
+
+void ZenMetaLog::EncodeRecord(const Slice& slice, char* dst) {
+  uint32_t record_sz = slice.size();
+  const char* data = slice.data();
+  size_t phys_sz = PhysicalSize(record_sz);
+  uint32_t crc = 0;
 
-  memset(buffer, 0, phys_sz);
+  assert(data != nullptr);
 
   crc = crc32c::Extend(crc, (const char*)&record_sz, sizeof(uint32_t));
   crc = crc32c::Extend(crc, data, record_sz);
   crc = crc32c::Mask(crc);
 
-  EncodeFixed32(buffer, crc);
-  EncodeFixed32(buffer + sizeof(uint32_t), record_sz);
-  memcpy(buffer + sizeof(uint32_t) * 2, data, record_sz);
+  EncodeFixed32(dst, crc);
+  EncodeFixed32(dst + sizeof(uint32_t), record_sz);
+  memcpy(dst + zMetaHeaderSize, data, record_sz);
+  memset(dst + zMetaHeaderSize + record_sz, 0,
+         phys_sz - zMetaHeaderSize - record_sz);
+}
 
-  s = zone_->Append(buffer, phys_sz);
+IOStatus ZenMetaLog::AddRecord(const Slice& slice) {
+  size_t phys_sz = PhysicalSize(slice.size());
+  IOStatus s;
 
-  free(buffer);
-  return s;
+  s = ReserveBuffer(phys_sz);
+  if (!s.ok()) return s;
+
+  EncodeRecord(slice, buffer_);
+  return zone_->Append(buffer_, phys_sz);
+}
+
+IOStatus ZenMetaLog::AddRecords(const std::vector<std::string>& records) {
+  size_t phys_sz = 0;
+  char* dst;
+  IOStatus s;
+
+  for (const auto& record : records) phys_sz += PhysicalSize(record.size());
+
+  s = ReserveBuffer(phys_sz);
+  if (!s.ok()) return s;
+
+  dst = buffer_;
+  for (const auto& record : records) {
+    EncodeRecord(record, dst);
+    dst += PhysicalSize(record.size());
+  }
+  return zone_->Append(buffer_, phys_sz);
 }
 
 IOStatus ZenMetaLog::Read(Slice* slice) {
@@ -261,43 +478,90 @@ ZenFS::~ZenFS() {
     run_gc_worker_ = false;
     gc_worker_->join();
   }
+  zbd_->StopResetWorker();
 
   meta_log_.reset(nullptr);
   ClearFiles();
   delete zbd_;
 }
 
+// APPEND-DOC, LFS style cost-benefit of collecting a full zone: the garbage
+// freed over the cost of reading and writing back the valid data, weighted by
+// how long the data in the zone has been stable. Data with a short lifetime
+// hint is likely to be deleted soon without a copy.
+static double GCCostBenefit(const ZoneSnapshot& zone, uint64_t age_us) {
+  double garbage = (double)(zone.max_capacity - zone.used_capacity);
+  double cost = (double)(zone.max_capacity + zone.used_capacity);
+  double age = (double)(age_us / 1000000 + 1);
+  double weight = zone.lifetime >= Env::WLTH_SHORT
+                      ? (double)(zone.lifetime - Env::WLTH_NONE)
+                      : (double)(Env::WLTH_MEDIUM - Env::WLTH_NONE);
+
+  return garbage * age * weight / cost;
+}
+
 void ZenFS::GCWorker() {
+  bool busy = false;
+
   while (run_gc_worker_) {
-    usleep(1000 * 1000 * 10);
+    usleep(1000 * (busy ? GC_BUSY_INTERVAL_MS : GC_IDLE_INTERVAL_MS));
+    busy = false;
+
+    uint64_t now = Env::Default()->NowMicros();
+    ZenFSSnapshot zone_snapshot;
+    ZenFSSnapshotOptions zone_options;
+
+    /* Track the age of the full zones */
+    zone_options.zone_ = 1;
+    GetZenFSSnapshot(zone_snapshot, zone_options);
+    std::map<uint64_t, uint64_t> zone_full_us;
+    for (const auto& zone : zone_snapshot.zones_) {
+      if (zone.capacity != 0 || zone.used_capacity == 0) continue;
+      auto it = gc_zone_full_us_.find(zone.start);
+      zone_full_us[zone.start] = it == gc_zone_full_us_.end() ? now : it->second;
+    }
+    gc_zone_full_us_.swap(zone_full_us);
 
     uint64_t non_free = zbd_->GetUsedSpace() + zbd_->GetReclaimableSpace();
     uint64_t free = zbd_->GetFreeSpace();
     uint64_t free_percent = (100 * free) / (free + non_free);
-    ZenFSSnapshot snapshot;
-    ZenFSSnapshotOptions options;
 
     if (free_percent > GC_START_LEVEL) continue;
 
-    options.zone_ = 1;
+    ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(), ZENFS_GC_ROUND_LATENCY,
+                                   Env::Default());
+    std::vector<std::pair<double, uint64_t>> victims;
+    for (const auto& zone : zone_snapshot.zones_) {
+      auto it = gc_zone_full_us_.find(zone.start);
+      if (it == gc_zone_full_us_.end()) continue;
+      uint64_t garbage_percent_approx =
+          100 - 100 * zone.used_capacity / zone.max_capacity;
+      if (garbage_percent_approx < GC_MIN_GARBAGE ||
+          garbage_percent_approx >= 100)
+        continue;
+      victims.emplace_back(GCCostBenefit(zone, now - it->second), zone.start);
+    }
+    std::sort(victims.begin(), victims.end(),
+              [](const std::pair<double, uint64_t>& a,
+                 const std::pair<double, uint64_t>& b) {
+                return a.first > b.first;
+              });
+    if (victims.size() > GC_MAX_VICTIMS) victims.resize(GC_MAX_VICTIMS);
+    zbd_->GetMetrics()->ReportGeneral(ZENFS_GC_VICTIM_ZONES_COUNT,
+                                      victims.size());
+    if (victims.empty()) continue;
+
+    std::set<uint64_t> migrate_zones_start;
+    for (const auto& victim : victims) migrate_zones_start.emplace(victim.second);
+
+    ZenFSSnapshot snapshot;
+    ZenFSSnapshotOptions options;
+
     options.zone_file_ = 1;
     options.log_garbage_ = 1;
 
     GetZenFSSnapshot(snapshot, options);
 
-    uint64_t threshold = (100 - GC_SLOPE * (GC_START_LEVEL - free_percent));
-    std::set<uint64_t> migrate_zones_start;
-    for (const auto& zone : snapshot.zones_) {
-      if (zone.capacity == 0) {
-        uint64_t garbage_percent_approx =
-            100 - 100 * zone.used_capacity / zone.max_capacity;
-        if (garbage_percent_approx > threshold &&
-            garbage_percent_approx < 100) {
-          migrate_zones_start.emplace(zone.start);
-        }
-      }
-    }
-
     std::vector<ZoneExtentSnapshot*> migrate_exts;
     for (auto& ext : snapshot.extents_) {
       if (migrate_zones_start.find(ext.zone_start) !=
@@ -308,12 +572,13 @@ void ZenFS::GCWorker() {
 
     if (migrate_exts.size() > 0) {
       IOStatus s;
-      Info(logger_, "Garbage collecting %d extents \n",
-           (int)migrate_exts.size());
+      Info(logger_, "Garbage collecting %d extents in %d zones\n",
+           (int)migrate_exts.size(), (int)victims.size());
       s = MigrateExtents(migrate_exts);
       if (!s.ok()) {
         Error(logger_, "Garbage collection failed");
       }
+      busy = s.ok();
     }
   }
 }
@@ -343,13 +608,13 @@ void ZenFS::LogFiles() {
   Info(logger_, "  Files:\n");
   for (it = files_.begin(); it != files_.end(); it++) {
     std::shared_ptr<ZoneFile> zFile = it->second;
-    std::vector<ZoneExtent*> extents = zFile->GetExtents();
+    const ZoneExtentList& extents = zFile->GetExtents();
 
     Info(logger_, "    %-45s sz: %lu lh: %d sparse: %u", it->first.c_str(),
          zFile->GetFileSize(), zFile->GetWriteLifeTimeHint(),
          zFile->IsSparse());
     for (unsigned int i = 0; i < extents.size(); i++) {
-      ZoneExtent* extent = extents[i];
+      const ZoneExtent* extent = extents[i];
       Info(logger_, "          Extent %u {start=0x%lx, zone=%u, len=%lu} ", i,
            extent->start_,
            (uint32_t)(extent->zone_->start_ / zbd_->GetZoneSize()),
@@ -416,6 +681,8 @@ IOStatus ZenFS::RollMetaZoneLocked() {
 
   old_meta_log.swap(meta_log_);
   meta_log_.swap(new_meta_log);
+  meta_log_full_ = false;
+  meta_log_gen_++;
 
   /* Write an end record and finish the meta data zone if there is space left */
   if (old_meta_log->GetZone()->GetCapacityLeft())
@@ -461,14 +728,16 @@ IOStatus ZenFS::PersistSnapshot(ZenMetaLog* meta_writer) {
   return s;
 }
 
+/* APPEND-DOC, the caller holds files_mtx_, so its record is queued after
+ * every update it depends on. Callers that do not need files_mtx_ while the
+ * record is written queue it and release the lock before the commit (see
+ * SyncFileMetadata), those are the ones that share a batch. */
 IOStatus ZenFS::PersistRecord(std::string record) {
-  IOStatus s;
+  std::shared_ptr<MetaBatch> batch = QueueRecord(std::move(record));
+  IOStatus s = CommitRecord(batch);
 
-  std::lock_guard<std::mutex> lock(metadata_sync_mtx_);
-  s = meta_log_->AddRecord(record);
   if (s == IOStatus::NoSpace()) {
-    Info(logger_, "Current meta zone full, rolling to next meta zone");
-    s = RollMetaZoneLocked();
+    s = RollFullMetaZoneLocked(batch->log_gen);
     /* After a successfull roll, a complete snapshot has been persisted
      * - no need to write the record update */
   }
@@ -476,11 +745,77 @@ IOStatus ZenFS::PersistRecord(std::string record) {
   return s;
 }
 
+std::shared_ptr<ZenFS::MetaBatch> ZenFS::QueueRecord(std::string record) {
+  std::lock_guard<std::mutex> lock(meta_batch_mtx_);
+
+  if (!meta_batch_) meta_batch_ = std::make_shared<MetaBatch>();
+  meta_batch_->records.push_back(std::move(record));
+  return meta_batch_;
+}
+
+// APPEND-DOC, wait until the batch of the record is durable. Without a leader
+// the open batch (which holds the record) is closed and appended by this
+// caller, records queued meanwhile go to the next batch. Once the meta log is
+// full, batches fail with NoSpace until it is rolled.
+IOStatus ZenFS::CommitRecord(std::shared_ptr<MetaBatch> batch) {
+  std::unique_lock<std::mutex> lock(meta_batch_mtx_);
+
+  while (!batch->done) {
+    if (meta_batch_leader_) {
+      meta_batch_cv_.wait(lock);
+      continue;
+    }
+    assert(batch == meta_batch_);
+    meta_batch_leader_ = true;
+    std::shared_ptr<MetaBatch> leading;
+    leading.swap(meta_batch_);
+    lock.unlock();
+
+    IOStatus s;
+    uint64_t log_gen;
+    {
+      std::lock_guard<std::mutex> log_lock(metadata_sync_mtx_);
+      s = meta_log_full_ ? IOStatus::NoSpace("Meta zone full")
+                         : meta_log_->AddRecords(leading->records);
+      if (s == IOStatus::NoSpace()) meta_log_full_ = true;
+      log_gen = meta_log_gen_;
+    }
+    zbd_->GetMetrics()->ReportGeneral(ZENFS_META_BATCH_RECORDS_COUNT,
+                                      leading->records.size());
+
+    lock.lock();
+    leading->status = s;
+    leading->log_gen = log_gen;
+    leading->done = true;
+    meta_batch_leader_ = false;
+    meta_batch_cv_.notify_all();
+  }
+
+  return batch->status;
+}
+
+/* APPEND-DOC, the snapshot of a roll covers every record queued before it, so
+ * the callers of a batch that did not fit roll the meta log only once */
+IOStatus ZenFS::RollFullMetaZoneLocked(uint64_t log_gen) {
+  std::lock_guard<std::mutex> lock(metadata_sync_mtx_);
+
+  if (log_gen != meta_log_gen_) return IOStatus::OK();
+  Info(logger_, "Current meta zone full, rolling to next meta zone");
+  return RollMetaZoneLocked();
+}
+
 IOStatus ZenFS::SyncFileExtents(ZoneFile* zoneFile,
-                                std::vector<ZoneExtent*> new_extents) {
+                                const std::vector<ZoneExtent>& new_extents) {
   IOStatus s;
 
-  std::vector<ZoneExtent*> old_extents = zoneFile->GetExtents();
+  /* The extent list is replaced in place, keep the ones that moved */
+  std::vector<ZoneExtent> moved_extents;
+  const ZoneExtentList& old_extents = zoneFile->GetExtents();
+  for (size_t i = 0; i < new_extents.size(); ++i) {
+    if (old_extents[i]->start_ != new_extents[i].start_)
+      moved_extents.push_back(*old_extents[i]);
+  }
+
   zoneFile->ReplaceExtentList(new_extents);
   zoneFile->MetadataUnsynced();
   s = SyncFileMetadata(zoneFile, true);
@@ -490,39 +825,44 @@ IOStatus ZenFS::SyncFileExtents(ZoneFile* zoneFile,
   }
 
   // Clear changed extents' zone stats
-  for (size_t i = 0; i < new_extents.size(); ++i) {
-    ZoneExtent* old_ext = old_extents[i];
-    if (old_ext->start_ != new_extents[i]->start_) {
-      old_ext->zone_->used_capacity_ -= old_ext->length_;
-    }
-    delete old_ext;
+  for (const auto& old_ext : moved_extents) {
+    old_ext.zone_->used_capacity_ -= old_ext.length_;
   }
 
   return IOStatus::OK();
 }
 
 /* Must hold files_mtx_ */
-IOStatus ZenFS::SyncFileMetadataNoLock(ZoneFile* zoneFile, bool replace) {
+bool ZenFS::EncodeFileMetadataNoLock(ZoneFile* zoneFile, bool replace,
+                                     std::string* output) {
   std::string fileRecord;
-  std::string output;
-  IOStatus s;
-  ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(), ZENFS_META_SYNC_LATENCY,
-                                 Env::Default());
 
   if (zoneFile->IsDeleted()) {
     Info(logger_, "File %s has been deleted, skip sync file metadata!",
          zoneFile->GetFilename().c_str());
-    return IOStatus::OK();
+    return false;
   }
 
   if (replace) {
-    PutFixed32(&output, kFileReplace);
+    PutFixed32(output, kFileReplace);
   } else {
     zoneFile->SetFileModificationTime(time(0));
-    PutFixed32(&output, kFileUpdate);
+    PutFixed32(output, kFileUpdate);
   }
   zoneFile->EncodeUpdateTo(&fileRecord);
-  PutLengthPrefixedSlice(&output, Slice(fileRecord));
+  PutLengthPrefixedSlice(output, Slice(fileRecord));
+  return true;
+}
+
+/* Must hold files_mtx_ */
+IOStatus ZenFS::SyncFileMetadataNoLock(ZoneFile* zoneFile, bool replace) {
+  std::string output;
+  IOStatus s;
+  ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(), ZENFS_META_SYNC_LATENCY,
+                                 Env::Default());
+
+  if (!EncodeFileMetadataNoLock(zoneFile, replace, &output))
+    return IOStatus::OK();
 
   s = PersistRecord(output);
   if (s.ok()) zoneFile->MetadataSynced();
@@ -530,9 +870,30 @@ IOStatus ZenFS::SyncFileMetadataNoLock(ZoneFile* zoneFile, bool replace) {
   return s;
 }
 
+// APPEND-DOC, the record is queued under files_mtx_, but committed without
+// it, so concurrent syncs (file syncs, zone allocations) share a batch
 IOStatus ZenFS::SyncFileMetadata(ZoneFile* zoneFile, bool replace) {
-  std::lock_guard<std::mutex> lock(files_mtx_);
-  return SyncFileMetadataNoLock(zoneFile, replace);
+  std::shared_ptr<MetaBatch> batch;
+  std::string output;
+  IOStatus s;
+  ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(), ZENFS_META_SYNC_LATENCY,
+                                 Env::Default());
+
+  {
+    std::lock_guard<std::mutex> lock(files_mtx_);
+    if (!EncodeFileMetadataNoLock(zoneFile, replace, &output))
+      return IOStatus::OK();
+    batch = QueueRecord(std::move(output));
+  }
+
+  s = CommitRecord(batch);
+  if (s == IOStatus::NoSpace()) {
+    std::lock_guard<std::mutex> lock(files_mtx_);
+    s = RollFullMetaZoneLocked(batch->log_gen);
+  }
+  if (s.ok()) zoneFile->MetadataSynced();
+
+  return s;
 }
 
 /* Must hold files_mtx_ */
@@ -584,9 +945,15 @@ IOStatus ZenFS::DeleteFileNoLock(std::string fname, const IOOptions& options,
       zoneFile->SetDeleted();
 
       // APPEND-DOC, deletion record is persisted to metadata (so resetting zones should be safe)
-      // We delete immediately
+      // We delete immediately. The delete itself succeeded, a failed reset is
+      // reported like the background ones.
       if (ends_with(fname, ".log")) {
-        zoneFile->ResetWALZones();
+        IOStatus reset_s = zoneFile->ResetWALZones();
+        if (!reset_s.ok()) {
+          Error(logger_, "WAL zone reset of %s failed: %s", fname.c_str(),
+                reset_s.ToString().c_str());
+          zbd_->SetZoneDeferredStatus(reset_s);
+        }
       }
 
       zoneFile.reset();
@@ -820,7 +1187,7 @@ IOStatus ZenFS::DeleteDirRecursive(const std::string& d,
     std::lock_guard<std::mutex> lock(files_mtx_);
     s = DeleteDirRecursiveNoLock(d, options, dbg);
   }
-  if (s.ok()) s = zbd_->ResetUnusedIOZones();
+  if (s.ok()) s = zbd_->ResetUnusedIOZonesAsync();
   return s;
 }
 
@@ -856,6 +1223,7 @@ IOStatus ZenFS::OpenWritableFile(const std::string& filename,
         std::make_shared<ZoneFile>(zbd_, next_file_id_++, &metadata_writer_);
     zoneFile->SetFileModificationTime(time(0));
     zoneFile->AddLinkName(fname);
+    zoneFile->SetTenant(GetTenant(fname));
 
     /* RocksDB does not set the right io type(!)*/
     if (is_wal) {
@@ -878,7 +1246,7 @@ IOStatus ZenFS::OpenWritableFile(const std::string& filename,
         new ZonedWritableFile(zbd_, !file_opts.use_direct_writes, zoneFile));
   }
 
-  if (resetIOZones) s = zbd_->ResetUnusedIOZones();
+  if (resetIOZones) s = zbd_->ResetUnusedIOZonesAsync();
 
   return s;
 }
@@ -892,12 +1260,51 @@ IOStatus ZenFS::DeleteFile(const std::string& fname, const IOOptions& options,
   files_mtx_.lock();
   s = DeleteFileNoLock(fname, options, dbg);
   files_mtx_.unlock();
-  if (s.ok()) s = zbd_->ResetUnusedIOZones();
+  if (s.ok()) s = zbd_->ResetUnusedIOZonesAsync();
   zbd_->LogZoneStats();
 
   return s;
 }
 
+/* Splits off the handles of ZonedRandomAccessFile::ReadAsync, the device
+ * knows the handles it issued */
+static std::vector<void*> TakeZenFSReads(ZonedBlockDevice* zbd,
+                                         std::vector<void*>& io_handles,
+                                         std::vector<ZenFSAsyncRead*>* reads) {
+  std::vector<void*> aux_handles;
+  for (void* h : io_handles) {
+    if (zbd->IsAsyncRead(h))
+      reads->push_back(static_cast<ZenFSAsyncRead*>(h));
+    else
+      aux_handles.push_back(h);
+  }
+  return aux_handles;
+}
+
+IOStatus ZenFS::Poll(std::vector<void*>& io_handles, size_t min_completions) {
+  std::vector<ZenFSAsyncRead*> reads;
+  std::vector<void*> aux_handles = TakeZenFSReads(zbd_, io_handles, &reads);
+
+  /* Our reads are all completed, which covers min_completions */
+  for (ZenFSAsyncRead* read : reads) read->Complete(true);
+  if (aux_handles.empty()) return IOStatus::OK();
+
+  size_t aux_min = min_completions > reads.size()
+                       ? min_completions - reads.size()
+                       : 0;
+  return target()->Poll(aux_handles, aux_min);
+}
+
+IOStatus ZenFS::AbortIO(std::vector<void*>& io_handles) {
+  std::vector<ZenFSAsyncRead*> reads;
+  std::vector<void*> aux_handles = TakeZenFSReads(zbd_, io_handles, &reads);
+
+  /* Reads can not be cancelled, wait for them without calling back */
+  for (ZenFSAsyncRead* read : reads) read->Complete(false);
+  if (aux_handles.empty()) return IOStatus::OK();
+  return target()->AbortIO(aux_handles);
+}
+
 IOStatus ZenFS::GetFileModificationTime(const std::string& filename,
                                         const IOOptions& options,
                                         uint64_t* mtime, IODebugContext* dbg) {
@@ -1061,7 +1468,7 @@ IOStatus ZenFS::RenameFile(const std::string& source_path,
     std::lock_guard<std::mutex> lock(files_mtx_);
     s = RenameFileNoLock(source_path, dest_path, options, dbg);
   }
-  if (s.ok()) s = zbd_->ResetUnusedIOZones();
+  if (s.ok()) s = zbd_->ResetUnusedIOZonesAsync();
   return s;
 }
 
@@ -1420,6 +1827,10 @@ Status ZenFS::Mount(bool readonly) {
     std::string scratch;
     std::unique_ptr<ZenMetaLog> log = std::move(valid_logs[i]);
 
+    /* WAL files are decoded during recovery, so the WAL channels must exist */
+    s = ApplyWALOptions(valid_superblocks[i].get());
+    if (!s.ok()) return s;
+
     s = RecoverFrom(log.get());
     if (!s.ok()) {
       if (s.IsNotFound()) {
@@ -1447,6 +1858,14 @@ Status ZenFS::Mount(bool readonly) {
   superblock_ = std::move(valid_superblocks[r]);
   zbd_->SetFinishTreshold(superblock_->GetFinishTreshold());
 
+  // APPEND-DOC, WAL zones of live WALs must not be reset or reused for IO,
+  // zones of tenants are charged to their budget
+  for (const auto& file_it : files_) {
+    file_it.second->SetTenant(GetTenant(file_it.first));
+    s = file_it.second->ClaimZones();
+    if (!s.ok()) return s;
+  }
+
   IOOptions foo;
   IODebugContext bar;
   s = target()->CreateDirIfMissing(superblock_->GetAuxFsPath(), foo, &bar);
@@ -1497,6 +1916,9 @@ Status ZenFS::Mount(bool readonly) {
       run_gc_worker_ = true;
       gc_worker_.reset(new std::thread(&ZenFS::GCWorker, this));
     }
+
+    Info(logger_, "Starting zone reset worker");
+    zbd_->StartResetWorker();
   }
 
   LogFiles();
@@ -1504,8 +1926,78 @@ Status ZenFS::Mount(bool readonly) {
   return Status::OK();
 }
 
+Status ZenFS::AddTenant(const std::string& path_prefix,
+                       const ZenFSTenantOptions& options) {
+  if (superblock_ != nullptr)
+    return Status::InvalidArgument("Tenants must be added before mount");
+
+  std::string prefix = FormatPathLexically(path_prefix);
+  for (const auto& t : tenant_prefixes_) {
+    if (t.first == prefix)
+      return Status::InvalidArgument("Duplicate tenant: " + prefix);
+  }
+
+  uint32_t tenant;
+  IOStatus s = zbd_->AddTenant(options, &tenant);
+  if (!s.ok()) return s;
+
+  tenant_prefixes_.push_back(std::make_pair(prefix, tenant));
+  Info(logger_, "Tenant %u: %s", tenant, prefix.c_str());
+  return Status::OK();
+}
+
+// APPEND-DOC, the longest tenant prefix that is a parent of (or equal to) fname
+uint32_t ZenFS::GetTenant(const std::string& fname) {
+  uint32_t tenant = ZENFS_DEFAULT_TENANT;
+  size_t best_len = 0;
+
+  for (const auto& t : tenant_prefixes_) {
+    const std::string& prefix = t.first;
+    if (prefix.size() <= best_len || fname.compare(0, prefix.size(), prefix))
+      continue;
+    if (fname.size() == prefix.size() || fname[prefix.size()] == '/' ||
+        prefix.back() == '/') {
+      tenant = t.second;
+      best_len = prefix.size();
+    }
+  }
+  return tenant;
+}
+
+Status ZenFS::ApplyWALOptions(Superblock* super_block) {
+  ZWALOptions wal_options = super_block->GetWALOptions();
+
+  if (wal_options_override_.buffer_size_kb)
+    wal_options.buffer_size_kb = wal_options_override_.buffer_size_kb;
+  if (wal_options_override_.barrier_size_kb)
+    wal_options.barrier_size_kb = wal_options_override_.barrier_size_kb;
+  if (wal_options_override_.barrier_min_kb)
+    wal_options.barrier_min_kb = wal_options_override_.barrier_min_kb;
+  if (wal_options_override_.barrier_max_kb)
+    wal_options.barrier_max_kb = wal_options_override_.barrier_max_kb;
+  if (wal_options_override_.depth)
+    wal_options.depth = wal_options_override_.depth;
+  if (wal_options_override_.channels)
+    wal_options.channels = wal_options_override_.channels;
+  if (wal_options_override_.sst_zone_appends)
+    wal_options.sst_zone_appends = true;
+  if (wal_options_override_.reserve_io_zones)
+    wal_options.reserve_io_zones = wal_options_override_.reserve_io_zones;
+  if (wal_options_override_.reserve_wal_ranges)
+    wal_options.reserve_wal_ranges = wal_options_override_.reserve_wal_ranges;
+  if (wal_options_override_.gc_threads)
+    wal_options.gc_threads = wal_options_override_.gc_threads;
+  if (wal_options_override_.gc_bandwidth_mb)
+    wal_options.gc_bandwidth_mb = wal_options_override_.gc_bandwidth_mb;
+
+  Status s = ResolveWALOptions(&wal_options);
+  if (!s.ok()) return s;
+
+  return zbd_->SetWALOptions(wal_options);
+}
+
 Status ZenFS::MkFS(std::string aux_fs_p, uint32_t finish_threshold,
-                   bool enable_gc) {
+                   bool enable_gc, ZWALOptions wal_options) {
   std::vector<Zone*> metazones = zbd_->GetMetaZones();
   std::unique_ptr<ZenMetaLog> log;
   Zone* meta_zone = nullptr;
@@ -1516,6 +2008,8 @@ Status ZenFS::MkFS(std::string aux_fs_p, uint32_t finish_threshold,
     return Status::InvalidArgument(
         "Aux filesystem path must be less than 256 bytes\n");
   }
+  Status ws = ResolveWALOptions(&wal_options);
+  if (!ws.ok()) return ws;
   ClearFiles();
   IOStatus status = zbd_->ResetUnusedIOZones();
   if (!status.ok()) return status;
@@ -1549,7 +2043,8 @@ Status ZenFS::MkFS(std::string aux_fs_p, uint32_t finish_threshold,
 
   log.reset(new ZenMetaLog(zbd_, meta_zone));
 
-  Superblock super(zbd_, aux_fs_path, finish_threshold, enable_gc);
+  Superblock super(zbd_, aux_fs_path, finish_threshold, enable_gc,
+                   wal_options);
   std::string super_string;
   super.EncodeTo(&super_string);
 
@@ -1601,6 +2096,22 @@ Status NewZenFS(FileSystem** fs, const std::string& bdevname,
 Status NewZenFS(FileSystem** fs, const ZbdBackendType backend_type,
                 const std::string& backend_name,
                 std::shared_ptr<ZenFSMetrics> metrics) {
+  return NewZenFS(fs, backend_type, backend_name, ZWALOptions(), metrics);
+}
+
+Status NewZenFS(FileSystem** fs, const ZbdBackendType backend_type,
+                const std::string& backend_name,
+                const ZWALOptions& wal_options,
+                std::shared_ptr<ZenFSMetrics> metrics) {
+  return NewZenFS(fs, backend_type, backend_name, wal_options,
+                  ZenFSTenantList(), metrics);
+}
+
+Status NewZenFS(FileSystem** fs, const ZbdBackendType backend_type,
+                const std::string& backend_name,
+                const ZWALOptions& wal_options,
+                const ZenFSTenantList& tenants,
+                std::shared_ptr<ZenFSMetrics> metrics) {
   std::shared_ptr<Logger> logger;
   Status s;
 
@@ -1631,6 +2142,14 @@ Status NewZenFS(FileSystem** fs, const ZbdBackendType backend_type,
   }
 
   ZenFS* zenFS = new ZenFS(zbd, FileSystem::Default(), logger);
+  zenFS->SetWALOptions(wal_options);
+  for (const auto& t : tenants) {
+    s = zenFS->AddTenant(t.first, t.second);
+    if (!s.ok()) {
+      delete zenFS;
+      return s;
+    }
+  }
   s = zenFS->Mount(false);
   if (!s.ok()) {
     delete zenFS;
@@ -1735,11 +2254,15 @@ void ZenFS::GetZenFSSnapshot(ZenFSSnapshot& snapshot,
       /* Skip files open for writing, as extents are being updated */
       if (!file.TryAcquireWRLock()) continue;
 
-      // file -> extents mapping
-      snapshot.zone_files_.emplace_back(file);
-      // extent -> file mapping
-      for (auto* ext : file.GetExtents()) {
-        snapshot.extents_.emplace_back(*ext, file.GetFilename());
+      {
+        /* The extent list is walked in place, not copied */
+        ZoneFile::ReadLock lck(&file);
+        // file -> extents mapping
+        snapshot.zone_files_.emplace_back(file);
+        // extent -> file mapping
+        for (const auto* ext : file.GetExtents()) {
+          snapshot.extents_.emplace_back(*ext, file.GetFilename());
+        }
       }
 
       file.ReleaseWRLock();
@@ -1755,6 +2278,8 @@ void ZenFS::GetZenFSSnapshot(ZenFSSnapshot& snapshot,
   }
 }
 
+// APPEND-DOC, files are migrated by up to gc_threads threads, the first error
+// stops the migration
 IOStatus ZenFS::MigrateExtents(
     const std::vector<ZoneExtentSnapshot*>& extents) {
   IOStatus s;
@@ -1768,12 +2293,37 @@ IOStatus ZenFS::MigrateExtents(
     }
   }
 
-  for (const auto& it : file_extents) {
-    s = MigrateFileExtents(it.first, it.second);
-    if (!s.ok()) break;
-    s = zbd_->ResetUnusedIOZones();
-    if (!s.ok()) break;
-  }
+  std::vector<const std::pair<const std::string,
+                              std::vector<ZoneExtentSnapshot*>>*>
+      files;
+  for (const auto& it : file_extents) files.push_back(&it);
+
+  std::atomic<size_t> next_file{0};
+  std::mutex status_mtx;
+  auto migrate = [&]() {
+    size_t i;
+    while ((i = next_file++) < files.size()) {
+      {
+        std::lock_guard<std::mutex> lock(status_mtx);
+        if (!s.ok()) return;
+      }
+      IOStatus file_s = MigrateFileExtents(files[i]->first, files[i]->second);
+      if (file_s.ok()) file_s = zbd_->ResetUnusedIOZonesAsync();
+      if (!file_s.ok()) {
+        std::lock_guard<std::mutex> lock(status_mtx);
+        if (s.ok()) s = file_s;
+        return;
+      }
+    }
+  };
+
+  size_t nr_threads =
+      std::min<size_t>(std::max(zbd_->GCThreads(), 1u), files.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < nr_threads; i++) threads.emplace_back(migrate);
+  migrate();
+  for (auto& t : threads) t.join();
+
   return s;
 }
 
@@ -1781,6 +2331,8 @@ IOStatus ZenFS::MigrateFileExtents(
     const std::string& fname,
     const std::vector<ZoneExtentSnapshot*>& migrate_exts) {
   IOStatus s = IOStatus::OK();
+  ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(),
+                                 ZENFS_GC_MIGRATE_FILE_LATENCY, Env::Default());
   Info(logger_, "MigrateFileExtents, fname: %s, extent count: %lu",
        fname.data(), migrate_exts.size());
 
@@ -1796,15 +2348,14 @@ IOStatus ZenFS::MigrateFileExtents(
     return IOStatus::OK();
   }
 
-  std::vector<ZoneExtent*> new_extent_list;
-  std::vector<ZoneExtent*> extents = zfile->GetExtents();
-  for (const auto* ext : extents) {
-    new_extent_list.push_back(
-        new ZoneExtent(ext->start_, ext->length_, ext->zone_));
+  std::vector<ZoneExtent> new_extent_list;
+  for (const auto* ext : zfile->GetExtents()) {
+    new_extent_list.push_back(*ext);
   }
 
   // Modify the new extent list
-  for (ZoneExtent* ext : new_extent_list) {
+  for (ZoneExtent& extent : new_extent_list) {
+    ZoneExtent* ext = &extent;
     // Check if current extent need to be migrated
     auto it = std::find_if(migrate_exts.begin(), migrate_exts.end(),
                            [&](const ZoneExtentSnapshot* ext_snapshot) {
@@ -1821,9 +2372,9 @@ IOStatus ZenFS::MigrateFileExtents(
 
     // Allocate a new migration zone.
     s = zbd_->TakeMigrateZone(&target_zone, zfile->GetWriteLifeTimeHint(),
-                              ext->length_);
+                              ext->length_, zfile->GetTenant());
     if (!s.ok()) {
-      continue;
+      break;
     }
 
     if (target_zone == nullptr) {
@@ -1841,17 +2392,24 @@ IOStatus ZenFS::MigrateFileExtents(
       uint64_t header_size = ZoneFile::SPARSE_HEADER_SIZE + 
         (zfile->IsWAL() * ZoneFile::SPARSE_WAL_HEADER_SIZE); 
       target_start = target_zone->wp_ + header_size;
-      zfile->MigrateData(ext->start_ - header_size,
-                         ext->length_ + header_size,
-                         target_zone);
-      zbd_->AddGCBytesWritten(ext->length_ + header_size);
+      s = zfile->MigrateData(ext->start_ - header_size,
+                             ext->length_ + header_size, target_zone);
+      if (s.ok()) zbd_->AddGCBytesWritten(ext->length_ + header_size);
     } else {
-      zfile->MigrateData(ext->start_, ext->length_, target_zone);
-      zbd_->AddGCBytesWritten(ext->length_);
+      s = zfile->MigrateData(ext->start_, ext->length_, target_zone);
+      if (s.ok()) zbd_->AddGCBytesWritten(ext->length_);
+    }
+
+    // Keep the extents migrated so far, this one stays where it is
+    if (!s.ok()) {
+      Error(logger_, "Migrate extent failed, fname: %s, ext_start: %lu",
+            fname.data(), ext->start_);
+      zbd_->ReleaseMigrateZone(target_zone);
+      break;
     }
 
     // If the file doesn't exist, skip
-    if (GetFileNoLock(fname) == nullptr) {
+    if (GetFile(fname) == nullptr) {
       Info(logger_, "Migrate file not exist anymore.");
       zbd_->ReleaseMigrateZone(target_zone);
       break;
@@ -1864,12 +2422,13 @@ IOStatus ZenFS::MigrateFileExtents(
     zbd_->ReleaseMigrateZone(target_zone);
   }
 
-  SyncFileExtents(zfile.get(), new_extent_list);
+  IOStatus sync_s = SyncFileExtents(zfile.get(), new_extent_list);
   zfile->ReleaseWRLock();
+  if (s.ok()) s = sync_s;
 
   Info(logger_, "MigrateFileExtents Finished, fname: %s, extent count: %lu",
        fname.data(), migrate_exts.size());
-  return IOStatus::OK();
+  return s;
 }
 
 extern "C" FactoryFunc<FileSystem> zenfs_filesystem_reg;
@@ -1888,16 +2447,33 @@ FactoryFunc<FileSystem> zenfs_filesystem_reg =
 #endif
           std::string devID = uri;
           FileSystem* fs = nullptr;
+          ZWALOptions wal_options;
+          ZenFSTenantList tenants;
           Status s;
 
           devID.replace(0, strlen("zenfs://"), "");
+
+          // APPEND-DOC, optional ZWAL options: zenfs://dev:<dev>?wal_depth=32
+          // and tenants: ?tenant=/db0:4:4:12:2&tenant=/db1:4:4:12:2
+          size_t query = devID.find('?');
+          if (query != std::string::npos) {
+            s = ParseURIOptions(devID.substr(query + 1), &wal_options,
+                                &tenants);
+            devID.erase(query);
+            if (!s.ok()) {
+              *errmsg = s.ToString();
+              return f->get();
+            }
+          }
+
           if (devID.rfind("dev:") == 0) {
             devID.replace(0, strlen("dev:"), "");
 #ifdef ZENFS_EXPORT_PROMETHEUS
-            s = NewZenFS(&fs, ZbdBackendType::kBlockDev, devID,
-                         std::make_shared<ZenFSPrometheusMetrics>());
+            s = NewZenFS(&fs, ZbdBackendType::kBlockDev, devID, wal_options,
+                         tenants, std::make_shared<ZenFSPrometheusMetrics>());
 #else
-            s = NewZenFS(&fs, ZbdBackendType::kBlockDev, devID);
+            s = NewZenFS(&fs, ZbdBackendType::kBlockDev, devID, wal_options,
+                         tenants);
 #endif
             if (!s.ok()) {
               *errmsg = s.ToString();
@@ -1917,11 +2493,11 @@ FactoryFunc<FileSystem> zenfs_filesystem_reg =
 
 #ifdef ZENFS_EXPORT_PROMETHEUS
                 s = NewZenFS(&fs, zenFileSystems[devID].second,
-                             zenFileSystems[devID].first,
+                             zenFileSystems[devID].first, wal_options, tenants,
                              std::make_shared<ZenFSPrometheusMetrics>());
 #else
                 s = NewZenFS(&fs, zenFileSystems[devID].second,
-                             zenFileSystems[devID].first);
+                             zenFileSystems[devID].first, wal_options, tenants);
 #endif
                 if (!s.ok()) {
                   *errmsg = s.ToString();
@@ -1930,7 +2506,16 @@ FactoryFunc<FileSystem> zenfs_filesystem_reg =
             }
           } else if (devID.rfind("zonefs:") == 0) {
             devID.replace(0, strlen("zonefs:"), "");
-            s = NewZenFS(&fs, ZbdBackendType::kZoneFS, devID);
+            s = NewZenFS(&fs, ZbdBackendType::kZoneFS, devID, wal_options,
+                         tenants);
+            if (!s.ok()) {
+              *errmsg = s.ToString();
+            }
+          } else if (devID.rfind("emu:") == 0) {
+            // APPEND-DOC, emulated device, zenfs://emu:<file or mem>,zones=..
+            devID.replace(0, strlen("emu:"), "");
+            s = NewZenFS(&fs, ZbdBackendType::kEmulated, devID, wal_options,
+                         tenants);
             if (!s.ok()) {
               *errmsg = s.ToString();
             }
@@ -14,6 +14,8 @@ namespace fs = filesystem_utility;
 namespace fs = std::filesystem;
 #endif
 
+#include <condition_variable>
+#include <map>
 #include <memory>
 #include <thread>
 
@@ -47,7 +49,18 @@ class Superblock {
   char aux_fs_path_[256] = {0};
   uint32_t finish_treshold_ = 0;
   char zenfs_version_[64]{0};
-  char reserved_[123] = {0};
+  // APPEND-DOC, ZWAL tunables (0 = compile-time default)
+  uint32_t wal_buffer_size_kb_ = 0;
+  uint32_t wal_barrier_size_kb_ = 0;
+  uint32_t wal_depth_ = 0;
+  uint32_t wal_channels_ = 0;
+  uint32_t wal_barrier_min_kb_ = 0;
+  uint32_t wal_barrier_max_kb_ = 0; /* 0 = fixed barrier */
+  uint32_t reserve_io_zones_ = 0;
+  uint32_t reserve_wal_ranges_ = 0;
+  uint32_t gc_threads_ = 0;
+  uint32_t gc_bandwidth_mb_ = 0; /* 0 = unlimited */
+  char reserved_[83] = {0};
 
  public:
   const uint32_t MAGIC = 0x5a454e46; /* ZENF */
@@ -55,13 +68,16 @@ class Superblock {
   const uint32_t CURRENT_SUPERBLOCK_VERSION = 2;
   const uint32_t DEFAULT_FLAGS = 0;
   const uint32_t FLAGS_ENABLE_GC = 1 << 0;
+  // APPEND-DOC, SSTs zone append to shared zones
+  const uint32_t FLAGS_SST_ZONE_APPENDS = 1 << 1;
 
   Superblock() {}
 
   /* Create a superblock for a filesystem covering the entire zoned block device
    */
   Superblock(ZonedBlockDevice* zbd, std::string aux_fs_path = "",
-             uint32_t finish_threshold = 0, bool enable_gc = false) {
+             uint32_t finish_threshold = 0, bool enable_gc = false,
+             ZWALOptions wal_options = ZWALOptions()) {
     std::string uuid = Env::Default()->GenerateUniqueId();
     int uuid_len =
         std::min(uuid.length(),
@@ -71,9 +87,21 @@ class Superblock {
     superblock_version_ = CURRENT_SUPERBLOCK_VERSION;
     flags_ = DEFAULT_FLAGS;
     if (enable_gc) flags_ |= FLAGS_ENABLE_GC;
+    if (wal_options.sst_zone_appends) flags_ |= FLAGS_SST_ZONE_APPENDS;
 
     finish_treshold_ = finish_threshold;
 
+    wal_buffer_size_kb_ = wal_options.buffer_size_kb;
+    wal_barrier_size_kb_ = wal_options.barrier_size_kb;
+    wal_depth_ = wal_options.depth;
+    wal_channels_ = wal_options.channels;
+    wal_barrier_min_kb_ = wal_options.barrier_min_kb;
+    wal_barrier_max_kb_ = wal_options.barrier_max_kb;
+    reserve_io_zones_ = wal_options.reserve_io_zones;
+    reserve_wal_ranges_ = wal_options.reserve_wal_ranges;
+    gc_threads_ = wal_options.gc_threads;
+    gc_bandwidth_mb_ = wal_options.gc_bandwidth_mb;
+
     block_size_ = zbd->GetBlockSize();
     zone_size_ = zbd->GetZoneSize() / block_size_;
     nr_zones_ = zbd->GetNrZones();
@@ -95,6 +123,21 @@ class Superblock {
   uint32_t GetFinishTreshold() { return finish_treshold_; }
   std::string GetUUID() { return std::string(uuid_); }
   bool IsGCEnabled() { return flags_ & FLAGS_ENABLE_GC; };
+  ZWALOptions GetWALOptions() {
+    ZWALOptions wal_options;
+    wal_options.buffer_size_kb = wal_buffer_size_kb_;
+    wal_options.barrier_size_kb = wal_barrier_size_kb_;
+    wal_options.depth = wal_depth_;
+    wal_options.channels = wal_channels_;
+    wal_options.barrier_min_kb = wal_barrier_min_kb_;
+    wal_options.barrier_max_kb = wal_barrier_max_kb_;
+    wal_options.reserve_io_zones = reserve_io_zones_;
+    wal_options.reserve_wal_ranges = reserve_wal_ranges_;
+    wal_options.gc_threads = gc_threads_;
+    wal_options.gc_bandwidth_mb = gc_bandwidth_mb_;
+    wal_options.sst_zone_appends = flags_ & FLAGS_SST_ZONE_APPENDS;
+    return wal_options;
+  }
 };
 
 class ZenMetaLog {
@@ -107,6 +150,10 @@ class ZenMetaLog {
    * bits) */
   const size_t zMetaHeaderSize = sizeof(uint32_t) * 2;
 
+  /* APPEND-DOC, aligned buffer of the appends, reused and grown as needed */
+  char* buffer_ = nullptr;
+  size_t buffer_sz_ = 0;
+
  public:
   ZenMetaLog(ZonedBlockDevice* zbd, Zone* zone) {
     assert(zone->IsBusy());
@@ -117,6 +164,7 @@ class ZenMetaLog {
   }
 
   virtual ~ZenMetaLog() {
+    free(buffer_);
     // TODO: report async error status
     bool ok = zone_->Release();
     assert(ok);
@@ -124,12 +172,18 @@ class ZenMetaLog {
   }
 
   IOStatus AddRecord(const Slice& slice);
+  // APPEND-DOC, appends the records with a single write, every record still
+  // starts on a block boundary
+  IOStatus AddRecords(const std::vector<std::string>& records);
   IOStatus ReadRecord(Slice* record, std::string* scratch);
 
   Zone* GetZone() { return zone_; };
 
  private:
   IOStatus Read(Slice* slice);
+  IOStatus ReserveBuffer(size_t size);
+  size_t PhysicalSize(size_t record_sz);
+  void EncodeRecord(const Slice& slice, char* dst);
 };
 
 class ZenFS : public FileSystemWrapper {
@@ -142,7 +196,28 @@ class ZenFS : public FileSystemWrapper {
   Zone* cur_meta_zone_ = nullptr;
   std::unique_ptr<ZenMetaLog> meta_log_;
   std::mutex metadata_sync_mtx_;
+  /* Must hold metadata_sync_mtx_ */
+  bool meta_log_full_ = false;
+  uint64_t meta_log_gen_ = 0; /* rolls of the meta log */
+
+  // APPEND-DOC, group commit of metadata records. Records are queued in the
+  // open batch, the first waiter appends the whole batch with one write while
+  // the next batch fills up.
+  struct MetaBatch {
+    std::vector<std::string> records;
+    bool done = false;
+    IOStatus status;
+    uint64_t log_gen = 0; /* meta log the batch was written to */
+  };
+  std::mutex meta_batch_mtx_;
+  std::condition_variable meta_batch_cv_;
+  std::shared_ptr<MetaBatch> meta_batch_;
+  bool meta_batch_leader_ = false;
   std::unique_ptr<Superblock> superblock_;
+  // APPEND-DOC, per-mount overrides of the superblock ZWAL options
+  ZWALOptions wal_options_override_;
+  // APPEND-DOC, path prefix (e.g. DB directory) of every tenant
+  std::vector<std::pair<std::string, uint32_t>> tenant_prefixes_;
 
   std::shared_ptr<Logger> GetLogger() { return logger_; }
 
@@ -175,9 +250,17 @@ class ZenFS : public FileSystemWrapper {
   IOStatus WriteEndRecord(ZenMetaLog* meta_log);
   IOStatus RollMetaZoneLocked();
   IOStatus PersistSnapshot(ZenMetaLog* meta_writer);
+  /* Must hold files_mtx_ */
   IOStatus PersistRecord(std::string record);
+  std::shared_ptr<MetaBatch> QueueRecord(std::string record);
+  IOStatus CommitRecord(std::shared_ptr<MetaBatch> batch);
+  /* Must hold files_mtx_ */
+  IOStatus RollFullMetaZoneLocked(uint64_t log_gen);
   IOStatus SyncFileExtents(ZoneFile* zoneFile,
-                           std::vector<ZoneExtent*> new_extents);
+                           const std::vector<ZoneExtent>& new_extents);
+  /* Must hold files_mtx_, false if there is nothing to sync */
+  bool EncodeFileMetadataNoLock(ZoneFile* zoneFile, bool replace,
+                                std::string* output);
   /* Must hold files_mtx_ */
   IOStatus SyncFileMetadataNoLock(ZoneFile* zoneFile, bool replace = false);
   /* Must hold files_mtx_ */
@@ -200,6 +283,8 @@ class ZenFS : public FileSystemWrapper {
   Status DecodeFileDeletionFrom(Slice* slice);
 
   Status RecoverFrom(ZenMetaLog* log);
+  // APPEND-DOC, apply the superblock ZWAL options (and overrides) to the zbd
+  Status ApplyWALOptions(Superblock* super_block);
 
   std::string ToAuxPath(std::string path) {
     return superblock_->GetAuxFsPath() + path;
@@ -280,7 +365,15 @@ class ZenFS : public FileSystemWrapper {
 
   Status Mount(bool readonly);
   Status MkFS(std::string aux_fs_path, uint32_t finish_threshold,
-              bool enable_gc);
+              bool enable_gc, ZWALOptions wal_options = ZWALOptions());
+  void SetWALOptions(const ZWALOptions& wal_options) {
+    wal_options_override_ = wal_options;
+  }
+  // APPEND-DOC, files below path_prefix allocate from their own zone budget,
+  // must be called before Mount
+  Status AddTenant(const std::string& path_prefix,
+                   const ZenFSTenantOptions& options);
+  uint32_t GetTenant(const std::string& fname);
   std::map<std::string, Env::WriteLifeTimeHint> GetWriteLifeTimeHints();
 
   const char* Name() const override {
@@ -337,6 +430,13 @@ class ZenFS : public FileSystemWrapper {
   IOStatus RenameFile(const std::string& f, const std::string& t,
                       const IOOptions& options, IODebugContext* dbg) override;
 
+  // APPEND-DOC, completes the reads of ZonedRandomAccessFile::ReadAsync,
+  // handles of the aux file system are passed on
+  IOStatus Poll(std::vector<void*>& io_handles,
+                size_t min_completions) override;
+  IOStatus AbortIO(std::vector<void*>& io_handles) override;
+  bool use_async_io() override { return true; }
+
   IOStatus GetFreeSpace(const std::string& /*path*/,
                         const IOOptions& /*options*/, uint64_t* diskfree,
                         IODebugContext* /*dbg*/) override {
@@ -460,7 +560,12 @@ class ZenFS : public FileSystemWrapper {
  private:
   const uint64_t GC_START_LEVEL =
       20;                      /* Enable GC when < 20% free space available */
-  const uint64_t GC_SLOPE = 3; /* GC agressiveness */
+  const uint64_t GC_MIN_GARBAGE = 10; /* Never collect zones below 10% garbage */
+  const size_t GC_MAX_VICTIMS = 16;   /* Zones collected per round */
+  const uint64_t GC_IDLE_INTERVAL_MS = 10000;
+  const uint64_t GC_BUSY_INTERVAL_MS = 100; /* Next round right after work */
+  /* When the GC worker first saw a zone full, by zone start */
+  std::map<uint64_t, uint64_t> gc_zone_full_us_;
   void GCWorker();
 };
 #endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -472,6 +577,17 @@ Status NewZenFS(
     FileSystem** fs, const ZbdBackendType backend_type,
     const std::string& backend_name,
     std::shared_ptr<ZenFSMetrics> metrics = std::make_shared<NoZenFSMetrics>());
+Status NewZenFS(
+    FileSystem** fs, const ZbdBackendType backend_type,
+    const std::string& backend_name, const ZWALOptions& wal_options,
+    std::shared_ptr<ZenFSMetrics> metrics = std::make_shared<NoZenFSMetrics>());
+// APPEND-DOC, (path prefix, budget) of every tenant sharing the device
+typedef std::vector<std::pair<std::string, ZenFSTenantOptions>> ZenFSTenantList;
+Status NewZenFS(
+    FileSystem** fs, const ZbdBackendType backend_type,
+    const std::string& backend_name, const ZWALOptions& wal_options,
+    const ZenFSTenantList& tenants,
+    std::shared_ptr<ZenFSMetrics> metrics = std::make_shared<NoZenFSMetrics>());
 Status AppendZenFileSystem(
     std::string path, ZbdBackendType backend,
     std::map<std::string, std::pair<std::string, ZbdBackendType>>& fs_list);
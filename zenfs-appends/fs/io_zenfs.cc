@@ -11,6 +11,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <libzbd/zbd.h>
 #include <linux/blkzoned.h>
 #include <stdlib.h>
@@ -46,12 +47,12 @@ Status ZoneExtent::DecodeFrom(Slice* input) {
   return Status::OK();
 }
 
-void ZoneExtent::EncodeTo(std::string* output) {
+void ZoneExtent::EncodeTo(std::string* output) const {
   PutFixed64(output, start_);
   PutFixed64(output, length_);
 }
 
-void ZoneExtent::EncodeJson(std::ostream& json_stream) {
+void ZoneExtent::EncodeJson(std::ostream& json_stream) const {
   json_stream << "{";
   json_stream << "\"start\":" << start_ << ",";
   json_stream << "\"length\":" << length_;
@@ -70,6 +71,12 @@ enum ZoneFileTag : uint32_t {
   kLinkedFilename = 9,
   // APPEND-DOC, we need an additional tag to mark WAL appends
   kWALSeq = 10,
+  // APPEND-DOC, barrier size the WAL was written with
+  kWALBarrierSize = 11,
+  // APPEND-DOC, contiguous zones owned by the WAL
+  kWALZones = 12,
+  // APPEND-DOC, the WAL adapts its barrier, chunks carry their barrier
+  kWALBarrierAdaptive = 13,
 };
 
 void ZoneFile::EncodeTo(std::string* output, uint32_t extent_start) {
@@ -97,6 +104,16 @@ void ZoneFile::EncodeTo(std::string* output, uint32_t extent_start) {
     //   wal_seq_.load(std::memory_order_consume));
     PutFixed32(output, kWALSeq);
     PutFixed64(output, wal_seq_.load(std::memory_order_consume));
+#ifdef WAL_BARRIERS
+    PutFixed32(output, kWALBarrierSize);
+    PutFixed64(output, wal_barrier_sz_);
+    if (wal_barrier_adaptive_) PutFixed32(output, kWALBarrierAdaptive);
+#endif
+    if (wal_range_.nr > 0) {
+      PutFixed32(output, kWALZones);
+      PutFixed64(output, wal_range_.start);
+      PutFixed64(output, wal_range_.nr);
+    }
   }
 
   PutFixed32(output, kModificationTime);
@@ -162,12 +179,15 @@ Status ZoneFile::DecodeFrom(Slice* input) {
   if (tag != kFileID || !GetFixed64(input, &file_id_))
     return Status::Corruption("ZoneFile", "File ID missing");
 
+#ifdef WAL_BARRIERS
+  /* Recovered WALs keep the barrier mode they were written with */
+  wal_barrier_adaptive_ = false;
+#endif
+
   while (true) {
     Slice slice;
-    ZoneExtent* extent;
+    ZoneExtent extent(0, 0, nullptr);
     Status s;
-    // APPEND-DOC, we will use a once_log to store the WAL
-    SZD::SZDOnceLog *wal_pos;
 
     if (!GetFixed32(input, &tag)) break;
 
@@ -183,34 +203,20 @@ Status ZoneFile::DecodeFrom(Slice* input) {
         lifetime_ = (Env::WriteLifeTimeHint)lt;
         break;
       case kExtent:
-        extent = new ZoneExtent(0, 0, nullptr);
         GetLengthPrefixedSlice(input, &slice);
-        s = extent->DecodeFrom(&slice);
-        if (!s.ok()) {
-          delete extent;
-          return s;
-        }
-        extent->zone_ = zbd_->GetIOZone(extent->start_);
-        if (!extent->zone_)
+        s = extent.DecodeFrom(&slice);
+        if (!s.ok()) return s;
+        extent.zone_ = zbd_->GetIOZone(extent.start_);
+        if (!extent.zone_)
           return Status::Corruption("ZoneFile", "Invalid zone extent");
-        extent->zone_->used_capacity_ += extent->length_;
+        extent.zone_->used_capacity_ += extent.length_;
 
-        align = extent->length_ % 4096;
+        align = extent.length_ % 4096;
         if (align) {
           pad_sz += 4096 - align;
         }
 
-        extents_.push_back(extent);
-
-        // APPEND-DOC, Along with the extents, we need to decode the once log.
-        if (wal_ == nullptr) {
-          wal_pos = zbd_->GetWAL(extent->start_);
-          if (wal_pos != nullptr) {
-            // printf("WAL reinited at %lu\n", extent->zone_->GetZoneNr());
-            wal_ = wal_pos;
-          }
-        }
-
+        AddExtent(extent.start_, extent.length_, extent.zone_);
         break;
       case kModificationTime:
         uint64_t ct;
@@ -244,6 +250,24 @@ Status ZoneFile::DecodeFrom(Slice* input) {
         // printf("Recovered wal sequence number %lu\n", wal_seq);
         wal_seq_.store(wal_seq, std::memory_order_acquire);
         break;
+      case kWALBarrierSize:
+        uint64_t wal_barrier_sz;
+        if (!GetFixed64(input, &wal_barrier_sz) || wal_barrier_sz == 0)
+          return Status::Corruption("ZoneFile", "Missing WAL barrier size");
+#ifdef WAL_BARRIERS
+        wal_barrier_sz_ = wal_barrier_sz;
+#endif
+        break;
+      case kWALBarrierAdaptive:
+#ifdef WAL_BARRIERS
+        wal_barrier_adaptive_ = true;
+#endif
+        break;
+      case kWALZones:
+        if (!GetFixed64(input, &wal_range_.start) ||
+            !GetFixed64(input, &wal_range_.nr) || wal_range_.nr == 0)
+          return Status::Corruption("ZoneFile", "Missing WAL zones");
+        break;
       default:
         return Status::Corruption("ZoneFile", "Unexpected tag");
     }
@@ -251,12 +275,14 @@ Status ZoneFile::DecodeFrom(Slice* input) {
 
   if (is_wal) {
   #ifdef WAL_BARRIERS
-    append_bytes_since_last_barrier_ = (file_size_ + pad_sz) % (WAL_BARRIER_SIZE_IN_KB * KiB);
+    append_bytes_since_last_barrier_ = (file_size_ + pad_sz) % wal_barrier_sz_;
+    wal_barrier_resume_ = wal_barrier_adaptive_;
   #endif
 
-    if (wal_) {
-      uint64_t wal_size = (wal_->GetWriteHead() - wal_->GetWriteTail()) * 4096;
-      printf("WAL size %lu \n", wal_size);
+    // APPEND-DOC, WALs written before kWALZones own the fixed run of their first zone
+    if (wal_range_.nr == 0 && extents_.size()) {
+      wal_range_.start = extents_[0]->zone_->GetZoneNr();
+      wal_range_.nr = ZENFS_ZONES_FOREACH_WAL;
     }
 
     uint64_t ext = extents_.size() ? (extents_[0]->start_ / zbd_->GetZoneSize()) : 0xdeadbeef;
@@ -283,18 +309,24 @@ Status ZoneFile::MergeUpdate(std::shared_ptr<ZoneFile> update, bool replace) {
     wal_seq_.store(update->GetWALSeq(), std::memory_order_acquire);
     // printf("WAL seq %s updated to %lu \n", GetFilename().c_str(), wal_seq_.load(std::memory_order_consume));
   }
+#ifdef WAL_BARRIERS
+  wal_barrier_sz_ = update->GetWALBarrierSize();
+  wal_barrier_adaptive_ = update->IsWALBarrierAdaptive();
+  wal_barrier_resume_ = wal_barrier_adaptive_;
+#endif
+  if (update->GetWALZones().nr > 0) {
+    wal_range_ = update->GetWALZones();
+  }
 
   if (replace) {
     // printf("Replacing is a hack that should be illegal\n");
     ClearExtents();
   }
 
-  std::vector<ZoneExtent*> update_extents = update->GetExtents();
-  for (long unsigned int i = 0; i < update_extents.size(); i++) {
-    ZoneExtent* extent = update_extents[i];
+  for (const ZoneExtent* extent : update->GetExtents()) {
     Zone* zone = extent->zone_;
     zone->used_capacity_ += extent->length_;
-    extents_.push_back(new ZoneExtent(extent->start_, extent->length_, zone));
+    AddExtent(extent->start_, extent->length_, zone);
   }
   extent_start_ = update->GetExtentStart();
   is_sparse_ = update->IsSparse();
@@ -318,7 +350,13 @@ ZoneFile::ZoneFile(ZonedBlockDevice* zbd, uint64_t file_id,
       file_id_(file_id),
       nr_synced_extents_(0),
       m_time_(0),
-      metadata_writer_(metadata_writer) {}
+      metadata_writer_(metadata_writer) {
+#ifdef WAL_BARRIERS
+  // APPEND-DOC, new WALs use the barrier of the mount, recovered WALs their own
+  wal_barrier_sz_ = zbd_->GetWALOptions().barrier_size_kb * KiB;
+  wal_barrier_adaptive_ = zbd_->GetWALOptions().barrier_max_kb > 0;
+#endif
+}
 
 std::string ZoneFile::GetFilename() { return linkfiles_[0]; }
 time_t ZoneFile::GetFileModificationTime() { return m_time_; }
@@ -357,81 +395,115 @@ ZoneFile::~ZoneFile() {
   }
 #endif
 
-  // APPEND-DOC, sync all WAL business
-  if (wal_) {
+#ifdef WAL_BARRIERS
+  // APPEND-DOC, recovery workers read from the once log
+  StopWALRecovery();
+#endif
+
+  // APPEND-DOC, sync all WAL business (closed WALs already returned the once log)
+  if (wal_ || is_wal_) {
     uint64_t ext = extents_.size() ? (extents_[0]->start_ / zbd_->GetZoneSize()) : 0xdeadbeef;
   #ifdef WAL_BARRIERS
     printf("Last write (close) %lu: %lu %lu \n",ext, append_bytes_since_last_barrier_, wal_syncs_);
     if (wal_writes_>0) printf("Correct Nameless syncs:%lu writes:%lu ratio:%f\n", wal_syncs_, wal_writes_, (double)wal_writes_
       / (double)wal_syncs_);
   #endif  
+  }
+  if (wal_) {
     // An anti-pattern to circumentvent weirdness when sync is not called before deletion.
     zbd_->AppendSync(wal_);
     wal_->Sync();
-    delete wal_;
+    zbd_->CloseWALZone(&wal_);
   } 
   ClearExtents(); 
 #ifdef WAL_BARRIERS
   //if (wal_) {
   //    printf("DELETE WAL \n"); fflush(stdout);
   //}
-  if (loaded_wal_chunks_.wal_entries_.size() > 0) {
-    for (auto w : loaded_wal_chunks_.wal_entries_) {
-      delete w.second;
-    }
-  }
-  loaded_wal_chunks_.wal_entries_.clear();
+  loaded_wal_chunks_.wal_entries_.Clear();
   //if (wal_) {
       //printf("DELETED WAL \n"); fflush(stdout);
   //}
 #else
-  if (wal_entries_.size() > 0) {
-    for (auto w : wal_entries_) {
-      delete w.second;
-    }
-  }
-  wal_entries_.clear();
+  wal_entries_.Clear();
 #endif
 }
 
-// APPEND-DOC, Reset the WAL zones (needed as they are now in different zonesets than files)
+// APPEND-DOC, mark the zones of a recovered file, so that WAL zones are not
+// used for IO and the zones are charged to the tenant of the file
+IOStatus ZoneFile::ClaimZones() {
+  for (auto e : extents_) {
+    zbd_->ClaimTenantZone(e->zone_, tenant_);
+  }
+  if (wal_range_.nr == 0) return IOStatus::OK();
+  return zbd_->ClaimWALZones(wal_range_, tenant_);
+}
+
+// APPEND-DOC, Reset the WAL zones and return them to the zone pool
 IOStatus ZoneFile::ResetWALZones() {
   IOStatus s = IOStatus::OK();
-  Zone* z = nullptr;
-  if (extents_.size() > 0 && !wal_) {
-    z = extents_[0]->zone_;
-    while (!z->Acquire())
-      ;
-    // printf("WAL Resetting zones from %lu to %lu \n", z->GetZoneNr(), z->GetZoneNr() + 3);
-    s = zbd_->OpenWALZone(&wal_, z);
-    if (!s.ok()) return s;  
-  } 
+  if (wal_range_.nr == 0) return s;
 
-  if (wal_) {
-    s = wal_->ResetAll() == SZD::SZDStatus::Success 
-      ? IOStatus::OK() 
-      : IOStatus::IOError("WAL sync error");
-    if (s.ok()) {
-      s = zbd_->ReleaseUnusedWALZones();
-    }
+  // APPEND-DOC, the zones are reset by the reset worker of the device, if it
+  // runs, they stay owned by the WAL until then
+  ClearExtents();
+  s = zbd_->ResetWALZones(&wal_, wal_range_, tenant_);
+  wal_range_ = WALZoneRange();
+  return s;
+}
+
+void ZoneFile::ClearExtents() {
+  WriteLock lck(this);
+  for (ZoneExtent* e : extents_) {
+    Zone* zone = e->zone_;
+
+    assert(zone && zone->used_capacity_ >= e->length_);
+    zone->used_capacity_ -= e->length_;
   }
+  extents_.Clear();
+  std::vector<uint64_t>().swap(extent_ends_);
+}
 
-  if (z != nullptr) {
-    z->Release();
+// APPEND-DOC, extents are looked up through the file offsets they end at.
+// Written extents of regular files are merged into the previous extent when
+// they are physically contiguous and that extent was not persisted yet.
+// Sparse files and WALs keep one extent per header. Readers that walk the
+// list hold a ReadLock.
+void ZoneFile::AddExtent(uint64_t start, uint64_t length, Zone* zone,
+                         bool merge) {
+  WriteLock lck(this);
+  uint64_t end = extent_ends_.empty() ? 0 : extent_ends_.back();
+
+  if (merge && !is_sparse_ && !is_wal_ &&
+      extents_.size() > nr_synced_extents_) {
+    ZoneExtent* last = extents_.back();
+    if (last->zone_ == zone && last->start_ + last->length_ == start) {
+      last->length_ += length;
+      extent_ends_.back() = end + length;
+      return;
+    }
   }
 
-  return s;
+  extents_.Add(start, length, zone);
+  extent_ends_.push_back(end + length);
 }
 
-void ZoneFile::ClearExtents() {
-  for (auto e = std::begin(extents_); e != std::end(extents_); ++e) {
-    Zone* zone = (*e)->zone_;
-
-    assert(zone && zone->used_capacity_ >= (*e)->length_);
-    zone->used_capacity_ -= (*e)->length_;
-    delete *e;
+void ZoneFile::RebuildExtentIndex() {
+  uint64_t end = 0;
+  extent_ends_.clear();
+  extent_ends_.reserve(extents_.size());
+  for (const auto* extent : extents_) {
+    end += extent->length_;
+    extent_ends_.push_back(end);
   }
-  extents_.clear();
+}
+
+/* Index of the first extent that ends after file_offset */
+size_t ZoneFile::FindExtent(uint64_t file_offset, size_t first) {
+  if (first >= extent_ends_.size()) return extent_ends_.size();
+  return std::upper_bound(extent_ends_.begin() + first, extent_ends_.end(),
+                          file_offset) -
+         extent_ends_.begin();
 }
 
 IOStatus ZoneFile::CloseActiveZone() {
@@ -443,16 +515,25 @@ IOStatus ZoneFile::CloseActiveZone() {
       : IOStatus::IOError("Failed syncing WAL");
   }
 
+  // APPEND-DOC, the last writer of a shared zone closes it
+  if (active_zone_ && active_zone_shared_) {
+    Zone* zone = active_zone_;
+    active_zone_ = nullptr;
+    active_zone_shared_ = false;
+    return zbd_->ReleaseSharedIOZone(zone);
+  }
+
   if (active_zone_) {
     bool full = active_zone_->IsFull();
+    uint32_t zone_tenant = active_zone_->tenant_;
     s = active_zone_->Close();
     ReleaseActiveZone();
     if (!s.ok()) {
       return s;
     }
-    zbd_->PutOpenIOZoneToken();
+    zbd_->PutOpenIOZoneToken(tenant_);
     if (full) {
-      zbd_->PutActiveIOZoneToken();
+      zbd_->PutActiveIOZoneToken(zone_tenant);
     }
   }
   return s;
@@ -483,8 +564,20 @@ IOStatus ZoneFile::CloseWR() {
   extent_start_ = NO_EXTENT;
   s = PersistMetadata();
   if (!s.ok()) return s;
+  zbd_->GetMetrics()->ReportGeneral(ZENFS_FILE_METADATA_SIZE,
+                                    GetMetadataBytes());
   ReleaseWRLock();
-  return CloseActiveZone();
+  s = CloseActiveZone();
+
+  // APPEND-DOC, return the leased WAL channel, reads reopen the once log
+  if (s.ok() && wal_) {
+    zbd_->AppendSync(wal_);
+    s = wal_->Sync() == SZD::SZDStatus::Success
+      ? IOStatus::OK()
+      : IOStatus::IOError("Failed syncing WAL");
+    zbd_->CloseWALZone(&wal_);
+  }
+  return s;
 }
 
 IOStatus ZoneFile::PersistMetadata() {
@@ -494,32 +587,26 @@ IOStatus ZoneFile::PersistMetadata() {
 
 // APPEND-DOC, modified to support both WAL and file
 ZoneExtent* ZoneFile::GetExtent(uint64_t file_offset, uint64_t* dev_offset) {
-  for (unsigned int i = 0; i < extents_.size(); i++) {
-    if (file_offset < extents_[i]->length_) {
-      *dev_offset = extents_[i]->start_ + file_offset;
-        // printf("  Picked Extend id:%u offset:%lu (mark)\n", i, file_offset);
-      return extents_[i];
-    } else {
-      file_offset -= extents_[i]->length_;
-    }
-  }
-  return NULL;
+  size_t i = FindExtent(file_offset, 0);
+  if (i == extents_.size()) return NULL;
+
+  ZoneExtent* extent = extents_[i];
+  *dev_offset = extent->start_ + file_offset -
+                (extent_ends_[i] - extent->length_);
+  return extent;
 }
 
 // APPEND-DOC, get WALextent
 ZoneExtent* ZoneFile::GetWALExtent(uint64_t file_offset, uint64_t* dev_offset, 
   uint64_t* index) {
-  for (unsigned int i = *index; i < extents_.size(); i++) {
-    if (file_offset < extents_[i]->length_) {
-      *dev_offset = file_offset;
+  /* file_offset is relative to the start of extent *index */
+  if (*index < extents_.size()) {
+    uint64_t base = extent_ends_[*index] - extents_[*index]->length_;
+    size_t i = FindExtent(base + file_offset, *index);
+    if (i < extents_.size()) {
+      *dev_offset = base + file_offset - (extent_ends_[i] - extents_[i]->length_);
       *index = i;
-      // printf("  Picked WAL Extend id:%u (seq%lu) offset:%lu start(%lu) (mark)\n", i, 
-      // wal_entries_[i].first,
-      // file_offset, extents_[i]->start_);
-      // printf("Get WAL extent id %lu\n", i);
       return extents_[i];
-    } else {
-      file_offset -= extents_[i]->length_;
     }
   }
   printf("Extent could not be found?\n");
@@ -580,7 +667,118 @@ static uint64_t get_timespan(const struct timespec& begin, struct timespec& end)
 }
 #endif
 
-IOStatus ZoneFile::RecoverWALChunk(uint64_t begin, uint64_t end, std::vector<std::pair<uint64_t, std::string*>>*  wal_entries) {
+// APPEND-DOC, device read of a WAL chunk. Once log reads are serialized, so
+// that recovery workers can share the log of the file.
+IOStatus ZoneFile::ReadWALChunk(uint64_t begin, uint64_t end, char* ptr) {
+  std::lock_guard<std::mutex> lock(wal_read_mtx_);
+  return wal_->Read(begin >> shift_block_size(GetBlockSize()), ptr, end - begin, true) == SZD::SZDStatus::Success 
+    ? IOStatus::OK() 
+    : IOStatus::IOError("Error WAL read I/O");
+}
+
+char* WALChunkEntries::Allocate(size_t size) {
+  size_t page_sz = sysconf(_SC_PAGESIZE);
+
+  Clear();
+  /* Rounded up, reads of the once log are in whole blocks */
+  if (posix_memalign((void**)&buffer_, page_sz,
+                     (size + page_sz - 1) / page_sz * page_sz)) {
+    buffer_ = nullptr;
+  }
+  return buffer_;
+}
+
+void WALChunkEntries::Clear() {
+  free(buffer_);
+  buffer_ = nullptr;
+  index_.clear();
+}
+
+// APPEND-DOC, sequence numbers of a chunk come from a single wal_seq_++, so
+// they are dense and nearly ordered. Entries are placed directly at
+// seq - min_seq, a comparison sort is only needed if the range has gaps or
+// duplicates (e.g. a torn chunk).
+uint64_t WALChunkEntries::Sort() {
+  size_t n = index_.size();
+  uint64_t min_seq = UINT64_MAX;
+  uint64_t max_seq = 0;
+  uint64_t reordered = 0;
+
+  for (const auto& e : index_) {
+    /* Arrived after an entry with a higher sequence number */
+    if (e.seq_ < max_seq) reordered++;
+    min_seq = std::min(min_seq, e.seq_);
+    max_seq = std::max(max_seq, e.seq_);
+  }
+  if (reordered == 0) return 0;
+
+  if (max_seq - min_seq + 1 == n) {
+    /* Entries are never empty, so length 0 marks a free slot */
+    std::vector<wal_entry> sorted(n, wal_entry{0, 0, 0});
+    bool dense = true;
+    for (const auto& e : index_) {
+      wal_entry& slot = sorted[e.seq_ - min_seq];
+      if (slot.length_) {
+        dense = false;
+        break;
+      }
+      slot = e;
+    }
+    if (dense) {
+      index_.swap(sorted);
+      return reordered;
+    }
+  }
+
+  std::sort(index_.begin(), index_.end(),
+            [](const wal_entry& a, const wal_entry& b) {
+              return a.seq_ < b.seq_;
+            });
+  return reordered;
+}
+
+// APPEND-DOC, index the entries of the WAL chunk in the buffer of wal_entries,
+// in device order. The headers are skipped, entries are only views.
+IOStatus ZoneFile::DecodeWALChunk(uint64_t begin, size_t str_size,
+    WALChunkEntries* wal_entries) {
+  const char* ptr = wal_entries->Buffer();
+  uint64_t r = 0, br = 0;
+  const uint64_t header_sz = ZoneFile::SPARSE_HEADER_SIZE +  ZoneFile::SPARSE_WAL_HEADER_SIZE;
+
+  // Read entries one-by-one
+  while (r < str_size && br < str_size) {
+    // Decode extent header
+    uint64_t size = DecodeFixed64(ptr + r) & WAL_CHUNK_LENGTH_MASK;
+    uint64_t seqn = DecodeFixed64(ptr + r + sizeof(uint64_t));
+
+    // We reached into the padding zone
+    if (!size) {
+      break;
+    }
+
+    // Padding region
+    if (seqn == 0 && begin > wal_->GetWriteTail() << shift_block_size(GetBlockSize()))
+      break;
+
+    // Views must stay inside the chunk buffer
+    if (r + header_sz + size > str_size) {
+      return IOStatus::Corruption("Overshooting WAL\n");
+    }
+    wal_entries->Add(seqn, r + header_sz, size);
+
+    // Move to the next extent
+    br += size;
+    r += size + header_sz;
+  }
+
+  // Corruption
+  if (r > str_size) {
+    return IOStatus::Corruption("Overshooting WAL\n");
+  }
+  return IOStatus::OK();
+}
+
+IOStatus ZoneFile::RecoverWALChunk(uint64_t begin, uint64_t end, WALChunkEntries* wal_entries) {
   IOStatus s = IOStatus::OK();
   char* ptr;
   size_t str_size = end - begin;
@@ -594,101 +792,45 @@ IOStatus ZoneFile::RecoverWALChunk(uint64_t begin, uint64_t end, std::vector<std
 	struct timespec tp_end_sort;
 #endif
 
-  //printf("RecoverWALChunk, IN %lu OUT %lu   %lu %lu\n", begin, end, wal_->GetWriteTail() << shift_block_size(GetBlockSize()), 
-  //wal_->GetWriteHead() << shift_block_size(GetBlockSize()));
-  //fflush(stdout);
-
-  // Cleanup leaks
-  {
-    if (wal_entries->size() > 0) {
-      for (auto w : *wal_entries) {
-        delete w.second;
-      }
-    }
-    wal_entries->clear();
-  }
 #ifdef MEASURE_WAL_LAT
   clock_gettime(CLOCK_MONOTONIC, &tp_begin_read_io);
 #endif  
-  // Read from storage
-  {
-    // printf("ALLOC SIZE %lu\n", str_size);
-    ptr = new char[str_size+1];
-    // printf("WAL %lu %lu %lu %lu %lu\n", 
-    //   wal_->GetWriteTail(), 
-    //   begin >> shift_block_size(GetBlockSize()), 
-    //   str_size, 
-    //   wal_->GetWriteHead(), 
-    //   wal_->GetWriteTail() + (str_size + GetBlockSize()-1) / GetBlockSize());
-    s = wal_->Read(begin >> shift_block_size(GetBlockSize()), ptr, str_size, true) == SZD::SZDStatus::Success 
-      ? IOStatus::OK() 
-      : IOStatus::IOError("Error WAL read I/O");
-    if (!s.ok()) return s;
+  std::shared_ptr<ZenFSMetrics> metrics = zbd_->GetMetrics();
+  uint64_t begin_us = Env::Default()->NowMicros();
+  uint64_t end_us;
+
+  // Read from storage, this releases the previous chunk
+  ptr = wal_entries->Allocate(str_size);
+  if (!ptr) return IOStatus::IOError("Out of memory while recovering WAL");
+  s = ReadWALChunk(begin, end, ptr);
+  if (!s.ok()) {
+    wal_entries->Clear();
+    return s;
   }
+  end_us = Env::Default()->NowMicros();
+  metrics->ReportLatency(ZENFS_WAL_RECOVERY_READ_LATENCY, end_us - begin_us);
+  begin_us = end_us;
 #ifdef MEASURE_WAL_LAT
   clock_gettime(CLOCK_MONOTONIC, &tp_end_read_io);
   wal_seq_read_time_sum_ += get_timespan(tp_begin_read_io, tp_end_read_io);
   clock_gettime(CLOCK_MONOTONIC, &tp_begin_chunk);
 #endif
   // Read entries
-  {
-    uint64_t r = 0, br = 0;
-    uint64_t max_seq = 0;
-    const uint64_t header_sz = ZoneFile::SPARSE_HEADER_SIZE +  ZoneFile::SPARSE_WAL_HEADER_SIZE;
-
-    // Read entries one-by-one
-    while (r < str_size && br < str_size) {
-      // Decode extent header
-      uint64_t size = DecodeFixed64(ptr);
-      uint64_t seqn = DecodeFixed64(ptr + sizeof(uint64_t));
-
-      // We reached into the padding zone
-      if (!size) {
-        break;
-      }
-
-      // Increment sequence number in batch
-      if (seqn > max_seq)
-        max_seq = seqn;
-
-      // Padding region
-      if (seqn == 0 && begin > wal_->GetWriteTail() << shift_block_size(GetBlockSize()))
-        break;
-
-      //printf("SEQN %lu\n", seqn);
-
-      std::string* dat = new std::string;
-      // IMPORTANT: We skip the header! We do not NEED the information in the buffer
-      dat->assign(ptr + header_sz, size);
-      wal_entries->push_back(std::make_pair(seqn, dat));
-
-      // printf("Decoded WAL entry %lu - %lu %lu %lu\n", br, r, size, seqn);
-
-      // Move to the next extent
-      br += size;
-      r += size + header_sz;
-      ptr += size + header_sz;
-    }
-
-    // Corruption
-    if (r > str_size) {
-      s = IOStatus::Corruption("Overshooting WAL\n");
-      return s;
-    }
-  }
+  s = DecodeWALChunk(begin, str_size, wal_entries);
+  if (!s.ok()) return s;
+  end_us = Env::Default()->NowMicros();
+  metrics->ReportLatency(ZENFS_WAL_RECOVERY_DECODE_LATENCY, end_us - begin_us);
+  begin_us = end_us;
 #ifdef MEASURE_WAL_LAT
   clock_gettime(CLOCK_MONOTONIC, &tp_end_chunk);
   wal_decode_time_sum_ += get_timespan(tp_begin_chunk, tp_end_chunk);
   clock_gettime(CLOCK_MONOTONIC, &tp_begin_sort);
 #endif
   // Sort entries
-  {
-    std::sort(
-      wal_entries->begin(), wal_entries->end(),
-      [](std::pair<uint64_t, std::string*> a,
-        std::pair<uint64_t, std::string*> b) { return a.first < b.first; });
-  }
-  // delete[] ptr;
+  metrics->ReportGeneral(ZENFS_WAL_RECOVERY_REORDERED_COUNT,
+                        wal_entries->Sort());
+  metrics->ReportLatency(ZENFS_WAL_RECOVERY_SORT_LATENCY,
+                         Env::Default()->NowMicros() - begin_us);
 #ifdef MEASURE_WAL_LAT
     clock_gettime(CLOCK_MONOTONIC, &tp_end_sort);
     wal_sort_time_sum_ += get_timespan(tp_begin_sort, tp_end_sort);
@@ -697,6 +839,91 @@ IOStatus ZoneFile::RecoverWALChunk(uint64_t begin, uint64_t end, std::vector<std
   return s;
 }
 
+#ifdef WAL_BARRIERS
+// APPEND-DOC, fix the chunk bounds and start the recovery workers. The chunks
+// are taken by the reader in order, the workers stay at most
+// WAL_RECOVERY_DEPTH chunks ahead.
+void ZoneFile::StartWALRecovery() {
+  wal_recovery_nr_ = wal_chunk_bounds_.size() - 1;
+  wal_recovery_next_ = chunk_id_;
+  wal_recovery_taken_ = chunk_id_;
+  wal_recovery_chunks_.resize(WAL_RECOVERY_DEPTH);
+  for (auto& chunk : wal_recovery_chunks_) chunk.ready_ = false;
+
+  for (int i = 0; i < WAL_RECOVERY_THREADS; i++)
+    wal_recovery_threads_.emplace_back(&ZoneFile::WALRecoveryWorker, this);
+}
+
+void ZoneFile::StopWALRecovery() {
+  {
+    std::lock_guard<std::mutex> lock(wal_recovery_mtx_);
+    wal_recovery_stop_ = true;
+  }
+  wal_recovery_cv_.notify_all();
+  for (auto& t : wal_recovery_threads_) t.join();
+  wal_recovery_threads_.clear();
+
+  for (auto& chunk : wal_recovery_chunks_) chunk.wal_entries_.Clear();
+}
+
+void ZoneFile::WALRecoveryWorker() {
+  std::unique_lock<std::mutex> lock(wal_recovery_mtx_);
+
+  while (true) {
+    wal_recovery_cv_.wait(lock, [&] {
+      return wal_recovery_stop_ || wal_recovery_next_ >= wal_recovery_nr_ ||
+             wal_recovery_next_ < wal_recovery_taken_ + WAL_RECOVERY_DEPTH;
+    });
+    if (wal_recovery_stop_ || wal_recovery_next_ >= wal_recovery_nr_) break;
+
+    uint64_t id = wal_recovery_next_++;
+    lock.unlock();
+
+    uint64_t begin = wal_chunk_bounds_[id];
+    uint64_t end = wal_chunk_bounds_[id + 1];
+    WALChunkEntries wal_entries;
+    char* ptr = wal_entries.Allocate(end - begin);
+    IOStatus s = ptr ? ReadWALChunk(begin, end, ptr)
+                     : IOStatus::IOError("Out of memory while recovering WAL");
+
+    if (s.ok()) s = DecodeWALChunk(begin, end - begin, &wal_entries);
+    if (s.ok())
+      zbd_->GetMetrics()->ReportGeneral(ZENFS_WAL_RECOVERY_REORDERED_COUNT,
+                                        wal_entries.Sort());
+
+    lock.lock();
+    /* The slot was released, the reader took chunk id - WAL_RECOVERY_DEPTH */
+    struct recovered_wal_chunk& chunk =
+        wal_recovery_chunks_[id % WAL_RECOVERY_DEPTH];
+    chunk.id_ = id;
+    chunk.status_ = s;
+    chunk.wal_entries_.Swap(wal_entries);
+    chunk.ready_ = true;
+    wal_recovery_cv_.notify_all();
+  }
+}
+
+// APPEND-DOC, wait for the next chunk in order and replace the loaded entries
+IOStatus ZoneFile::TakeRecoveredWALChunk(uint64_t id,
+                                         WALChunkEntries* wal_entries) {
+  std::unique_lock<std::mutex> lock(wal_recovery_mtx_);
+  assert(id == wal_recovery_taken_);
+  struct recovered_wal_chunk& chunk =
+      wal_recovery_chunks_[id % WAL_RECOVERY_DEPTH];
+
+  wal_recovery_cv_.wait(lock, [&] { return chunk.ready_ && chunk.id_ == id; });
+
+  wal_entries->Clear();
+  wal_entries->Swap(chunk.wal_entries_);
+  IOStatus s = chunk.status_;
+  chunk.ready_ = false;
+  wal_recovery_taken_ = id + 1;
+  lock.unlock();
+  wal_recovery_cv_.notify_all();
+
+  return s;
+}
+#endif
 
 #ifndef WAL_BARRIERS
 IOStatus ZoneFile::RecoverEntireWAL() {
@@ -706,7 +933,7 @@ IOStatus ZoneFile::RecoverEntireWAL() {
     return s;
   }
   if (!wal_) {
-    s = zbd_->OpenWALZone(&wal_, extents_[0]->zone_);
+    s = zbd_->OpenWALZone(&wal_, wal_range_, tenant_);
     if (!s.ok()) return s;
   }
 
@@ -743,34 +970,42 @@ IOStatus ZoneFile::TryRecoverWAL(uint64_t offset) {
 
   // Ensure WAL is ready
   if (!wal_) {
-    s = zbd_->OpenWALZone(&wal_, extents_[0]->zone_);
+    s = zbd_->OpenWALZone(&wal_, wal_range_, tenant_);
     if (!s.ok()) return s;
   }
 
   // Stupid RocksDB thinks this is ok.
   offset = std::min(offset, file_size_);
 
+  // Chunk bounds, reloaded if the WAL has grown since
+  if (wal_chunk_bounds_.empty() ||
+      (wal_recovery_threads_.empty() &&
+       wal_chunk_bounds_.back() !=
+           wal_->GetWriteHead() << shift_block_size(GetBlockSize()))) {
+    s = LoadWALChunkBounds();
+    if (!s.ok()) return s;
+  }
+
   // Repeatedly load the next chunk if needed
   do {
     uint64_t jump = loaded_wal_chunks_.wal_entries_.size();
 
     // Calculate the next chunk
-    // uint64_t chunk_id =  offset / (WAL_BARRIER_SIZE_IN_KB * KiB);
-    uint64_t lba_in = (wal_->GetWriteTail() << shift_block_size(GetBlockSize())) 
-      + chunk_id_ * ((WAL_BARRIER_SIZE_IN_KB * KiB));
-    uint64_t lba_out = (wal_->GetWriteTail() << shift_block_size(GetBlockSize())) 
-      + (chunk_id_+1) * ((WAL_BARRIER_SIZE_IN_KB * KiB));
-    // Safety first
-    lba_in = std::min(lba_in, wal_->GetWriteHead() << shift_block_size(GetBlockSize()));
-    lba_out = std::min(lba_out, wal_->GetWriteHead() << shift_block_size(GetBlockSize()));
-    // printf("LBA %lu - %lu\n", lba_in, lba_out); fflush(stdout);
-    if (lba_in >= lba_out) {
+    if (chunk_id_ + 1 >= wal_chunk_bounds_.size()) {
       // printf("in >= out\n");fflush(stdout);
       break;
     }
+    uint64_t lba_in = wal_chunk_bounds_[chunk_id_];
+    uint64_t lba_out = wal_chunk_bounds_[chunk_id_ + 1];
+    // printf("LBA %lu - %lu\n", lba_in, lba_out); fflush(stdout);
 
-    // Load next chunk
-    s = RecoverWALChunk(lba_in, lba_out, &(loaded_wal_chunks_.wal_entries_));
+    // Load next chunk, decoded ahead by the recovery workers
+    if (WAL_RECOVERY_THREADS > 0 && wal_recovery_threads_.empty())
+      StartWALRecovery();
+    if (!wal_recovery_threads_.empty() && chunk_id_ < wal_recovery_nr_)
+      s = TakeRecoveredWALChunk(chunk_id_, &(loaded_wal_chunks_.wal_entries_));
+    else
+      s = RecoverWALChunk(lba_in, lba_out, &(loaded_wal_chunks_.wal_entries_));
     if (!s.ok()) {
       // printf("Errored \n");fflush(stdout);
       return s;
@@ -779,7 +1014,7 @@ IOStatus ZoneFile::TryRecoverWAL(uint64_t offset) {
     // Get complete size
     uint64_t extent_size = 0;
     for (const auto& extent : loaded_wal_chunks_.wal_entries_) {
-      extent_size += extent.second->size();
+      extent_size += extent.length_;
     }
 
     // Update chunk info
@@ -899,6 +1134,8 @@ IOStatus ZoneFile::WALPositionedRead(uint64_t offset, size_t n, Slice* result,
 
     // APPEND-DOC, copy into mem.
     if (iswal) {
+      ZenFSMetricsLatencyGuard copy_guard(
+          zbd_->GetMetrics(), ZENFS_WAL_RECOVERY_COPY_LATENCY, Env::Default());
 #ifdef MEASURE_WAL_LAT
     clock_gettime(CLOCK_MONOTONIC, &tp_begin_copy);
 #endif
@@ -910,13 +1147,13 @@ IOStatus ZoneFile::WALPositionedRead(uint64_t offset, size_t n, Slice* result,
       // }
       // printf("\n");
       // fflush(stdout);
-      memcpy(ptr, loaded_wal_chunks_.wal_entries_[extend_id-loaded_wal_chunks_.jump_].second->data() + r_off, pread_sz);
+      memcpy(ptr, loaded_wal_chunks_.wal_entries_.Data(extend_id-loaded_wal_chunks_.jump_) + r_off, pread_sz);
 #else
       // for (size_t i = 0; i < pread_sz; i++) {
       //   printf("%c", wal_entries_[extend_id].second->data()[r_off + i]);
       // }
       // printf("\n");
-      memcpy(ptr, wal_entries_[extend_id].second->data() + r_off, pread_sz);
+      memcpy(ptr, wal_entries_.Data(extend_id) + r_off, pread_sz);
 #endif
 #ifdef MEASURE_WAL_LAT
       clock_gettime(CLOCK_MONOTONIC, &tp_end_copy);
@@ -1114,6 +1351,146 @@ IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
   return s;
 }
 
+/* Must hold a ReadLock. Maps a read to a single device read, *len is the
+ * number of bytes that are valid (0 at the end of the file). Returns false if
+ * the read spans extents or is a WAL read, those need PositionedRead. */
+bool ZoneFile::MapDeviceRead(uint64_t offset, size_t n, char* scratch,
+                             bool direct, ZbdReadRequest* dev_req,
+                             size_t* len) {
+  uint64_t dev_offset;
+  ZoneExtent* extent;
+
+  if (ends_with(linkfiles_[0], ".log")) return false;
+
+  *len = 0;
+  if (offset >= file_size_) return true;
+  extent = GetExtent(offset, &dev_offset);
+  if (!extent) return true;
+
+  *len = std::min((uint64_t)n, file_size_ - offset);
+  if (dev_offset + *len > extent->start_ + extent->length_) return false;
+
+  /* Same padding of unaligned direct reads as in PositionedRead */
+  size_t read_sz = *len;
+  if (direct && read_sz % zbd_->GetBlockSize())
+    read_sz += zbd_->GetBlockSize() - (read_sz % zbd_->GetBlockSize());
+
+  dev_req->buf = scratch;
+  dev_req->pos = dev_offset;
+  dev_req->size = read_sz;
+  dev_req->direct = direct;
+  return true;
+}
+
+IOStatus ZoneFile::MultiRead(FSReadRequest* reqs, size_t num_reqs,
+                             bool direct) {
+  ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(), ZENFS_READ_LATENCY,
+                                 Env::Default());
+  zbd_->GetMetrics()->ReportQPS(ZENFS_READ_QPS, num_reqs);
+
+  std::vector<ZbdReadRequest> dev_reqs(num_reqs);
+  std::vector<size_t> lens(num_reqs, 0);
+  std::vector<ZbdReadRequest*> batch;
+  std::vector<size_t> batch_idx;
+  std::vector<size_t> single;
+
+  {
+    ReadLock lck(this);
+    for (size_t i = 0; i < num_reqs; i++) {
+      FSReadRequest& req = reqs[i];
+
+      req.status = IOStatus::OK();
+      req.result = Slice(req.scratch, 0);
+      if (!MapDeviceRead(req.offset, req.len, req.scratch, direct,
+                         &dev_reqs[i], &lens[i])) {
+        single.push_back(i);
+      } else if (lens[i]) {
+        batch.push_back(&dev_reqs[i]);
+        batch_idx.push_back(i);
+      }
+    }
+    zbd_->MultiRead(batch.data(), batch.size());
+  }
+
+  for (size_t i : batch_idx) {
+    FSReadRequest& req = reqs[i];
+    if (dev_reqs[i].result < 0) {
+      req.status = IOStatus::IOError("pread error\n");
+    } else {
+      req.result =
+          Slice(req.scratch, std::min((size_t)dev_reqs[i].result, lens[i]));
+    }
+  }
+
+  /* Outside the ReadLock, PositionedRead takes its own */
+  for (size_t i : single) {
+    FSReadRequest& req = reqs[i];
+    req.status = PositionedRead(req.offset, req.len, &req.result, req.scratch,
+                                direct);
+  }
+
+  return IOStatus::OK();
+}
+
+ZenFSAsyncRead* ZoneFile::SubmitAsyncRead(std::shared_ptr<ZoneFile> file,
+                                          const FSReadRequest& req,
+                                          bool direct) {
+  std::unique_ptr<ZenFSAsyncRead> handle(new ZenFSAsyncRead());
+  ZbdReadRequest* dev_req = &handle->dev_req_;
+  ZonedBlockDevice* zbd = file->zbd_;
+  size_t len;
+
+  {
+    /* The read is tracked before the lock is dropped, a migration that
+     * replaces the extents after that waits for it */
+    ReadLock lck(file.get());
+    if (!file->MapDeviceRead(req.offset, req.len, req.scratch, direct,
+                             dev_req, &len) ||
+        !len)
+      return nullptr;
+
+    std::lock_guard<std::mutex> lock(file->async_reads_mtx_);
+    zbd->SubmitReads(&dev_req, 1);
+    file->async_reads_.insert(dev_req);
+  }
+
+  zbd->GetMetrics()->ReportQPS(ZENFS_READ_QPS, 1);
+  handle->zbd_ = zbd;
+  handle->file_ = file;
+  handle->req_ = req;
+  handle->req_.len = len;
+  zbd->RegisterAsyncRead(handle.get());
+  return handle.release();
+}
+
+/* A handle that is deleted before it was polled still waits for its read,
+ * the device writes into dev_req_ and the caller's scratch until then */
+ZenFSAsyncRead::~ZenFSAsyncRead() {
+  if (file_) Complete(false);
+  if (zbd_) zbd_->UnregisterAsyncRead(this);
+}
+
+void ZenFSAsyncRead::Complete(bool callback) {
+  if (completed_) return;
+
+  ZbdReadRequest* dev_req = &dev_req_;
+  zbd_->WaitReads(&dev_req, 1);
+  {
+    std::lock_guard<std::mutex> lock(file_->async_reads_mtx_);
+    file_->async_reads_.erase(dev_req);
+  }
+  if (dev_req_.result < 0) {
+    req_.status = IOStatus::IOError("pread error\n");
+    req_.result = Slice(req_.scratch, 0);
+  } else {
+    req_.status = IOStatus::OK();
+    req_.result =
+        Slice(req_.scratch, std::min((size_t)dev_req_.result, req_.len));
+  }
+  completed_ = true;
+  if (callback) cb_(req_, cb_arg_);
+}
+
 void ZoneFile::PushExtent() {
   uint64_t length;
 
@@ -1125,7 +1502,7 @@ void ZoneFile::PushExtent() {
   if (length == 0) return;
 
   assert(length <= (active_zone_->wp_ - extent_start_));
-  extents_.push_back(new ZoneExtent(extent_start_, length, active_zone_));
+  AddExtent(extent_start_, length, active_zone_, true);
 
   active_zone_->used_capacity_ += length;
   extent_start_ = active_zone_->wp_;
@@ -1148,10 +1525,18 @@ IOStatus ZoneFile::AllocateNewZone() {
       }
       //  APPEND-loG crossing a zone is a barrier (but annoying to fix)
       // append_bytes_since_last_barrier_ = 0;
-      s = zbd_->AllocateWALZone(&zone, &wal_, z);
+      s = zbd_->AllocateWALZone(&zone, &wal_, z, &wal_range_, tenant_);
     if (!s.ok()) return s;
+#ifdef WAL_BARRIERS
+    if (wal_barrier_resume_) {
+      s = ResumeWALBarrier();
+      if (!s.ok()) return s;
+    }
+#endif
+  } else if (UsesZoneAppends()) {
+    s = zbd_->AllocateSharedIOZone(lifetime_, io_type_, &zone, tenant_);
   } else {
-    s = zbd_->AllocateIOZone(lifetime_, io_type_, &zone);
+    s = zbd_->AllocateIOZone(lifetime_, io_type_, &zone, tenant_);
   }
 
   if (!s.ok()) return s;
@@ -1159,9 +1544,18 @@ IOStatus ZoneFile::AllocateNewZone() {
     return IOStatus::NoSpace("Zone allocation failure\n");
   }
   SetActiveZone(zone);
-  extent_start_ = active_zone_->wp_;
   extent_filepos_ = file_size_;
 
+  /* APPEND-DOC, the write pointer of a shared zone also moves for the other
+   * writers, so it can not recover the active extent. Extents are added as
+   * the appends complete and are persisted on sync. */
+  if (UsesZoneAppends()) {
+    active_zone_shared_ = true;
+    extent_start_ = NO_EXTENT;
+    return IOStatus::OK();
+  }
+  extent_start_ = active_zone_->wp_;
+
   /* Persist metadata so we can recover the active extent using
      the zone write pointer in case there is a crash before syncing */
   return PersistMetadata();
@@ -1174,6 +1568,8 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
   uint32_t block_sz = GetBlockSize();
   IOStatus s;
 
+  if (UsesZoneAppends()) return SharedZoneAppend(buffer, data_size);
+
   if (active_zone_ == NULL) {
     s = AllocateNewZone();
     if (!s.ok()) return s;
@@ -1185,8 +1581,8 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
     if (wr_size > active_zone_->capacity_) wr_size = active_zone_->capacity_;
     // APPEND_LOG, Prevent cross-barrier write
   #ifdef WAL_BARRIERS
-    if (is_wal_ && wr_size > (WAL_BARRIER_SIZE_IN_KB * KiB - append_bytes_since_last_barrier_)) 
-      wr_size = WAL_BARRIER_SIZE_IN_KB * KiB - append_bytes_since_last_barrier_;
+    if (is_wal_ && wr_size > (wal_barrier_sz_ - append_bytes_since_last_barrier_)) 
+      wr_size = wal_barrier_sz_ - append_bytes_since_last_barrier_;
   #endif
     /* Pad to the next block boundary if needed */
     uint32_t align = wr_size % block_sz;
@@ -1203,14 +1599,13 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
     if (is_wal_) {
       // APPEND-DOC do the sync (first)
     #ifdef WAL_BARRIERS
-      if (append_bytes_since_last_barrier_ >= WAL_BARRIER_SIZE_IN_KB * KiB) {
-        wal_->Sync();
-        append_bytes_since_last_barrier_ = 0;
-        wal_syncs_++;
+      if (append_bytes_since_last_barrier_ >= wal_barrier_sz_) {
+        s = WALBarrier();
+        if (!s.ok()) return s;
       }
       wal_writes_++;
     #endif
-      s = active_zone_->ZoneAppend(buffer, wr_size + pad_sz, wal_);
+      s = WALZoneAppend(buffer, wr_size + pad_sz, pad_sz);
     #ifdef WAL_BARRIERS
       append_bytes_since_last_barrier_ += (wr_size + pad_sz);
     #endif
@@ -1220,8 +1615,7 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
       if (!s.ok()) return s;
     }
 
-    extents_.push_back(
-        new ZoneExtent(extent_start_, extent_length, active_zone_));
+    AddExtent(extent_start_, extent_length, active_zone_, true);
 
     extent_start_ = active_zone_->wp_;
     active_zone_->used_capacity_ += extent_length;
@@ -1246,11 +1640,18 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
 
 /* Byte-aligned, sparse writes with inline metadata
    the caller reserves 8 bytes of data for a size header */
+// APPEND-DOC, a write that is split (barrier or full zone) is not moved back
+// to the start of the buffer. The header of the next chunk is encoded in place
+// right in front of the remaining data, over bytes that were already issued.
+// Plain appends are synchronous and logs that copy appends (CopiesAppends) are
+// done with the data, otherwise the previous chunk is completed with a sync
+// before its bytes are overwritten.
 IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
   uint32_t left = data_size;
   uint32_t wr_size;
+  char* chunk = sparse_buffer;
   // TODO: fix APPEND-DOC, only works with 4KiB for now
-  uint32_t block_sz = 4096; // GetBlockSize();
+  uint32_t block_sz = SPARSE_BLOCK_SIZE; // GetBlockSize();
   IOStatus s;
 
   if (active_zone_ == NULL) {
@@ -1265,14 +1666,12 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
 
     // APPEND-DOC, write to WAL with a zone append, wal_->Sync()
   #ifdef WAL_BARRIERS
-    if (is_wal_ && append_bytes_since_last_barrier_ >= WAL_BARRIER_SIZE_IN_KB * KiB) 
+    if (is_wal_ && append_bytes_since_last_barrier_ >= wal_barrier_sz_) 
     {
-      // printf("Synced barrier because %lu >= %lu\n", append_bytes_since_last_barrier_, WAL_BARRIER_SIZE_IN_KB * KiB);
-      s = WALSync();
+      // printf("Synced barrier because %lu >= %lu\n", append_bytes_since_last_barrier_, wal_barrier_sz_);
+      s = WALBarrier();
       if (!s.ok()) return s;
       // printf("Synced WAL\n");
-      wal_syncs_++;
-      append_bytes_since_last_barrier_ = 0;
     }
     wal_writes_++;
 #endif
@@ -1281,8 +1680,8 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
     if (wr_size > active_zone_->capacity_) wr_size = active_zone_->capacity_;
     // APPEND_LOG, Prevent cross-barrier write
     #ifdef WAL_BARRIERS
-    if (is_wal_ && wr_size > (WAL_BARRIER_SIZE_IN_KB * KiB - append_bytes_since_last_barrier_)) 
-      wr_size = WAL_BARRIER_SIZE_IN_KB * KiB - append_bytes_since_last_barrier_;
+    if (is_wal_ && wr_size > (wal_barrier_sz_ - append_bytes_since_last_barrier_)) 
+      wr_size = wal_barrier_sz_ - append_bytes_since_last_barrier_;
     // printf("Writing size: %u \n", wr_size);
     #endif
     /* Pad to the next block boundary if needed */
@@ -1293,47 +1692,52 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
 
     /* the sparse buffer has block_sz extra bytes tail allocated for padding, so
      * this is safe */
-    if (pad_sz) memset(sparse_buffer + wr_size, 0x0, pad_sz);
+    if (pad_sz) memset(chunk + wr_size, 0x0, pad_sz);
 
     uint64_t extent_length = wr_size - header_size;
-    EncodeFixed64(sparse_buffer, extent_length);
+    uint64_t header_length = extent_length;
+  #ifdef WAL_BARRIERS
+    if (is_wal_ && wal_barrier_adaptive_)
+      header_length |= (wal_barrier_sz_ / KiB) << WAL_CHUNK_BARRIER_SHIFT;
+  #endif
+    if (is_wal_ && chunk != sparse_buffer && !WALCopiesAppends() &&
+        GetWALAppendsCompleted() < GetWALAppendsIssued()) {
+      s = WALSync();
+      if (!s.ok()) return s;
+    }
+    EncodeFixed64(chunk, header_length);
     // printf("Write (%lu %lu %lu %lu\n", wal_seq_.load(std::memory_order_acquire), extent_length, file_size_, 
     //   (wal_->GetWriteHead() - wal_->GetWriteTail()) * 512 );
-    EncodeFixed64(sparse_buffer + sizeof(uint64_t), wal_seq_++);
+    EncodeFixed64(chunk + sizeof(uint64_t), wal_seq_++);
 
     // APPEND-DOC, write to WAL with a zone append, to a file with a write (Append is write in ZenFS...)
     if (is_wal_) {
-      s = active_zone_->ZoneAppend(sparse_buffer, wr_size + pad_sz, wal_);
+      s = WALZoneAppend(chunk, wr_size + pad_sz, pad_sz);
       if (!s.ok()) return s;
     #ifdef WAL_BARRIERS
       append_bytes_since_last_barrier_ += wr_size + pad_sz;
-      // printf("Append before barrier because %lu <= %lu\n", append_bytes_since_last_barrier_, WAL_BARRIER_SIZE_IN_KB * KiB);
+      // printf("Append before barrier because %lu <= %lu\n", append_bytes_since_last_barrier_, wal_barrier_sz_);
     #endif   
     } else {
-      s = active_zone_->Append(sparse_buffer, wr_size + pad_sz);
+      s = active_zone_->Append(chunk, wr_size + pad_sz);
       if (!s.ok()) return s;
     }
 
     // APPEND-DOC, variable header size
-    extents_.push_back(
-        new ZoneExtent(extent_start_ + header_size,
-                       extent_length, active_zone_));
+    AddExtent(extent_start_ + header_size, extent_length, active_zone_);
 
     extent_start_ = active_zone_->wp_;
     active_zone_->used_capacity_ += extent_length;
     file_size_ += extent_length;
     left -= extent_length;
+    /* Split chunks are block aligned, so padding only follows the last one */
+    chunk += extent_length;
 
     if (active_zone_->capacity_ == 0) {
       s = CloseActiveZone();
       if (!s.ok()) {
         return s;
       }
-      if (left) {
-        // APPEND-DOC, vartiable headersize
-        memmove((void*)(sparse_buffer + header_size),
-                (void*)(sparse_buffer + wr_size), left);
-      }
       s = AllocateNewZone();
       if (!s.ok()) return s;
     }
@@ -1348,6 +1752,8 @@ IOStatus ZoneFile::Append(void* data, int data_size) {
   uint32_t wr_size, offset = 0;
   IOStatus s = IOStatus::OK();
 
+  if (UsesZoneAppends()) return SharedZoneAppend((char*)data, data_size);
+
   if (!active_zone_) {
     s = AllocateNewZone();
     if (!s.ok()) return s;
@@ -1380,6 +1786,46 @@ IOStatus ZoneFile::Append(void* data, int data_size) {
   return IOStatus::OK();
 }
 
+/* APPEND-DOC, byte-aligned writes to a zone shared with other SSTs of the same
+   lifetime. Each piece is a zone append and becomes an extent at the position
+   the device reported on completion (merged when it follows the previous
+   one), the buffer has a block of room for the padding. The zone clamps the
+   piece to its capacity under its own lock, so a piece is split only on block
+   boundaries and the padding never overwrites remaining data. */
+IOStatus ZoneFile::SharedZoneAppend(char* data, uint32_t data_size) {
+  uint32_t left = data_size;
+  uint32_t appended;
+  uint64_t pos;
+  IOStatus s;
+
+  if (active_zone_ == nullptr) {
+    s = AllocateNewZone();
+    if (!s.ok()) return s;
+  }
+
+  while (left) {
+    s = active_zone_->ZoneAppend(data, left, &appended, &pos);
+    /* The zone is full, possibly taken by another writer first */
+    if (s.IsNoSpace()) {
+      s = CloseActiveZone();
+      if (!s.ok()) return s;
+      s = AllocateNewZone();
+      if (!s.ok()) return s;
+      continue;
+    }
+    if (!s.ok()) return s;
+
+    AddExtent(pos, appended, active_zone_, true);
+    active_zone_->used_capacity_ += appended;
+    file_size_ += appended;
+    data += appended;
+    left -= appended;
+  }
+
+  extent_filepos_ = file_size_;
+  return IOStatus::OK();
+}
+
 IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
                                         Zone* zone) {
   /* Sparse writes, we need to recover each individual segment */
@@ -1410,7 +1856,7 @@ IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
       break;
     }
 
-    extent_length = DecodeFixed64(buffer);
+    extent_length = DecodeFixed64(buffer) & WAL_CHUNK_LENGTH_MASK;
     if (extent_length == 0) {
       s = IOStatus::IOError("Unexpected extent length while recovering");
       break;
@@ -1426,8 +1872,7 @@ IOStatus ZoneFile::RecoverSparseExtents(uint64_t start, uint64_t end,
 
     zone->used_capacity_ += extent_length;
     // APPEND-DOC, different size for WAL and file
-    extents_.push_back(new ZoneExtent(next_extent_start + header_size,
-                                      extent_length, zone));
+    AddExtent(next_extent_start + header_size, extent_length, zone);
     uint64_t extent_blocks = (extent_length + header_size) / block_sz;
     if ((extent_length + header_size) % block_sz) {
       extent_blocks++;
@@ -1478,7 +1923,7 @@ IOStatus ZoneFile::Recover() {
     /* For non-sparse files, the data is contigous and we can recover directly
        any missing data using the WP */
     zone->used_capacity_ += to_recover;
-    extents_.push_back(new ZoneExtent(extent_start_, to_recover, zone));
+    AddExtent(extent_start_, to_recover, zone);
   }
 
   /* Mark up the file as having no missing extents */
@@ -1497,12 +1942,76 @@ IOStatus ZoneFile::Recover() {
   return IOStatus::OK();
 }
 
-void ZoneFile::ReplaceExtentList(std::vector<ZoneExtent*> new_list) {
+// APPEND-DOC, the CPU of the reader, or a hash of its thread if unknown
+size_t ZoneFile::ReadLockShard() {
+  int cpu = sched_getcpu();
+  if (cpu >= 0) return (size_t)cpu % ZENFS_READ_LOCK_SHARDS;
+  return std::hash<std::thread::id>()(std::this_thread::get_id()) %
+         ZENFS_READ_LOCK_SHARDS;
+}
+
+/* The count and writer_ are seq_cst, a reader and a writer cannot both miss
+ * each other */
+void ZoneFile::LockRead(ReaderShard* shard) {
+  while (true) {
+    shard->readers.fetch_add(1);
+    if (!writer_.load()) return;
+
+    UnlockRead(shard);
+    std::unique_lock<std::mutex> lk(rw_mtx_);
+    rw_cv_.wait(lk, [this] { return !writer_.load(); });
+  }
+}
+
+void ZoneFile::UnlockRead(ReaderShard* shard) {
+  shard->readers.fetch_sub(1);
+  if (writer_.load()) {
+    std::lock_guard<std::mutex> lk(rw_mtx_);
+    rw_cv_.notify_all();
+  }
+}
+
+bool ZoneFile::HasReaders() {
+  for (const auto& shard : reader_shards_) {
+    if (shard.readers.load() > 0) return true;
+  }
+  return false;
+}
+
+void ZoneFile::LockWrite() {
+  writer_mtx_.lock();
+  writer_.store(true);
+  std::unique_lock<std::mutex> lk(rw_mtx_);
+  rw_cv_.wait(lk, [this] { return !HasReaders(); });
+}
+
+void ZoneFile::UnlockWrite() {
+  {
+    std::lock_guard<std::mutex> lk(rw_mtx_);
+    writer_.store(false);
+  }
+  rw_cv_.notify_all();
+  writer_mtx_.unlock();
+}
+
+/* Must hold the WriteLock, so no new async read maps the old extents. The
+ * reads in flight are waited for on the device, not for their handles to be
+ * polled: the owner of a handle may be blocked on this file's rw lock. */
+void ZoneFile::WaitAsyncReads() {
+  std::lock_guard<std::mutex> lock(async_reads_mtx_);
+  for (ZbdReadRequest* req : async_reads_) zbd_->WaitReads(&req, 1);
+}
+
+void ZoneFile::ReplaceExtentList(const std::vector<ZoneExtent>& new_list) {
   assert(IsOpenForWR() && new_list.size() > 0);
   assert(new_list.size() == extents_.size());
 
   WriteLock lck(this);
-  extents_ = new_list;
+  WaitAsyncReads();
+  extents_.Clear();
+  for (const auto& extent : new_list)
+    extents_.Add(extent.start_, extent.length_, extent.zone_);
+  RebuildExtentIndex();
 }
 
 void ZoneFile::AddLinkName(const std::string& linkf) {
@@ -1566,15 +2075,28 @@ ZonedWritableFile::ZonedWritableFile(ZonedBlockDevice* zbd, bool _buffered,
     if (zoneFile->IsSparse()) {
       size_t sparse_buffer_sz;
 
-      // APPEND-DOC, we made the buffersize definable
-      sparse_buffer_sz =
-          SPARSE_BUFFER_SIZE_IN_KB * KiB + block_sz; /* one extra block size for padding */
-      int ret = posix_memalign((void**)&sparse_buffer, sysconf(_SC_PAGESIZE),
-                               sparse_buffer_sz);
-
-      if (ret) sparse_buffer = nullptr;
-
-      assert(sparse_buffer != nullptr);
+      // APPEND-DOC, we made the buffersize definable (per filesystem/mount)
+      sparse_buffer_sz = zbd->GetWALOptions().buffer_size_kb * KiB +
+                         block_sz; /* one extra block size for padding */
+
+      // APPEND-DOC, WALs get a ring of buffers, so that appends can continue
+      // while earlier buffers are still being appended to the device.
+      size_t nr_buffers = zoneFile->IsWAL() ? WAL_PIPELINE_DEPTH : 1;
+      for (size_t i = 0; i < nr_buffers; i++) {
+        char* wal_buffer = nullptr;
+        int ret = posix_memalign((void**)&wal_buffer, sysconf(_SC_PAGESIZE),
+                                 sparse_buffer_sz);
+        if (ret) wal_buffer = nullptr;
+        assert(wal_buffer != nullptr);
+        wal_buffers_.push_back(wal_buffer);
+      }
+      sparse_buffer = wal_buffers_[0];
+      if (nr_buffers > 1) {
+        wal_buffer_fill_.resize(nr_buffers, 0);
+        wal_buffer_issued_.resize(nr_buffers, 0);
+        wal_submitter_.reset(
+            new std::thread(&ZonedWritableFile::WALSubmitter, this));
+      }
 
       // APPEND-DOC, WALs need more space
       uint64_t header_size = ZoneFile::SPARSE_HEADER_SIZE + 
@@ -1592,14 +2114,26 @@ ZonedWritableFile::ZonedWritableFile(ZonedBlockDevice* zbd, bool _buffered,
     }
   }
 
+  wal_synced_wp_ = wp;
   open = true;
 }
 
 ZonedWritableFile::~ZonedWritableFile() {
   IOStatus s = CloseInternal();
+
+  // APPEND-DOC, stop the WAL submitter before releasing its buffers
+  if (wal_submitter_) {
+    {
+      std::lock_guard<std::mutex> lock(wal_pipeline_mtx_);
+      wal_submitter_stop_ = true;
+    }
+    wal_pipeline_cv_.notify_all();
+    wal_submitter_->join();
+  }
+
   if (buffered) {
     if (sparse_buffer != nullptr) {
-      free(sparse_buffer);
+      for (auto wal_buffer : wal_buffers_) free(wal_buffer);
     } else {
       free(buffer);
     }
@@ -1620,6 +2154,14 @@ IOStatus ZonedWritableFile::Truncate(uint64_t size,
 }
 
 IOStatus ZonedWritableFile::DataSync() {
+  // APPEND-DOC, background zone resets report their errors here and on the
+  // next zone allocation
+  IOStatus deferred = zoneFile_->GetZbd()->GetZoneDeferredStatus();
+  if (!deferred.ok()) return deferred;
+
+  // APPEND-DOC, buffered WALs coalesce concurrent syncs
+  if (zoneFile_->IsWAL() && buffered) return WALGroupSync();
+
   // APPEND-DOC, sync on datasync
   if (zoneFile_->IsWAL()) {
     zoneFile_->WALSync();
@@ -1643,6 +2185,8 @@ IOStatus ZonedWritableFile::DataSync() {
     /* For direct writes, there is no buffer to flush, we just need to push
        an extent for the latest written data */
     zoneFile_->PushExtent();
+    // APPEND-DOC, extents of shared zones can not be recovered from the wp
+    if (zoneFile_->UsesZoneAppends()) return zoneFile_->PersistMetadata();
   }
 
   return IOStatus::OK();
@@ -1702,6 +2246,10 @@ IOStatus ZonedWritableFile::CloseInternal() {
   IOStatus s = DataSync();
   if (!s.ok()) return s;
 
+  // APPEND-DOC, the last buffer is handed off by DataSync
+  s = DrainWALPipeline();
+  if (!s.ok()) return s;
+
   s = zoneFile_->CloseWR();
   if (!s.ok()) return s;
 
@@ -1714,6 +2262,8 @@ IOStatus ZonedWritableFile::FlushBuffer() {
 
   if (buffer_pos == 0) return IOStatus::OK();
 
+  if (wal_submitter_) return HandOffWALBuffer();
+
   if (zoneFile_->IsSparse()) {
     s = zoneFile_->SparseAppend(sparse_buffer, buffer_pos);
   } else {
@@ -1730,20 +2280,160 @@ IOStatus ZonedWritableFile::FlushBuffer() {
   return IOStatus::OK();
 }
 
+// APPEND-DOC, WAL sync with group commit. Every caller needs the data it
+// appended (up to wp + buffer_pos) to be behind a barrier. If a sync is
+// already running, the caller waits for it and only becomes the leader of a
+// new sync if its data was not covered. The leader flushes the buffer, waits
+// for the in flight appends and issues a single barrier for all waiters.
+IOStatus ZonedWritableFile::WALGroupSync() {
+  uint64_t target;
+
+  buffer_mtx_.lock();
+  target = wp + buffer_pos;
+  buffer_mtx_.unlock();
+
+  std::unique_lock<std::mutex> lock(wal_sync_mtx_);
+  while (wal_synced_wp_ < target) {
+    if (wal_sync_leader_) {
+      wal_sync_cv_.wait(lock);
+      continue;
+    }
+    wal_sync_leader_ = true;
+    lock.unlock();
+
+    IOStatus s;
+    uint64_t covered;
+    buffer_mtx_.lock();
+    covered = wp + buffer_pos;
+    s = FlushBuffer();
+    if (s.ok()) s = DrainWALPipeline();
+    if (s.ok()) s = zoneFile_->WALSync();
+    buffer_mtx_.unlock();
+
+    lock.lock();
+    wal_sync_leader_ = false;
+    if (s.ok() && covered > wal_synced_wp_) wal_synced_wp_ = covered;
+    wal_sync_cv_.notify_all();
+    /* Waiters that are not covered retry as the next leader */
+    if (!s.ok()) return s;
+  }
+
+  return IOStatus::OK();
+}
+
+// APPEND-DOC, a buffer can be filled again once the appends issued from it
+// completed. Must hold wal_pipeline_mtx_.
+bool ZonedWritableFile::WALBufferFree(size_t idx) {
+  return wal_buffer_issued_[idx] != UINT64_MAX &&
+         zoneFile_->GetWALAppendsCompleted() >= wal_buffer_issued_[idx];
+}
+
+// APPEND-DOC, pass the filled buffer to the submitter and continue in the next
+IOStatus ZonedWritableFile::HandOffWALBuffer() {
+  std::unique_lock<std::mutex> lock(wal_pipeline_mtx_);
+  size_t next = (wal_fill_idx_ + 1) % wal_buffers_.size();
+
+  /* The next buffer may still be queued or have appends in flight, the
+   * submitter reaps those with a sync once the queue is empty */
+  while (!WALBufferFree(next) && wal_submit_status_.ok()) {
+    wal_reap_ = true;
+    wal_pipeline_cv_.notify_all();
+    wal_pipeline_cv_.wait(lock);
+  }
+  if (!wal_submit_status_.ok()) return wal_submit_status_;
+
+  wal_buffer_fill_[wal_fill_idx_] = buffer_pos;
+  wal_buffer_issued_[wal_fill_idx_] = UINT64_MAX; /* queued */
+  wal_inflight_++;
+  wal_fill_idx_ = (wal_fill_idx_ + 1) % wal_buffers_.size();
+  lock.unlock();
+  wal_pipeline_cv_.notify_all();
+
+  size_t header_size = buffer - sparse_buffer;
+  sparse_buffer = wal_buffers_[wal_fill_idx_];
+  buffer = sparse_buffer + header_size;
+
+  wp += buffer_pos;
+  buffer_pos = 0;
+
+  return IOStatus::OK();
+}
+
+// APPEND-DOC, wait until all handed off buffers are appended
+IOStatus ZonedWritableFile::DrainWALPipeline() {
+  if (!wal_submitter_) return IOStatus::OK();
+
+  std::unique_lock<std::mutex> lock(wal_pipeline_mtx_);
+  wal_pipeline_cv_.wait(lock,
+                        [&] { return wal_inflight_ == 0 && !wal_reap_; });
+  return wal_submit_status_;
+}
+
+// APPEND-DOC, appends the handed off buffers in order. If the log copies the
+// data (SZD channels with preserve_async_buffer), a buffer is free as soon as
+// its appends are issued. Otherwise it is free once a sync completed them, a
+// barrier in SparseAppend or a reap. Barriers (WALSync) wait for the actual
+// completions either way.
+void ZonedWritableFile::WALSubmitter() {
+  std::unique_lock<std::mutex> lock(wal_pipeline_mtx_);
+
+  while (true) {
+    wal_pipeline_cv_.wait(lock, [&] {
+      return wal_inflight_ > 0 || wal_reap_ || wal_submitter_stop_;
+    });
+    if (wal_inflight_ == 0 && !wal_reap_) break;
+
+    bool reap = wal_inflight_ == 0;
+    size_t idx = wal_submit_idx_;
+    IOStatus s = wal_submit_status_;
+    lock.unlock();
+
+    /* After an error the remaining buffers are dropped, the error is
+     * reported on the next hand off or sync */
+    if (s.ok()) {
+      if (reap)
+        s = zoneFile_->WALSync();
+      else
+        s = zoneFile_->SparseAppend(wal_buffers_[idx], wal_buffer_fill_[idx]);
+    }
+
+    lock.lock();
+    if (!s.ok() && wal_submit_status_.ok()) wal_submit_status_ = s;
+    if (reap) {
+      wal_reap_ = false;
+    } else {
+      wal_buffer_issued_[idx] = zoneFile_->WALCopiesAppends()
+                                    ? 0
+                                    : zoneFile_->GetWALAppendsIssued();
+      wal_submit_idx_ = (idx + 1) % wal_buffers_.size();
+      wal_inflight_--;
+    }
+    wal_pipeline_cv_.notify_all();
+  }
+}
+
+// APPEND-DOC, makes room in the write buffer, flushing it when it is full
+IOStatus ZonedWritableFile::ReserveBuffer(uint32_t* buffer_left) {
+  if (buffer_pos == buffer_sz) {
+    IOStatus s = FlushBuffer();
+    if (!s.ok()) return s;
+  }
+
+  *buffer_left = buffer_sz - buffer_pos;
+  return IOStatus::OK();
+}
+
 IOStatus ZonedWritableFile::BufferedWrite(const Slice& slice) {
   uint32_t data_left = slice.size();
   char* data = (char*)slice.data();
   IOStatus s;
 
   while (data_left) {
-    uint32_t buffer_left = buffer_sz - buffer_pos;
+    uint32_t buffer_left;
     uint32_t to_buffer;
 
-    if (!buffer_left) {
-      s = FlushBuffer();
-      if (!s.ok()) return s;
-      buffer_left = buffer_sz;
-    } 
+    s = ReserveBuffer(&buffer_left);
+    if (!s.ok()) return s;
 
     to_buffer = data_left;
     if (to_buffer > buffer_left) {
@@ -1759,6 +2449,35 @@ IOStatus ZonedWritableFile::BufferedWrite(const Slice& slice) {
   return IOStatus::OK();
 }
 
+IOStatus ZonedWritableFile::ReserveAppend(size_t n, char** dst,
+                                          size_t* avail) {
+  uint32_t buffer_left;
+  IOStatus s;
+
+  if (!buffered)
+    return IOStatus::NotSupported("Zero-copy append needs a buffered file");
+
+  buffer_mtx_.lock();
+  s = ReserveBuffer(&buffer_left);
+  if (!s.ok()) {
+    buffer_mtx_.unlock();
+    return s;
+  }
+
+  *dst = buffer + buffer_pos;
+  *avail = std::min(n, (size_t)buffer_left);
+  return IOStatus::OK();
+}
+
+void ZonedWritableFile::CommitAppend(size_t n) {
+  assert(buffer_pos + n <= buffer_sz);
+  buffer_pos += n;
+  buffer_mtx_.unlock();
+
+  zoneFile_->GetZBDMetrics()->ReportQPS(ZENFS_WRITE_QPS, 1);
+  zoneFile_->GetZBDMetrics()->ReportThroughput(ZENFS_WRITE_THROUGHPUT, n);
+}
+
 IOStatus ZonedWritableFile::Append(const Slice& data,
                                    const IOOptions& /*options*/,
                                    IODebugContext* /*dbg*/) {
@@ -1818,12 +2537,91 @@ void ZonedWritableFile::SetWriteLifeTimeHint(Env::WriteLifeTimeHint hint) {
   zoneFile_->SetWriteLifeTimeHint(hint);
 }
 
+IOStatus ZonedReadahead::Fill(uint64_t offset, size_t n) {
+  uint32_t block_sz = zoneFile_->GetBlockSize();
+  Slice result;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (Covers(offset, n)) return IOStatus::OK();
+
+  /* Direct reads start on a block and the buffer has a block of tail room for
+   * the padding of an unaligned last extent */
+  if (!buf_ && posix_memalign((void**)&buf_, sysconf(_SC_PAGESIZE),
+                              ZENFS_READAHEAD_SIZE + block_sz)) {
+    buf_ = nullptr;
+    return IOStatus::IOError("Out of memory for readahead");
+  }
+
+  uint64_t start = direct_ ? offset - offset % block_sz : offset;
+  size_t sz = std::min((size_t)ZENFS_READAHEAD_SIZE, n + (offset - start));
+  if (direct_ && sz % block_sz) sz += block_sz - sz % block_sz;
+  sz = std::min(sz, (size_t)ZENFS_READAHEAD_SIZE);
+
+  len_ = 0;
+  IOStatus s = zoneFile_->PositionedRead(start, sz, &result, buf_, direct_);
+  if (!s.ok()) return s;
+  start_ = start;
+  len_ = result.size();
+  return IOStatus::OK();
+}
+
+/* Must hold mtx_. A range that reaches past the end of the file is covered if
+ * the buffer holds the rest of the file. */
+bool ZonedReadahead::Covers(uint64_t offset, size_t n) {
+  uint64_t end = start_ + len_;
+  if (!len_ || offset < start_ || offset >= end) return false;
+  return offset + n <= end || end >= zoneFile_->GetFileSize();
+}
+
+void ZonedReadahead::Copy(uint64_t offset, size_t n, Slice* result,
+                          char* scratch) {
+  size_t sz = std::min(n, (size_t)(start_ + len_ - offset));
+  memcpy(scratch, buf_ + (offset - start_), sz);
+  *result = Slice(scratch, sz);
+}
+
+bool ZonedReadahead::TryRead(uint64_t offset, size_t n, Slice* result,
+                             char* scratch) {
+  if (!enabled_) return false;
+
+  std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+  if (!lock.owns_lock() || !len_) return false;
+
+  if (!Covers(offset, n)) {
+    zoneFile_->GetZBDMetrics()->ReportQPS(ZENFS_READAHEAD_MISS_QPS, 1);
+    return false;
+  }
+  Copy(offset, n, result, scratch);
+  zoneFile_->GetZBDMetrics()->ReportQPS(ZENFS_READAHEAD_HIT_QPS, 1);
+  return true;
+}
+
+IOStatus ZonedReadahead::Read(uint64_t offset, size_t n, Slice* result,
+                              char* scratch) {
+  /* Reads of the full readahead size gain nothing from the copy */
+  if (!enabled_ || n >= ZENFS_READAHEAD_SIZE)
+    return zoneFile_->PositionedRead(offset, n, result, scratch, direct_);
+
+  if (TryRead(offset, n, result, scratch)) return IOStatus::OK();
+
+  IOStatus s = Fill(offset, ZENFS_READAHEAD_SIZE);
+  if (!s.ok()) return s;
+
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (!Covers(offset, n)) {
+    *result = Slice(scratch, 0);
+    return IOStatus::OK();
+  }
+  Copy(offset, n, result, scratch);
+  return IOStatus::OK();
+}
+
 IOStatus ZonedSequentialFile::Read(size_t n, const IOOptions& /*options*/,
                                    Slice* result, char* scratch,
                                    IODebugContext* /*dbg*/) {
   IOStatus s;
 
-  s = zoneFile_->PositionedRead(rp, n, result, scratch, direct_);
+  s = readahead_.Read(rp, n, result, scratch);
   if (s.ok()) rp += result->size();
 
   return s;
@@ -1847,56 +2645,267 @@ IOStatus ZonedRandomAccessFile::Read(uint64_t offset, size_t n,
                                      const IOOptions& /*options*/,
                                      Slice* result, char* scratch,
                                      IODebugContext* /*dbg*/) const {
+  if (readahead_->TryRead(offset, n, result, scratch)) return IOStatus::OK();
   return zoneFile_->PositionedRead(offset, n, result, scratch, direct_);
 }
 
+IOStatus ZonedRandomAccessFile::MultiRead(FSReadRequest* reqs,
+                                          size_t num_reqs,
+                                          const IOOptions& /*options*/,
+                                          IODebugContext* /*dbg*/) {
+  return zoneFile_->MultiRead(reqs, num_reqs, direct_);
+}
+
+// APPEND-DOC, reads that can not be submitted as one device read complete
+// synchronously, without a handle
+IOStatus ZonedRandomAccessFile::ReadAsync(
+    FSReadRequest& req, const IOOptions& opts,
+    std::function<void(const FSReadRequest&, void*)> cb, void* cb_arg,
+    void** io_handle, IOHandleDeleter* del_fn, IODebugContext* dbg) {
+  ZenFSAsyncRead* handle = ZoneFile::SubmitAsyncRead(zoneFile_, req, direct_);
+
+  if (!handle) {
+    req.status = Read(req.offset, req.len, opts, &req.result, req.scratch, dbg);
+    cb(req, cb_arg);
+    return IOStatus::OK();
+  }
+
+  handle->cb_ = cb;
+  handle->cb_arg_ = cb_arg;
+  *io_handle = handle;
+  *del_fn = [](void* h) { delete static_cast<ZenFSAsyncRead*>(h); };
+  return IOStatus::OK();
+}
+
 // APPEND-DOC, method to force sync the WAL
 IOStatus ZoneFile::WALSync() {
   if (wal_) {
+    std::shared_ptr<ZenFSMetrics> metrics = zbd_->GetMetrics();
+    ZenFSMetricsLatencyGuard guard(metrics, ZENFS_WAL_BARRIER_LATENCY,
+                                   Env::Default());
+    metrics->ReportQPS(ZENFS_WAL_BARRIER_QPS, 1);
+    uint64_t issued = wal_appends_issued_;
     zbd_->AppendSync(wal_);
-    return wal_->Sync() == SZD::SZDStatus::Success 
-      ? IOStatus::OK()
-      : IOStatus::IOError("Error WAL sync"); 
+    wal_appends_in_flight_ = 0;
+    if (wal_->Sync() != SZD::SZDStatus::Success)
+      return IOStatus::IOError("Error WAL sync");
+    wal_appends_completed_ = issued;
   }
   return IOStatus::OK();
 }
 
+// APPEND-DOC, the appends stay in flight until the next barrier (WALSync)
+IOStatus ZoneFile::WALZoneAppend(char* data, uint32_t size, uint32_t pad_sz) {
+  std::shared_ptr<ZenFSMetrics> metrics = zbd_->GetMetrics();
+  IOStatus s;
+
+  uint64_t begin_us = Env::Default()->NowMicros();
+  s = active_zone_->ZoneAppend(data, size, wal_);
+  if (!s.ok()) return s;
+  uint64_t append_us = Env::Default()->NowMicros() - begin_us;
+  metrics->ReportLatency(ZENFS_WAL_ZONE_APPEND_LATENCY, append_us);
+#ifdef WAL_BARRIERS
+  wal_append_us_ewma_ = (3 * wal_append_us_ewma_ + append_us) / 4;
+#endif
+
+  wal_appends_issued_++;
+  metrics->ReportGeneral(ZENFS_WAL_APPENDS_IN_FLIGHT_COUNT,
+                         ++wal_appends_in_flight_);
+  if (pad_sz) metrics->ReportThroughput(ZENFS_WAL_PADDING_THROUGHPUT, pad_sz);
+  return s;
+}
+
+#ifdef WAL_BARRIERS
+// APPEND-DOC, barrier between two chunks of the WAL. Adaptive WALs size the
+// next chunk here.
+IOStatus ZoneFile::WALBarrier() {
+  uint64_t in_flight = wal_appends_in_flight_;
+  uint64_t begin_us = Env::Default()->NowMicros();
+  IOStatus s = WALSync();
+  if (!s.ok()) return s;
+  uint64_t end_us = Env::Default()->NowMicros();
+
+  if (wal_barrier_adaptive_)
+    AdaptWALBarrier(begin_us, end_us - begin_us, in_flight);
+  append_bytes_since_last_barrier_ = 0;
+  wal_chunk_begin_us_ = end_us;
+  wal_syncs_++;
+  return s;
+}
+
+// APPEND-DOC, sizes the next chunk from the write rate and the stall of a
+// barrier. A chunk that takes WAL_BARRIER_AMORTIZE times the stall to fill
+// hides the stall, a larger one only widens the reorder window and the
+// recovery chunks. If the appends since the last sync already filled the
+// queue of the channel, the device is the limit and the barrier does not
+// grow. The barrier moves by at most a factor of two per chunk, within the
+// bounds of the mount.
+void ZoneFile::AdaptWALBarrier(uint64_t barrier_begin_us, uint64_t barrier_us,
+                               uint64_t in_flight) {
+  const ZWALOptions& options = zbd_->GetWALOptions();
+  uint64_t step = options.buffer_size_kb * KiB;
+  uint64_t barrier;
+  double target;
+
+  /* The first chunk after opening the WAL has no fill time */
+  if (wal_chunk_begin_us_ == 0 || options.barrier_max_kb == 0) return;
+
+  double fill_us = std::max<uint64_t>(barrier_begin_us - wal_chunk_begin_us_, 1);
+  double rate = append_bytes_since_last_barrier_ / fill_us;
+  double stall = std::max<double>(barrier_us, wal_append_us_ewma_);
+  wal_rate_ewma_ = wal_rate_ewma_ > 0 ? (3 * wal_rate_ewma_ + rate) / 4 : rate;
+  wal_stall_us_ewma_ = wal_stall_us_ewma_ > 0
+                           ? (3 * wal_stall_us_ewma_ + stall) / 4
+                           : stall;
+
+  target = wal_rate_ewma_ * wal_stall_us_ewma_ * WAL_BARRIER_AMORTIZE;
+  if (in_flight >= options.depth)
+    target = std::min<double>(target, wal_barrier_sz_);
+  target = std::max<double>(target, wal_barrier_sz_ / 2);
+  target = std::min<double>(target, wal_barrier_sz_ * 2);
+
+  barrier = static_cast<uint64_t>(target) / step * step;
+  barrier = std::max<uint64_t>(barrier, options.barrier_min_kb * KiB);
+  barrier = std::min<uint64_t>(barrier, options.barrier_max_kb * KiB);
+  wal_barrier_sz_ = std::max(barrier, step);
+  zbd_->GetMetrics()->ReportGeneral(ZENFS_WAL_BARRIER_SIZE, wal_barrier_sz_);
+}
+
+// APPEND-DOC, barrier of the chunk starting at begin. Appends never cross a
+// barrier, so a chunk starts with the header of one of its entries.
+IOStatus ZoneFile::ReadWALChunkBarrier(uint64_t begin, uint64_t* barrier) {
+  uint32_t block_sz = GetBlockSize();
+  char* buf;
+
+  if (posix_memalign((void**)&buf, sysconf(_SC_PAGESIZE), block_sz))
+    return IOStatus::IOError("Out of memory while recovering WAL");
+
+  IOStatus s = ReadWALChunk(begin, begin + block_sz, buf);
+  if (s.ok()) {
+    *barrier = (DecodeFixed64(buf) >> WAL_CHUNK_BARRIER_SHIFT) * KiB;
+    if (*barrier == 0 || *barrier % block_sz)
+      s = IOStatus::Corruption("Missing WAL chunk barrier\n");
+  }
+  free(buf);
+  return s;
+}
+
+// APPEND-DOC, the chunks of the once log. Chunks of fixed WALs are
+// wal_barrier_sz_ apart, adaptive WALs read the barrier of every chunk.
+IOStatus ZoneFile::LoadWALChunkBounds() {
+  uint64_t shift = shift_block_size(GetBlockSize());
+  uint64_t pos = wal_->GetWriteTail() << shift;
+  uint64_t head = wal_->GetWriteHead() << shift;
+  IOStatus s;
+
+  wal_chunk_bounds_.clear();
+  while (pos < head) {
+    uint64_t barrier = wal_barrier_sz_;
+    if (wal_barrier_adaptive_) {
+      s = ReadWALChunkBarrier(pos, &barrier);
+      if (!s.ok()) {
+        wal_chunk_bounds_.clear();
+        return s;
+      }
+    }
+    wal_chunk_bounds_.push_back(pos);
+    pos = std::min(pos + barrier, head);
+  }
+  wal_chunk_bounds_.push_back(head);
+  return s;
+}
+
+// APPEND-DOC, a reopened adaptive WAL fills its last chunk up to the barrier
+// that chunk was started with
+IOStatus ZoneFile::ResumeWALBarrier() {
+  IOStatus s = LoadWALChunkBounds();
+  if (!s.ok()) return s;
+
+  size_t n = wal_chunk_bounds_.size();
+  append_bytes_since_last_barrier_ = 0;
+  if (n >= 2) {
+    s = ReadWALChunkBarrier(wal_chunk_bounds_[n - 2], &wal_barrier_sz_);
+    if (!s.ok()) return s;
+    append_bytes_since_last_barrier_ =
+        wal_chunk_bounds_[n - 1] - wal_chunk_bounds_[n - 2];
+  }
+  wal_chunk_bounds_.clear();
+  wal_barrier_resume_ = false;
+  return s;
+}
+#endif
+
+// APPEND-DOC, the read of the next step is in flight while the current step
+// is appended to the target zone. Every step is charged to the GC bandwidth
+// budget before it is read.
 IOStatus ZoneFile::MigrateData(uint64_t offset, uint32_t length,
                                Zone* target_zone) {
-  uint32_t step = 128 << 10;
-  uint32_t read_sz = step;
+  const uint32_t step = ZENFS_GC_MIGRATE_STEP;
   int block_sz = zbd_->GetBlockSize();
+  IOStatus s;
 
   assert(offset % block_sz == 0);
   if (offset % block_sz != 0) {
     return IOStatus::IOError("MigrateData offset is not aligned!\n");
   }
 
-  char* buf;
-  int ret = posix_memalign((void**)&buf, block_sz, step);
-  if (ret) {
-    return IOStatus::IOError("failed allocating alignment write buffer\n");
+  char* bufs[2] = {nullptr, nullptr};
+  for (auto& buf : bufs) {
+    if (posix_memalign((void**)&buf, block_sz, step)) {
+      free(bufs[0]);
+      return IOStatus::IOError("failed allocating alignment write buffer\n");
+    }
   }
 
-  int pad_sz = 0;
-  while (length > 0) {
-    read_sz = length > read_sz ? read_sz : length;
-    pad_sz = read_sz % block_sz == 0 ? 0 : (block_sz - (read_sz % block_sz));
+  ZbdReadRequest reqs[2];
+  int cur = 0;
 
-    int r = zbd_->Read(buf, offset, read_sz + pad_sz, true);
-    if (r < 0) {
-      free(buf);
-      return IOStatus::IOError(strerror(errno));
-    }
-    target_zone->Append(buf, r);
+  /* Submits the read of the next step into bufs[n] */
+  auto submit = [&](int n) {
+    uint32_t read_sz = length > step ? step : length;
+    uint32_t pad_sz =
+        read_sz % block_sz == 0 ? 0 : (block_sz - (read_sz % block_sz));
+    ZbdReadRequest* req = &reqs[n];
+
+    zbd_->ThrottleGC(read_sz + pad_sz);
+    *req = ZbdReadRequest();
+    req->buf = bufs[n];
+    req->pos = offset;
+    req->size = read_sz + pad_sz;
+    req->direct = true;
+    zbd_->SubmitReads(&req, 1);
     length -= read_sz;
-    offset += r;
-  }
+    offset += read_sz + pad_sz;
+  };
+
+  if (length > 0) submit(cur);
+  while (reqs[cur].buf != nullptr) {
+    ZbdReadRequest* req = &reqs[cur];
+    zbd_->WaitReads(&req, 1);
+    if (req->result != req->size) {
+      s = req->result < 0 ? IOStatus::IOError(strerror(-req->result))
+                          : IOStatus::IOError("MigrateData short read");
+      break;
+    }
 
-  free(buf);
+    bool last = length == 0;
+    if (!last) submit(cur ^ 1);
+    s = target_zone->Append(bufs[cur], req->size);
+    if (!s.ok()) {
+      /* Do not free the buffer of the read in flight */
+      req = &reqs[cur ^ 1];
+      if (!last) zbd_->WaitReads(&req, 1);
+      break;
+    }
+    zbd_->GetMetrics()->ReportThroughput(ZENFS_GC_MIGRATE_THROUGHPUT,
+                                         req->size);
+    if (last) break;
+    cur ^= 1;
+  }
 
-                      //  printf("  Migrate data done\n");
-  return IOStatus::OK();
+  free(bufs[0]);
+  free(bufs[1]);
+  return s;
 }
 
 }  // namespace ROCKSDB_NAMESPACE
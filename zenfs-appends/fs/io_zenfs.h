@@ -15,9 +15,15 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -26,26 +32,105 @@
 #include "zbd_zenfs.h"
 
 #define KiB (1UL << 10UL)
-// APPEND-DOC BELOW is set explicitly in the build script
+// APPEND-DOC BELOW is set explicitly in the build script. It is only the
+// default, the buffer size can be changed at mkfs time or per mount (ZWALOptions)
 #define SPARSE_BUFFER_SIZE_IN_KB (KiB)UL
+// APPEND-DOC, sparse appends are padded to 4 KiB blocks, so WAL buffer sizes
+// must be a multiple of it
+#define SPARSE_BLOCK_SIZE (4096)
 //#define MEASURE_WAL_LAT
+// APPEND-DOC, number of sparse buffers per WAL writer. While one buffer is
+// filled, the others can be in flight to the device. 1 disables pipelining.
+#define WAL_PIPELINE_DEPTH (4)
+// APPEND-DOC, WAL recovery. Worker threads read, decode and sort up to
+// WAL_RECOVERY_DEPTH barrier chunks ahead of the reader. 0 threads recovers
+// one chunk at a time on the reading thread.
+#define WAL_RECOVERY_THREADS (4)
+#define WAL_RECOVERY_DEPTH (16)
+// APPEND-DOC, readahead buffer of a file reader, 0 disables readahead
+#define ZENFS_READAHEAD_SIZE (256 * KiB)
+// APPEND-DOC, reader counts of a file, readers count on the shard of their CPU.
+// Every file has them, a shard is a cache line.
+#define ZENFS_READ_LOCK_SHARDS (4)
 // APPEND-DOC barriers (by default 1MiB)
 #define WAL_BARRIERS
 
 #ifdef WAL_BARRIERS
+// APPEND-DOC, default barrier size, see SPARSE_BUFFER_SIZE_IN_KB
 #define WAL_BARRIER_SIZE_IN_KB (KiB)UL
 static_assert(WAL_BARRIER_SIZE_IN_KB % SPARSE_BUFFER_SIZE_IN_KB == 0 && 
   SPARSE_BUFFER_SIZE_IN_KB > 0 && WAL_BARRIER_SIZE_IN_KB > 0);
+// APPEND-DOC, adaptive barriers are sized so that the stall of a barrier is
+// about 1/WAL_BARRIER_AMORTIZE of the time it took to fill the chunk
+#define WAL_BARRIER_AMORTIZE (16)
 #endif
+// APPEND-DOC, the length in a WAL entry header. Entries of adaptive WALs carry
+// the barrier of their chunk (in KiB) in the upper bits.
+#define WAL_CHUNK_LENGTH_MASK (0xffffffffULL)
+#define WAL_CHUNK_BARRIER_SHIFT (32)
 
 namespace ROCKSDB_NAMESPACE {
 
 
+// APPEND-DOC, a decoded WAL entry, a view into the buffer of its chunk
+struct wal_entry {
+  uint64_t seq_;
+  uint64_t offset_;
+  uint64_t length_;
+};
+
+// APPEND-DOC, the entries of a recovered WAL chunk. The chunk is read into a
+// single page aligned buffer and the entries only index into it, so a chunk
+// costs two allocations and is released as a whole once it is consumed.
+class WALChunkEntries {
+ public:
+  WALChunkEntries() {}
+  WALChunkEntries(WALChunkEntries&& other) { Swap(other); }
+  WALChunkEntries(const WALChunkEntries&) = delete;
+  WALChunkEntries& operator=(const WALChunkEntries&) = delete;
+  ~WALChunkEntries() { Clear(); }
+
+  /* Replaces the buffer, returns NULL if out of memory */
+  char* Allocate(size_t size);
+  void Clear();
+  void Swap(WALChunkEntries& other) {
+    std::swap(buffer_, other.buffer_);
+    index_.swap(other.index_);
+  }
+
+  void Add(uint64_t seq, uint64_t offset, uint64_t length) {
+    index_.push_back({seq, offset, length});
+  }
+  /* Returns the number of entries the device returned out of order */
+  uint64_t Sort();
+
+  char* Buffer() { return buffer_; }
+  size_t size() const { return index_.size(); }
+  const wal_entry& operator[](size_t i) const { return index_[i]; }
+  const char* Data(size_t i) const { return buffer_ + index_[i].offset_; }
+  std::vector<wal_entry>::const_iterator begin() const {
+    return index_.begin();
+  }
+  std::vector<wal_entry>::const_iterator end() const { return index_.end(); }
+
+ private:
+  char* buffer_{nullptr};
+  std::vector<wal_entry> index_;
+};
+
 struct loaded_wal_chunk {
   uint64_t start_;
   uint64_t end_;
   uint64_t jump_;
-  std::vector<std::pair<uint64_t, std::string*>>  wal_entries_;
+  WALChunkEntries wal_entries_;
+};
+
+// APPEND-DOC, a barrier chunk decoded ahead of the reader during recovery
+struct recovered_wal_chunk {
+  uint64_t id_;
+  bool ready_;
+  IOStatus status_;
+  WALChunkEntries wal_entries_;
 };
 
 class ZoneExtent {
@@ -56,11 +141,56 @@ class ZoneExtent {
 
   explicit ZoneExtent(uint64_t start, uint64_t length, Zone* zone);
   Status DecodeFrom(Slice* input);
-  void EncodeTo(std::string* output);
-  void EncodeJson(std::ostream& json_stream);
+  void EncodeTo(std::string* output) const;
+  void EncodeJson(std::ostream& json_stream) const;
+};
+
+// APPEND-DOC, extents of a file. They are pooled in the chunks of a deque
+// instead of being allocated one by one, iteration yields pointers into the
+// pool and pointers stay valid while extents are added.
+class ZoneExtentList {
+ public:
+  template <typename It, typename T>
+  class Iterator {
+   public:
+    explicit Iterator(It it) : it_(it) {}
+    T* operator*() const { return &*it_; }
+    Iterator& operator++() {
+      ++it_;
+      return *this;
+    }
+    bool operator!=(const Iterator& other) const { return it_ != other.it_; }
+
+   private:
+    It it_;
+  };
+  typedef Iterator<std::deque<ZoneExtent>::iterator, ZoneExtent> iterator;
+  typedef Iterator<std::deque<ZoneExtent>::const_iterator, const ZoneExtent>
+      const_iterator;
+
+  ZoneExtent* Add(uint64_t start, uint64_t length, Zone* zone) {
+    extents_.emplace_back(start, length, zone);
+    return &extents_.back();
+  }
+  void Clear() { std::deque<ZoneExtent>().swap(extents_); }
+
+  size_t size() const { return extents_.size(); }
+  bool empty() const { return extents_.empty(); }
+  ZoneExtent* operator[](size_t i) { return &extents_[i]; }
+  const ZoneExtent* operator[](size_t i) const { return &extents_[i]; }
+  ZoneExtent* back() { return &extents_.back(); }
+
+  iterator begin() { return iterator(extents_.begin()); }
+  iterator end() { return iterator(extents_.end()); }
+  const_iterator begin() const { return const_iterator(extents_.cbegin()); }
+  const_iterator end() const { return const_iterator(extents_.cend()); }
+
+ private:
+  std::deque<ZoneExtent> extents_;
 };
 
 class ZoneFile;
+struct ZenFSAsyncRead;
 
 /* Interface for persisting metadata for files */
 class MetadataWriter {
@@ -75,12 +205,17 @@ class ZoneFile {
 
   ZonedBlockDevice* zbd_;
 
-  std::vector<ZoneExtent*> extents_;
+  ZoneExtentList extents_;
+  // APPEND-DOC, prefix sums of the extent lengths, extent_ends_[i] is the file
+  // offset where extent i ends. Reads map offsets to extents in O(log n).
+  std::vector<uint64_t> extent_ends_;
   std::vector<std::string> linkfiles_;
 
   Zone* active_zone_;
   uint64_t extent_start_ = NO_EXTENT;
   uint64_t extent_filepos_ = 0;
+  // APPEND-DOC, active zone is shared with other SSTs (zone append mode)
+  bool active_zone_shared_ = false;
 
   Env::WriteLifeTimeHint lifetime_;
   IOType io_type_; /* Only used when writing */
@@ -88,15 +223,40 @@ class ZoneFile {
   //APPEND-DOC, wal variables
   bool is_wal_{false};
   std::atomic<uint64_t> wal_seq_{0};
-  SZD::SZDOnceLog *wal_{nullptr};
+  ZoneAppendLog *wal_{nullptr};
+  WALZoneRange wal_range_;
+  std::mutex wal_read_mtx_;
+  // APPEND-DOC, zone budget the file allocates from
+  uint32_t tenant_{ZENFS_DEFAULT_TENANT};
 #ifdef WAL_BARRIERS
   struct loaded_wal_chunk loaded_wal_chunks_{1ULL, 0ULL, 0ULL, {}};
   uint64_t chunk_id_{0};
+  // APPEND-DOC, barrier size of this WAL, fixed at creation and persisted
+  uint64_t wal_barrier_sz_{0};
   uint64_t append_bytes_since_last_barrier_{0};
   uint64_t wal_syncs_{0};
   uint64_t wal_writes_{0};
+  // APPEND-DOC, adaptive barriers. The barrier changes only at a barrier, a
+  // reopened WAL first finds the barrier of its last chunk (resume).
+  bool wal_barrier_adaptive_{false};
+  bool wal_barrier_resume_{false};
+  uint64_t wal_chunk_begin_us_{0};
+  double wal_rate_ewma_{0};      /* bytes per us while filling a chunk */
+  double wal_stall_us_ewma_{0};  /* barrier or append latency, the larger */
+  double wal_append_us_ewma_{0};
+  // APPEND-DOC, chunk starts in the once log, the last entry is the head
+  std::vector<uint64_t> wal_chunk_bounds_;
+  // APPEND-DOC, parallel recovery, the chunk bounds are fixed when it starts
+  std::vector<std::thread> wal_recovery_threads_;
+  std::vector<struct recovered_wal_chunk> wal_recovery_chunks_;
+  uint64_t wal_recovery_nr_{0};
+  uint64_t wal_recovery_next_{0};
+  uint64_t wal_recovery_taken_{0};
+  bool wal_recovery_stop_{false};
+  std::mutex wal_recovery_mtx_;
+  std::condition_variable wal_recovery_cv_;
 #else
-  std::vector<std::pair<uint64_t, std::string*> > wal_entries_;
+  WALChunkEntries wal_entries_;
 #endif
 
   uint64_t file_size_;
@@ -112,14 +272,32 @@ class ZoneFile {
 
   MetadataWriter* metadata_writer_ = NULL;
 
-  std::mutex writer_mtx_;
-  std::atomic<int> readers_{0};
+  // APPEND-DOC, readers only touch the counter of their shard. A writer sets
+  // writer_ and waits for the counts to drain, readers that see writer_ back
+  // off and wait for it on rw_cv_.
+  struct alignas(64) ReaderShard {
+    std::atomic<int> readers{0};
+  };
+  ReaderShard reader_shards_[ZENFS_READ_LOCK_SHARDS];
+  std::atomic<bool> writer_{false};
+  std::mutex writer_mtx_; /* serializes writers */
+  std::mutex rw_mtx_;
+  std::condition_variable rw_cv_;
+
+  // APPEND-DOC, device reads of ReadAsync handles that may still be in
+  // flight. They pin the extents they read from without the rw lock, see
+  // WaitAsyncReads.
+  std::mutex async_reads_mtx_;
+  std::unordered_set<ZbdReadRequest*> async_reads_;
 
   uint64_t reader_offset_{0};
   uint64_t reader_offset_index_{0};
   uint64_t last_read{0};
 
   // APPEND-DOC, WAL-statistics 
+  uint64_t wal_appends_in_flight_{0}; /* zone appends since the last barrier */
+  std::atomic<uint64_t> wal_appends_issued_{0};
+  std::atomic<uint64_t> wal_appends_completed_{0}; /* issued before a sync */
 #ifdef MEASURE_WAL_LAT
   uint64_t wal_read_time_count_{0};
   uint64_t wal_read_time_sum_{0};
@@ -146,8 +324,22 @@ class ZoneFile {
   bool IsWAL() {return is_wal_;}
   // APPEND-DOC, ensure WAL is persisted
   IOStatus WALSync();
+  // APPEND-DOC, completions of WAL appends. An append is complete once a sync
+  // that started after it was issued succeeded. If the log does not copy
+  // appends, their data must stay untouched until then.
+  uint64_t GetWALAppendsIssued() { return wal_appends_issued_; }
+  uint64_t GetWALAppendsCompleted() { return wal_appends_completed_; }
+  bool WALCopiesAppends() { return wal_ == nullptr || wal_->CopiesAppends(); }
   // APPEND-DOC, get current sequence number in the WAL
   uint64_t GetWALSeq() {return wal_seq_;}
+  WALZoneRange GetWALZones() {return wal_range_;}
+  uint32_t GetTenant() {return tenant_;}
+  void SetTenant(uint32_t tenant) {tenant_ = tenant;}
+#ifdef WAL_BARRIERS
+  // APPEND-DOC, get the barrier size of the WAL in bytes
+  uint64_t GetWALBarrierSize() {return wal_barrier_sz_;}
+  bool IsWALBarrierAdaptive() {return wal_barrier_adaptive_;}
+#endif
   // APPEND-DOC, read and sort the entire WAL
 #ifndef WAL_BARRIERS
   IOStatus RecoverEntireWAL();
@@ -155,7 +347,24 @@ class ZoneFile {
   IOStatus TryRecoverWAL(uint64_t offset);
   // APPEND-DOC, read a WAL chunck
   IOStatus RecoverWALChunk(uint64_t begin, 
-    uint64_t end, std::vector<std::pair<uint64_t, std::string*>>*  wal_entries);
+    uint64_t end, WALChunkEntries* wal_entries);
+  IOStatus ReadWALChunk(uint64_t begin, uint64_t end, char* ptr);
+  IOStatus DecodeWALChunk(uint64_t begin, size_t size,
+    WALChunkEntries* wal_entries);
+#ifdef WAL_BARRIERS
+  // APPEND-DOC, parallel recovery of the barrier chunks
+  void StartWALRecovery();
+  void StopWALRecovery();
+  void WALRecoveryWorker();
+  IOStatus TakeRecoveredWALChunk(uint64_t id, WALChunkEntries* wal_entries);
+  // APPEND-DOC, adaptive barriers, chunk bounds and barrier sizing
+  IOStatus LoadWALChunkBounds();
+  IOStatus ReadWALChunkBarrier(uint64_t begin, uint64_t* barrier);
+  IOStatus ResumeWALBarrier();
+  IOStatus WALBarrier();
+  void AdaptWALBarrier(uint64_t barrier_begin_us, uint64_t barrier_us,
+                       uint64_t in_flight);
+#endif
 
   void AcquireWRLock();
   bool TryAcquireWRLock();
@@ -169,6 +378,13 @@ class ZoneFile {
   IOStatus Append(void* buffer, int data_size);
   IOStatus BufferedAppend(char* data, uint32_t size);
   IOStatus SparseAppend(char* data, uint32_t size);
+  // APPEND-DOC, writes of regular files in zone append mode
+  IOStatus SharedZoneAppend(char* data, uint32_t size);
+  // APPEND-DOC, zone append of a WAL chunk, size includes the padding
+  IOStatus WALZoneAppend(char* data, uint32_t size, uint32_t pad_sz);
+  bool UsesZoneAppends() {
+    return zbd_->SSTZoneAppends() && !is_wal_ && !is_sparse_;
+  }
   IOStatus SetWriteLifeTimeHint(Env::WriteLifeTimeHint lifetime);
   void SetIOType(IOType io_type);
   std::string GetFilename();
@@ -180,7 +396,12 @@ class ZoneFile {
 
   uint32_t GetBlockSize() { return zbd_->GetBlockSize(); }
   ZonedBlockDevice* GetZbd() { return zbd_; }
-  std::vector<ZoneExtent*> GetExtents() { return extents_; }
+  const ZoneExtentList& GetExtents() { return extents_; }
+  // APPEND-DOC, memory held by the extent list and its index
+  uint64_t GetMetadataBytes() {
+    return extents_.size() * sizeof(ZoneExtent) +
+           extent_ends_.capacity() * sizeof(uint64_t);
+  }
   Env::WriteLifeTimeHint GetWriteLifeTimeHint() { return lifetime_; }
 
   // APPEND-DOC, original read method
@@ -192,11 +413,20 @@ class ZoneFile {
   // APPEND-DOC, rerouted to WALPositionedRead or NormalPositionedRead
   IOStatus PositionedRead(uint64_t offset, size_t n, Slice* result,
                           char* scratch, bool direct);
+  // APPEND-DOC, reads that fit in one extent are submitted to the device
+  // together, the others (and WAL reads) go through PositionedRead
+  IOStatus MultiRead(FSReadRequest* reqs, size_t num_reqs, bool direct);
+  // APPEND-DOC, nullptr if the read needs PositionedRead or is empty
+  static ZenFSAsyncRead* SubmitAsyncRead(std::shared_ptr<ZoneFile> file,
+                                         const FSReadRequest& req,
+                                         bool direct);
   ZoneExtent* GetExtent(uint64_t file_offset, uint64_t* dev_offset);
   // APPEND-DOC, get extent in a WAL
   ZoneExtent* GetWALExtent(uint64_t file_offset, uint64_t* dev_offset, uint64_t* index);
 
   void PushExtent();
+  void AddExtent(uint64_t start, uint64_t length, Zone* zone,
+                 bool merge = false);
   IOStatus AllocateNewZone();
 
   void EncodeTo(std::string* output, uint32_t extent_start);
@@ -223,7 +453,7 @@ class ZoneFile {
 
   IOStatus Recover();
 
-  void ReplaceExtentList(std::vector<ZoneExtent*> new_list);
+  void ReplaceExtentList(const std::vector<ZoneExtent>& new_list);
   void AddLinkName(const std::string& linkfile);
   IOStatus RemoveLinkName(const std::string& linkfile);
   IOStatus RenameLink(const std::string& src, const std::string& dest);
@@ -234,9 +464,14 @@ class ZoneFile {
 
   // Append-doc, used to reset zones belonging to a WAL
   IOStatus ResetWALZones();
+  IOStatus ClaimZones();
 
  private:
   void ReleaseActiveZone();
+  void RebuildExtentIndex();
+  size_t FindExtent(uint64_t file_offset, size_t first);
+  bool MapDeviceRead(uint64_t offset, size_t n, char* scratch, bool direct,
+                     ZbdReadRequest* dev_req, size_t* len);
   void SetActiveZone(Zone* zone);
   IOStatus CloseActiveZone();
 
@@ -251,27 +486,55 @@ class ZoneFile {
   class ReadLock {
    public:
     ReadLock(ZoneFile* zfile) : zfile_(zfile) {
-      zfile_->writer_mtx_.lock();
-      zfile_->readers_++;
-      zfile_->writer_mtx_.unlock();
+      shard_ = &zfile_->reader_shards_[ReadLockShard()];
+      zfile_->LockRead(shard_);
     }
-    ~ReadLock() { zfile_->readers_--; }
+    ~ReadLock() { zfile_->UnlockRead(shard_); }
 
    private:
     ZoneFile* zfile_;
+    ReaderShard* shard_;
   };
   class WriteLock {
    public:
-    WriteLock(ZoneFile* zfile) : zfile_(zfile) {
-      zfile_->writer_mtx_.lock();
-      while (zfile_->readers_ > 0) {
-      }
-    }
-    ~WriteLock() { zfile_->writer_mtx_.unlock(); }
+    WriteLock(ZoneFile* zfile) : zfile_(zfile) { zfile_->LockWrite(); }
+    ~WriteLock() { zfile_->UnlockWrite(); }
 
    private:
     ZoneFile* zfile_;
   };
+
+ private:
+  static size_t ReadLockShard();
+  void LockRead(ReaderShard* shard);
+  void UnlockRead(ReaderShard* shard);
+  void LockWrite();
+  void UnlockWrite();
+  bool HasReaders();
+  void WaitAsyncReads();
+
+  friend struct ZenFSAsyncRead;
+};
+
+// APPEND-DOC, handle of a read submitted by ZonedRandomAccessFile::ReadAsync.
+// The file stays pinned and its device read is tracked by the file until it
+// completed, so GC waits for it before it moves the extent and resets its
+// zone. No rw lock is held across the async boundary, the reader may read the
+// file synchronously before it polls. The device registers the handle,
+// ZenFS::Poll tells it from those of the aux file system by address.
+struct ZenFSAsyncRead {
+  ZonedBlockDevice* zbd_ = nullptr;
+  std::shared_ptr<ZoneFile> file_;
+  ZbdReadRequest dev_req_;
+  FSReadRequest req_;
+  std::function<void(const FSReadRequest&, void*)> cb_;
+  void* cb_arg_ = nullptr;
+  bool completed_ = false;
+
+  ~ZenFSAsyncRead();
+
+  /* Waits for the read and fills in the request, the callback is optional */
+  void Complete(bool callback);
 };
 
 class ZonedWritableFile : public FSWritableFile {
@@ -319,11 +582,27 @@ class ZonedWritableFile : public FSWritableFile {
     return zoneFile_->GetWriteLifeTimeHint();
   }
 
+  // APPEND-DOC, zero-copy appends for buffered files. ReserveAppend returns a
+  // pointer into the write buffer (for WALs right behind the room kept for the
+  // sparse header) with space for up to n bytes, the caller serializes its
+  // records there and publishes them with CommitAppend. The buffer lock is
+  // held from a successful ReserveAppend until the matching CommitAppend.
+  IOStatus ReserveAppend(size_t n, char** dst, size_t* avail);
+  void CommitAppend(size_t n);
+
  private:
   IOStatus BufferedWrite(const Slice& data);
+  IOStatus ReserveBuffer(uint32_t* buffer_left);
   IOStatus FlushBuffer();
   IOStatus DataSync();
   IOStatus CloseInternal();
+  // APPEND-DOC, pipelined WAL appends
+  IOStatus HandOffWALBuffer();
+  IOStatus DrainWALPipeline();
+  bool WALBufferFree(size_t idx);
+  void WALSubmitter();
+  // APPEND-DOC, group commit of concurrent WAL syncs
+  IOStatus WALGroupSync();
 
   bool buffered;
   char* sparse_buffer;
@@ -339,6 +618,64 @@ class ZonedWritableFile : public FSWritableFile {
   MetadataWriter* metadata_writer_;
 
   std::mutex buffer_mtx_;
+
+  // APPEND-DOC, ring of sparse buffers for WALs. Filled buffers are handed to
+  // the submitter thread and recycled once their zone appends completed, or
+  // right after they are issued if the log copies appends. A buffer that is
+  // needed again before a barrier completed it is reaped with a WAL sync.
+  std::vector<char*> wal_buffers_;
+  std::vector<uint32_t> wal_buffer_fill_;
+  std::vector<uint64_t> wal_buffer_issued_; /* WAL appends issued up to it */
+  size_t wal_fill_idx_{0};
+  size_t wal_submit_idx_{0};
+  size_t wal_inflight_{0}; /* handed off and not yet issued */
+  bool wal_reap_{false};
+  bool wal_submitter_stop_{false};
+  IOStatus wal_submit_status_;
+  std::mutex wal_pipeline_mtx_;
+  std::condition_variable wal_pipeline_cv_;
+  std::unique_ptr<std::thread> wal_submitter_;
+
+  // APPEND-DOC, WAL group commit. One leader flushes and issues a barrier that
+  // covers all data appended so far, followers wait for it.
+  std::mutex wal_sync_mtx_;
+  std::condition_variable wal_sync_cv_;
+  bool wal_sync_leader_{false};
+  uint64_t wal_synced_wp_{0};
+};
+
+// APPEND-DOC, readahead for file readers. Fill reads a range of the file
+// (across extents) into an aligned buffer, reads that fall inside it are then
+// served from memory. Sparse files (WALs) are never read ahead, they are
+// recovered chunk by chunk.
+class ZonedReadahead {
+ public:
+  ZonedReadahead(ZoneFile* zoneFile, bool direct)
+      : zoneFile_(zoneFile),
+        direct_(direct),
+        enabled_(ZENFS_READAHEAD_SIZE > 0 && !zoneFile->IsSparse()) {}
+  ~ZonedReadahead() { free(buf_); }
+
+  /* Reads [offset, offset + n) ahead, at most ZENFS_READAHEAD_SIZE */
+  IOStatus Fill(uint64_t offset, size_t n);
+  /* Serves the read from the buffer if it is covered, never blocks on a
+   * concurrent fill */
+  bool TryRead(uint64_t offset, size_t n, Slice* result, char* scratch);
+  /* A sequential reader at offset, reads ahead on a miss */
+  IOStatus Read(uint64_t offset, size_t n, Slice* result, char* scratch);
+  bool Enabled() { return enabled_; }
+
+ private:
+  bool Covers(uint64_t offset, size_t n);
+  void Copy(uint64_t offset, size_t n, Slice* result, char* scratch);
+
+  ZoneFile* zoneFile_;
+  bool direct_;
+  bool enabled_;
+  char* buf_ = nullptr;
+  uint64_t start_ = 0;
+  size_t len_ = 0;
+  std::mutex mtx_;
 };
 
 class ZonedSequentialFile : public FSSequentialFile {
@@ -346,13 +683,15 @@ class ZonedSequentialFile : public FSSequentialFile {
   std::shared_ptr<ZoneFile> zoneFile_;
   uint64_t rp;
   bool direct_;
+  ZonedReadahead readahead_;
 
  public:
   explicit ZonedSequentialFile(std::shared_ptr<ZoneFile> zoneFile,
                                const FileOptions& file_opts)
       : zoneFile_(zoneFile),
         rp(0),
-        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()) {}
+        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()),
+        readahead_(zoneFile.get(), direct_) {}
 
   IOStatus Read(size_t n, const IOOptions& options, Slice* result,
                 char* scratch, IODebugContext* dbg) override;
@@ -376,21 +715,32 @@ class ZonedRandomAccessFile : public FSRandomAccessFile {
  private:
   std::shared_ptr<ZoneFile> zoneFile_;
   bool direct_;
+  // APPEND-DOC, filled by Prefetch, Read is const
+  std::unique_ptr<ZonedReadahead> readahead_;
 
  public:
   explicit ZonedRandomAccessFile(std::shared_ptr<ZoneFile> zoneFile,
                                  const FileOptions& file_opts)
       : zoneFile_(zoneFile),
-        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()) {}
+        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()),
+        readahead_(new ZonedReadahead(zoneFile.get(), direct_)) {}
 
   IOStatus Read(uint64_t offset, size_t n, const IOOptions& options,
                 Slice* result, char* scratch,
                 IODebugContext* dbg) const override;
 
-  IOStatus Prefetch(uint64_t /*offset*/, size_t /*n*/,
-                    const IOOptions& /*options*/,
+  IOStatus MultiRead(FSReadRequest* reqs, size_t num_reqs,
+                     const IOOptions& options, IODebugContext* dbg) override;
+
+  IOStatus ReadAsync(FSReadRequest& req, const IOOptions& opts,
+                     std::function<void(const FSReadRequest&, void*)> cb,
+                     void* cb_arg, void** io_handle, IOHandleDeleter* del_fn,
+                     IODebugContext* dbg) override;
+
+  IOStatus Prefetch(uint64_t offset, size_t n, const IOOptions& /*options*/,
                     IODebugContext* /*dbg*/) override {
-    return IOStatus::OK();
+    if (!readahead_->Enabled()) return IOStatus::NotSupported("Prefetch");
+    return readahead_->Fill(offset, n);
   }
 
   bool use_direct_io() const override { return direct_; }
@@ -88,6 +88,41 @@ enum ZenFSMetricsHistograms : uint32_t {
 
   ZENFS_RESETABLE_ZONES_COUNT,
 
+  ZENFS_WAL_CHANNELS_LEASED_COUNT,
+  ZENFS_WAL_CHANNELS_SHARED_COUNT,
+
+  ZENFS_WAL_RECOVERY_REORDERED_COUNT,
+
+  ZENFS_FILE_METADATA_SIZE,
+
+  ZENFS_READAHEAD_HIT_QPS,
+  ZENFS_READAHEAD_MISS_QPS,
+
+  ZENFS_WAL_ZONE_APPEND_LATENCY,
+  ZENFS_WAL_APPENDS_IN_FLIGHT_COUNT,
+  ZENFS_WAL_PADDING_THROUGHPUT,
+  ZENFS_WAL_BARRIER_LATENCY,
+  ZENFS_WAL_BARRIER_QPS,
+  ZENFS_WAL_BARRIER_SIZE,
+
+  ZENFS_WAL_RECOVERY_READ_LATENCY,
+  ZENFS_WAL_RECOVERY_DECODE_LATENCY,
+  ZENFS_WAL_RECOVERY_SORT_LATENCY,
+  ZENFS_WAL_RECOVERY_COPY_LATENCY,
+
+  ZENFS_META_BATCH_RECORDS_COUNT,
+
+  ZENFS_GC_ROUND_LATENCY,
+  ZENFS_GC_MIGRATE_FILE_LATENCY,
+  ZENFS_GC_MIGRATE_THROUGHPUT,
+  ZENFS_GC_THROTTLE_LATENCY,
+  ZENFS_GC_VICTIM_ZONES_COUNT,
+
+  ZENFS_WAL_TOKEN_WAIT_LATENCY,
+  ZENFS_FLUSH_TOKEN_WAIT_LATENCY,
+  ZENFS_COMPACTION_TOKEN_WAIT_LATENCY,
+  ZENFS_ZONE_ACQUIRE_WAIT_LATENCY,
+
   ZENFS_HISTOGRAM_ENUM_MAX,
 
   ZENFS_ZONE_WRITE_THROUGHPUT,
@@ -59,6 +59,29 @@ class ZenFSPrometheusMetrics : public rocksdb::ZenFSMetrics {
            {"zenfs_meta_alloc_latency", ZENFS_REPORTER_TYPE_LATENCY}},
           {ZENFS_META_SYNC_LATENCY,
            {"zenfs_meta_sync_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_META_BATCH_RECORDS_COUNT,
+           {"zenfs_meta_batch_records", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_IO_ALLOC_LATENCY,
+           {"zenfs_io_alloc_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_GC_ROUND_LATENCY,
+           {"zenfs_gc_round_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_GC_MIGRATE_FILE_LATENCY,
+           {"zenfs_gc_migrate_file_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_GC_MIGRATE_THROUGHPUT,
+           {"zenfs_gc_migrate_throughput", ZENFS_REPORTER_TYPE_THROUGHPUT}},
+          {ZENFS_GC_THROTTLE_LATENCY,
+           {"zenfs_gc_throttle_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_GC_VICTIM_ZONES_COUNT,
+           {"zenfs_gc_victim_zones", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_WAL_TOKEN_WAIT_LATENCY,
+           {"zenfs_wal_token_wait_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_FLUSH_TOKEN_WAIT_LATENCY,
+           {"zenfs_flush_token_wait_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_COMPACTION_TOKEN_WAIT_LATENCY,
+           {"zenfs_compaction_token_wait_latency",
+            ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_ZONE_ACQUIRE_WAIT_LATENCY,
+           {"zenfs_zone_acquire_wait_latency", ZENFS_REPORTER_TYPE_LATENCY}},
           {ZENFS_WRITE_QPS, {"zenfs_write_qps", ZENFS_REPORTER_TYPE_QPS}},
           {ZENFS_READ_QPS, {"zenfs_read_qps", ZENFS_REPORTER_TYPE_QPS}},
           {ZENFS_SYNC_QPS, {"zenfs_sync_qps", ZENFS_REPORTER_TYPE_QPS}},
@@ -74,6 +97,38 @@ class ZenFSPrometheusMetrics : public rocksdb::ZenFSMetrics {
            {"zenfs_open_zones", ZENFS_REPORTER_TYPE_GENERAL}},
           {ZENFS_ACTIVE_ZONES_COUNT,
            {"zenfs_active_zones", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_WAL_CHANNELS_LEASED_COUNT,
+           {"zenfs_wal_channels_leased", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_WAL_CHANNELS_SHARED_COUNT,
+           {"zenfs_wal_channels_shared", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_WAL_RECOVERY_REORDERED_COUNT,
+           {"zenfs_wal_recovery_reordered", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_FILE_METADATA_SIZE,
+           {"zenfs_file_metadata_size", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_READAHEAD_HIT_QPS,
+           {"zenfs_readahead_hit_qps", ZENFS_REPORTER_TYPE_QPS}},
+          {ZENFS_READAHEAD_MISS_QPS,
+           {"zenfs_readahead_miss_qps", ZENFS_REPORTER_TYPE_QPS}},
+          {ZENFS_WAL_ZONE_APPEND_LATENCY,
+           {"zenfs_wal_zone_append_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_WAL_APPENDS_IN_FLIGHT_COUNT,
+           {"zenfs_wal_appends_in_flight", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_WAL_PADDING_THROUGHPUT,
+           {"zenfs_wal_padding_throughput", ZENFS_REPORTER_TYPE_THROUGHPUT}},
+          {ZENFS_WAL_BARRIER_LATENCY,
+           {"zenfs_wal_barrier_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_WAL_BARRIER_QPS,
+           {"zenfs_wal_barrier_qps", ZENFS_REPORTER_TYPE_QPS}},
+          {ZENFS_WAL_BARRIER_SIZE,
+           {"zenfs_wal_barrier_size", ZENFS_REPORTER_TYPE_GENERAL}},
+          {ZENFS_WAL_RECOVERY_READ_LATENCY,
+           {"zenfs_wal_recovery_read_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_WAL_RECOVERY_DECODE_LATENCY,
+           {"zenfs_wal_recovery_decode_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_WAL_RECOVERY_SORT_LATENCY,
+           {"zenfs_wal_recovery_sort_latency", ZENFS_REPORTER_TYPE_LATENCY}},
+          {ZENFS_WAL_RECOVERY_COPY_LATENCY,
+           {"zenfs_wal_recovery_copy_latency", ZENFS_REPORTER_TYPE_LATENCY}},
       };
 
   void run();
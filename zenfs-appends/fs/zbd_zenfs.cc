@@ -18,6 +18,8 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
@@ -30,6 +32,7 @@
 #include "rocksdb/env.h"
 #include "rocksdb/io_status.h"
 #include "snapshot.h"
+#include "emu_zenfs.h"
 #include "zbdlib_zenfs.h"
 #include "zonefs_zenfs.h"
 
@@ -50,10 +53,6 @@
 // APPEND-DOC, because of a bug in ConfZNS, we skip 1 zone
 #define ZENFS_FLAKY_ZONES (1)
 
-/* APPEND-DOC, number of reserved zones for WALs. */
-#define ZENFS_WAL_ZONES (15)
-#define ZENFS_ZONES_FOREACH_WAL (3)
-
 /* Minimum of number of zones that makes sense */
 #define ZENFS_MIN_ZONES (32)
 
@@ -136,7 +135,7 @@ IOStatus Zone::Close() {
 }
 
 // APPEND-DOC, our zone-append method
-IOStatus Zone::ZoneAppend(char *data, uint32_t size, SZD::SZDOnceLog *wal) {
+IOStatus Zone::ZoneAppend(char *data, uint32_t size, ZoneAppendLog *wal) {
   int ret;
 
   if (capacity_ < size)
@@ -156,6 +155,61 @@ IOStatus Zone::ZoneAppend(char *data, uint32_t size, SZD::SZDOnceLog *wal) {
 
 
 
+// APPEND-DOC, the space of an append is reserved under append_mtx_ (wp_ is
+// then the end of the reserved space, the device catches up as the appends in
+// flight complete), the append itself is issued without it. So the writers of
+// a shared zone have their appends in flight together and the device picks
+// the positions. Only the last piece of a write can be unaligned, it is padded
+// into the block of room at the end of the caller's buffer. A failed append
+// gives its space back if nothing was reserved after it, otherwise the zone is
+// finished, so the accounting never claims space the device did not use.
+IOStatus Zone::ZoneAppend(char *data, uint32_t size, uint32_t *appended,
+                          uint64_t *pos) {
+  uint32_t block_sz = zbd_->GetBlockSize();
+  uint64_t wr_size;
+  uint64_t reserved_end;
+  uint32_t pad_sz;
+
+  {
+    std::lock_guard<std::mutex> lock(append_mtx_);
+    if (capacity_ == 0) return IOStatus::NoSpace("Shared zone is full");
+    wr_size = std::min<uint64_t>(size, capacity_);
+    wr_size = std::min<uint64_t>(wr_size, zbd_be_->ZoneAppendMax());
+    pad_sz = wr_size % block_sz ? block_sz - wr_size % block_sz : 0;
+    capacity_ -= wr_size + pad_sz;
+    wp_ += wr_size + pad_sz;
+    reserved_end = wp_;
+  }
+
+  if (pad_sz) memset(data + wr_size, 0x0, pad_sz);
+
+  ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(), ZENFS_ZONE_WRITE_LATENCY,
+                                 Env::Default());
+  zbd_->GetMetrics()->ReportThroughput(ZENFS_ZONE_WRITE_THROUGHPUT,
+                                       wr_size + pad_sz);
+  if (zbd_be_->ZoneAppend(data, wr_size + pad_sz, start_, pos) < 0) {
+    IOStatus s = IOStatus::IOError(strerror(errno));
+    std::lock_guard<std::mutex> lock(append_mtx_);
+    if (wp_ == reserved_end) {
+      capacity_ += wr_size + pad_sz;
+      wp_ -= wr_size + pad_sz;
+    } else {
+      IOStatus finish_s = Finish();
+      if (!finish_s.ok()) return finish_s;
+    }
+    return s;
+  }
+
+  zbd_->AddBytesWritten(wr_size + pad_sz);
+  *appended = wr_size;
+  return IOStatus::OK();
+}
+
+bool Zone::HasAppendCapacity() {
+  std::lock_guard<std::mutex> lock(append_mtx_);
+  return capacity_ > 0;
+}
+
 IOStatus Zone::Append(char *data, uint32_t size) {
   ZenFSMetricsLatencyGuard guard(zbd_->GetMetrics(), ZENFS_ZONE_WRITE_LATENCY,
                                  Env::Default());
@@ -195,41 +249,133 @@ inline IOStatus Zone::CheckRelease() {
 }
 
 Zone *ZonedBlockDevice::GetIOZone(uint64_t offset) {
-  // APPEND-DOC, split in io zone and WAL zone part
   for (const auto z : io_zones) {
     if (z->start_ <= offset && offset < (z->start_ + zbd_be_->GetZoneSize()))
       return z;
   }
+  return nullptr;
+}
 
-  for (const auto z : wal_zones) {
-    if (z->start_ <= offset && offset < (z->start_ + zbd_be_->GetZoneSize()))
-      return z;
+// APPEND-DOC, WAL zones are owned through the file metadata (WALZoneRange)
+IOStatus ZonedBlockDevice::ClaimWALZones(const WALZoneRange &range,
+                                         uint32_t tenant) {
+  for (uint64_t nr = range.start; nr < range.start + range.nr; nr++) {
+    Zone *z = GetIOZone(nr * zbd_be_->GetZoneSize());
+    if (z == nullptr)
+      return IOStatus::Corruption("Invalid WAL zone " + std::to_string(nr));
+    if (!z->IsWALOwned() && tenant != ZENFS_DEFAULT_TENANT)
+      tenants_[tenant].wal_zones++;
+    z->wal_owned_ = true;
+    ClaimTenantZone(z, tenant);
   }
-  return nullptr;
+  return IOStatus::OK();
 }
 
-// APPEND-DOC, method to allocate a once log needed for WALs
-SZD::SZDOnceLog *ZonedBlockDevice::GetWAL(uint64_t offset) {
-  for (size_t i=0; i < wal_zones.size(); i += 3) {
-    const auto z = wal_zones[i];
-    if (z->start_ <= offset && offset < (z->start_ + zbd_be_->GetZoneSize())) {
-      int old_ind = write_channel_ptr_;
-      int next_ind = (old_ind+1)  % write_channel_size_; 
-      while (!write_channel_ptr_.compare_exchange_weak(old_ind, next_ind, std::memory_order_release,
-                                          std::memory_order_relaxed)) {
-        old_ind = write_channel_ptr_;
-        next_ind = (old_ind+1)  % write_channel_size_; 
-      }
-      SZD::SZDOnceLog *wal = new SZD::SZDOnceLog(szd_factory_,
-        *di, i + ZENFS_META_ZONES + ZENFS_FLAKY_ZONES, i + ZENFS_META_ZONES + ZENFS_ZONES_FOREACH_WAL + ZENFS_FLAKY_ZONES,
-       write_channel_[next_ind]);
-      wal->RecoverPointers();  
-      return wal;
-    } 
+// APPEND-DOC, zones that are active at mount hold a device wide token only
+void ZonedBlockDevice::ClaimTenantZone(Zone *zone, uint32_t tenant) {
+  if (zone->tenant_ == tenant) return;
+  if (!zone->IsEmpty() && !zone->IsFull()) {
+    std::unique_lock<std::mutex> lk(zone_resources_mtx_);
+    if (zone->tenant_ != ZENFS_DEFAULT_TENANT)
+      tenants_[zone->tenant_].active_io_zones--;
+    if (tenant != ZENFS_DEFAULT_TENANT) tenants_[tenant].active_io_zones++;
+    GrantZoneTokensLocked();
   }
-  return nullptr;
+  zone->tenant_ = tenant;
+}
+
+IOStatus ZonedBlockDevice::AddTenant(const ZenFSTenantOptions &options,
+                                     uint32_t *tenant) {
+  uint32_t id = nr_tenants_;
+  if (id >= ZENFS_MAX_TENANTS)
+    return IOStatus::NoSpace("Too many tenants");
+  if (options.max_open_zones > max_nr_open_io_zones_ ||
+      options.max_active_zones > max_nr_active_io_zones_)
+    return IOStatus::InvalidArgument("Tenant budget exceeds the device limits");
+
+  tenants_[id].options = options;
+  if (wal_channels_registered_ && options.write_channels > 0) {
+    std::lock_guard<std::mutex> lk(wal_channel_mtx_);
+    IOStatus s = RegisterChannelPool(&tenants_[id].channels,
+                                     options.write_channels,
+                                     write_channel_depth_);
+    if (!s.ok()) return s;
+  }
+  nr_tenants_ = id + 1;
+  *tenant = id;
+
+  Info(logger_,
+       "Tenant %u: max open %u max active %u max WAL zones %u channels %u\n",
+       id, options.max_open_zones, options.max_active_zones,
+       options.max_wal_zones, options.write_channels);
+  return IOStatus::OK();
+}
+
+bool ZonedBlockDevice::ReserveTenantWALZones(uint32_t tenant, uint64_t nr) {
+  if (tenant == ZENFS_DEFAULT_TENANT) return true;
+  ZenFSTenant &t = tenants_[tenant];
+  uint64_t old_nr = t.wal_zones;
+  do {
+    if (t.options.max_wal_zones > 0 && old_nr + nr > t.options.max_wal_zones)
+      return false;
+  } while (!t.wal_zones.compare_exchange_weak(old_nr, old_nr + nr));
+  return true;
+}
+
+void ZonedBlockDevice::UnreserveTenantWALZones(uint32_t tenant, uint64_t nr) {
+  if (tenant == ZENFS_DEFAULT_TENANT) return;
+  tenants_[tenant].wal_zones -= nr;
+}
+
+// APPEND-DOC, lease a WAL channel that no other WAL writes to. Tenants with
+// dedicated channels lease from their own pool. When all channels are leased,
+// fall back to sharing the channel with the fewest WALs.
+SZD::SZDChannel *ZonedBlockDevice::LeaseWALChannel(uint32_t tenant,
+                                                   WALChannelLease *lease) {
+  std::lock_guard<std::mutex> lk(wal_channel_mtx_);
+  WALChannelPool *pool = &wal_channels_;
+  if (tenant != ZENFS_DEFAULT_TENANT &&
+      tenants_[tenant].channels.channels.size() > 0)
+    pool = &tenants_[tenant].channels;
+
+  size_t nr = pool->channels.size();
+  assert(nr > 0);
+  size_t best = pool->next % nr;
+  for (size_t i = 0; i < nr; i++) {
+    size_t idx = (pool->next + i) % nr;
+    if (pool->users[idx] < pool->users[best]) best = idx;
+    if (pool->users[best] == 0) break;
+  }
+
+  pool->users[best]++;
+  pool->next = (best + 1) % nr;
+  lease->pool = pool;
+  lease->idx = best;
+  ReportWALChannels();
+  return pool->channels[best];
+}
+
+void ZonedBlockDevice::ReturnWALChannel(const WALChannelLease &lease) {
+  std::lock_guard<std::mutex> lk(wal_channel_mtx_);
+  assert(lease.pool->users[lease.idx] > 0);
+  lease.pool->users[lease.idx]--;
+  ReportWALChannels();
 }
 
+void ZonedBlockDevice::ReportWALChannels() {
+  size_t leased = 0, shared = 0;
+  auto count = [&leased, &shared](const WALChannelPool &pool) {
+    for (auto users : pool.users) {
+      if (users > 0) leased++;
+      if (users > 1) shared++;
+    }
+  };
+
+  count(wal_channels_);
+  for (uint32_t i = 1; i < nr_tenants_; i++) count(tenants_[i].channels);
+  metrics_->ReportGeneral(ZENFS_WAL_CHANNELS_LEASED_COUNT, leased);
+  metrics_->ReportGeneral(ZENFS_WAL_CHANNELS_SHARED_COUNT, shared);
+}
 
 ZonedBlockDevice::ZonedBlockDevice(std::string path, ZbdBackendType backend,
                                    std::shared_ptr<Logger> logger,
@@ -241,6 +387,10 @@ ZonedBlockDevice::ZonedBlockDevice(std::string path, ZbdBackendType backend,
   } else if (backend == ZbdBackendType::kZoneFS) {
     zbd_be_ = std::unique_ptr<ZoneFsBackend>(new ZoneFsBackend(path));
     Info(logger_, "New zonefs backing: %s", zbd_be_->GetFilename().c_str());
+  } else if (backend == ZbdBackendType::kEmulated) {
+    zbd_be_ = std::unique_ptr<EmuBackend>(new EmuBackend(path));
+    Info(logger_, "New emulated zoned device: %s",
+         zbd_be_->GetFilename().c_str());
   }
 }
 
@@ -248,20 +398,90 @@ ZonedBlockDevice::ZonedBlockDevice(std::string path, ZbdBackendType backend,
 IOStatus ZonedBlockDevice::OpenCharacterDevice(std::string ch_path) {
   szd_device_ = new SZD::SZDDevice("ZenFS-WAL");
   szd_device_->Init();
-  szd_device_->Open(ch_path, ZENFS_META_ZONES + ZENFS_FLAKY_ZONES, ZENFS_META_ZONES + ZENFS_WAL_ZONES + ZENFS_FLAKY_ZONES);
+  // APPEND-DOC, any IO zone can become a WAL zone
+  szd_device_->Open(ch_path, ZENFS_META_ZONES + ZENFS_FLAKY_ZONES, zbd_be_->GetNrZones());
   szd_factory_ = new SZD::SZDChannelFactory(szd_device_->GetEngineManager(), 64);
   szd_factory_->Ref();
   di = new SZD::DeviceInfo();
   szd_device_->GetInfo(di);
 
-  write_channel_ = new SZD::SZDChannel* [write_channel_size_];
-  for (size_t i = 0; i < write_channel_size_; i++) {
-    szd_factory_->register_channel(&write_channel_[i], ZENFS_META_ZONES + ZENFS_FLAKY_ZONES, ZENFS_META_ZONES + ZENFS_WAL_ZONES + ZENFS_FLAKY_ZONES,
-                                  true, 
-                                  // WAL DEPTH
-                                  NAMELESS_WAL_DEPTH
-                                  );
+  // APPEND-DOC, channels are registered once the WAL depth is known (mount)
+  return IOStatus::OK();
+}
+
+// APPEND-DOC, (re)register the WAL channels with the requested queue depth
+IOStatus ZonedBlockDevice::RegisterWALChannels(uint32_t nr, uint32_t depth) {
+  if (zbd_be_->OwnsAppendLogs()) return IOStatus::OK();
+  if (szd_factory_ == nullptr)
+    return IOStatus::IOError("Character device is not opened");
+
+  std::lock_guard<std::mutex> lk(wal_channel_mtx_);
+  if (wal_channels_registered_ && write_channel_depth_ == depth &&
+      wal_channels_.channels.size() == nr)
+    return IOStatus::OK();
+  if (!wal_channel_leases_.empty())
+    return IOStatus::Busy("WAL channels are leased by open WALs");
+
+  IOStatus s = RegisterChannelPool(&wal_channels_, nr, depth);
+  if (!s.ok()) return s;
+
+  for (uint32_t i = 1; i < nr_tenants_; i++) {
+    if (tenants_[i].options.write_channels == 0) continue;
+    s = RegisterChannelPool(&tenants_[i].channels,
+                            tenants_[i].options.write_channels, depth);
+    if (!s.ok()) return s;
   }
+  write_channel_depth_ = depth;
+  wal_channels_registered_ = true;
+  return IOStatus::OK();
+}
+
+IOStatus ZonedBlockDevice::RegisterChannelPool(WALChannelPool *pool,
+                                               uint32_t nr, uint32_t depth) {
+  for (auto ch : pool->channels) {
+    szd_factory_->unregister_channel(ch);
+  }
+  pool->channels.assign(nr, nullptr);
+  pool->users.assign(nr, 0);
+  pool->next = 0;
+
+  for (size_t i = 0; i < nr; i++) {
+    if (szd_factory_->register_channel(&pool->channels[i],
+                                       ZENFS_META_ZONES + ZENFS_FLAKY_ZONES,
+                                       zbd_be_->GetNrZones(),
+                                       NAMELESS_WAL_PRESERVE_BUFFERS,
+                                       // WAL DEPTH
+                                       depth) != SZD::SZDStatus::Success) {
+      pool->channels.resize(i);
+      pool->users.resize(i);
+      return IOStatus::IOError("Failed to register WAL channel");
+    }
+  }
+  return IOStatus::OK();
+}
+
+IOStatus ZonedBlockDevice::SetWALOptions(const ZWALOptions &options) {
+  if (options.buffer_size_kb == 0 || options.barrier_size_kb == 0 ||
+      options.depth == 0 || options.channels == 0)
+    return IOStatus::InvalidArgument("Unresolved ZWAL options");
+
+  IOStatus s = RegisterWALChannels(options.channels, options.depth);
+  if (!s.ok()) return s;
+
+  wal_options_ = options;
+  Info(logger_,
+       "ZWAL options: buffer %u KiB barrier %u KiB (adaptive %u-%u KiB) "
+       "depth %u channels %u SST zone appends %d reserve %u IO zones %u WAL "
+       "ranges GC %u threads %u MiB/s\n",
+       options.buffer_size_kb, options.barrier_size_kb, options.barrier_min_kb,
+       options.barrier_max_kb, options.depth, options.channels,
+       options.sst_zone_appends, options.reserve_io_zones,
+       options.reserve_wal_ranges, options.gc_threads, options.gc_bandwidth_mb);
+  if (options.sst_zone_appends && !SSTZoneAppends())
+    Warn(logger_,
+         "SST zone appends are not supported by %s, SSTs are written at the "
+         "write pointer\n",
+         zbd_be_->GetFilename().c_str());
   return IOStatus::OK();
 }
 
@@ -323,17 +543,7 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
   while (i < ZENFS_META_ZONES + ZENFS_FLAKY_ZONES)
     i++;
 
-  // APPEND-DOC, Add WAL ZONES
-  while (i < ZENFS_META_ZONES + ZENFS_FLAKY_ZONES + ZENFS_WAL_ZONES) {
-    /* Only use sequential write required zones */
-    if (zbd_be_->ZoneIsSwr(zone_rep, i)) {
-      if (!zbd_be_->ZoneIsOffline(zone_rep, i)) {
-        Zone* z = new Zone(this, zbd_be_.get(), zone_rep, i);
-        wal_zones.push_back(z);
-      }
-    }
-    i++;
-  }
+  // APPEND-DOC, WAL zones are allocated from the IO zones at runtime
 
   active_io_zones_ = 0;
   open_io_zones_ = 0;
@@ -361,10 +571,17 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
         if (!status.ok()) {
           return status;
         }
+        if (newZone->IsEmpty())
+          IndexEmptyZone(newZone);
+        else if (!newZone->IsFull())
+          IndexOpenZone(newZone);
       }
     }
   }
 
+  start_time_ = time(NULL);
+  if (zbd_be_->OwnsAppendLogs()) return IOStatus::OK();
+
   // APPEND-DOC, open SZD, the API we need
   std::string char_filename = zbd_be_->GetFilename()
     .replace(zbd_be_->GetFilename().find("nvme"), std::string("nvme").size(), "ng");
@@ -372,8 +589,6 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
   IOStatus status = OpenCharacterDevice(char_filename);
   printf("Nameless WALs: Opened character device\n");
 
-  start_time_ = time(NULL);
-
   return status;
 }
 
@@ -487,6 +702,8 @@ void ZonedBlockDevice::LogGarbageInfo() {
 }
 
 ZonedBlockDevice::~ZonedBlockDevice() {
+  StopResetWorker();
+
   for (const auto z : meta_zones) {
     delete z;
   }
@@ -495,11 +712,6 @@ ZonedBlockDevice::~ZonedBlockDevice() {
     delete z;
   }
 
-  // APPEND-DOC, delete WAL zones
-  for (const auto z : wal_zones) {
-    delete z;
-  }
-
   // APPEND-DOC, delete SZD
   if (szd_factory_ != nullptr) {
     szd_factory_->Unref();
@@ -560,25 +772,32 @@ IOStatus ZonedBlockDevice::AllocateMetaZone(Zone **out_meta_zone) {
 }
 
 // APPEND-DOC, used to reset WAL zones that are not used
-IOStatus ZonedBlockDevice::ReleaseUnusedWALZones() {
+// APPEND-DOC, the once log already reset the zones, return them to the pool
+IOStatus ZonedBlockDevice::ReleaseWALZones(const WALZoneRange &range) {
   IOStatus s = IOStatus::OK();
-  for (size_t i = 0; i < ZENFS_WAL_ZONES; i++) {
-      const auto z = wal_zones[i];
-      if (z->Acquire()) {
-        if (!z->IsEmpty() && !z->IsUsed()) {
-          bool full = z->IsFull();
-
-          z->capacity_ = z->max_capacity_;
-          z->wp_ = z->start_;
-          // THIS IS DONE IN THE ONCE LOG (DO NOT UNCOMMENT)
-          //z->Reset();
-
-          s = z->CheckRelease();
-          if (!full) PutActiveIOZoneToken();
-        } else {
-          s = z->CheckRelease();
-        }
-      }
+  for (uint64_t nr = range.start; nr < range.start + range.nr; nr++) {
+    Zone *z = GetIOZone(nr * zbd_be_->GetZoneSize());
+    if (z == nullptr) continue;
+    WaitAcquireZone(z);
+    assert(!z->IsUsed());
+    uint32_t tenant = z->tenant_;
+    if (!z->IsEmpty()) {
+      bool full = z->IsFull();
+
+      z->capacity_ = z->max_capacity_;
+      z->wp_ = z->start_;
+      // THIS IS DONE IN THE ONCE LOG (DO NOT UNCOMMENT)
+      //z->Reset();
+
+      if (!full) PutActiveIOZoneToken(tenant);
+    }
+    if (z->IsWALOwned()) UnreserveTenantWALZones(tenant, 1);
+    z->lifetime_ = Env::WLTH_NOT_SET;
+    z->wal_owned_ = false;
+    z->tenant_ = ZENFS_DEFAULT_TENANT;
+    s = z->CheckRelease();
+    if (!s.ok()) return s;
+    IndexEmptyZone(z);
   }
   return s;
 }
@@ -586,9 +805,11 @@ IOStatus ZonedBlockDevice::ReleaseUnusedWALZones() {
 IOStatus ZonedBlockDevice::ResetUnusedIOZones() {
   for (const auto z : io_zones) {
     if (z->Acquire()) {
-      if (!z->IsEmpty() && !z->IsUsed()) {
+      if (!z->IsEmpty() && !z->IsUsed() && !z->IsWALOwned()) {
         bool full = z->IsFull();
+        uint32_t tenant = z->tenant_;
         IOStatus reset_status = z->Reset();
+        z->tenant_ = ZENFS_DEFAULT_TENANT;
         IOStatus release_status = z->CheckRelease();
         if (!reset_status.ok()) {
           return reset_status;
@@ -596,7 +817,8 @@ IOStatus ZonedBlockDevice::ResetUnusedIOZones() {
         if (!release_status.ok()) {
           return release_status;
         }
-        if (!full) PutActiveIOZoneToken();
+        if (!full) PutActiveIOZoneToken(tenant);
+        IndexEmptyZone(z);
       } else {
         IOStatus release_status = z->CheckRelease();
         if (!release_status.ok()) {
@@ -608,7 +830,304 @@ IOStatus ZonedBlockDevice::ResetUnusedIOZones() {
   return IOStatus::OK();
 }
 
-void ZonedBlockDevice::WaitForOpenIOZoneToken(bool prioritized) {
+IOStatus ZonedBlockDevice::ResetUnusedIOZonesAsync() {
+  {
+    std::lock_guard<std::mutex> lock(reset_mtx_);
+    if (reset_worker_ && !reset_stop_) {
+      reset_kicked_ = true;
+      reset_cv_.notify_one();
+      return IOStatus::OK();
+    }
+  }
+  return ResetUnusedIOZones();
+}
+
+void ZonedBlockDevice::KickResetWorker() {
+  std::lock_guard<std::mutex> lock(reset_mtx_);
+  if (!reset_worker_) return;
+  reset_kicked_ = true;
+  reset_cv_.notify_one();
+}
+
+IOStatus ZonedBlockDevice::ResetWALZones(ZoneAppendLog **wal,
+                                         const WALZoneRange &range,
+                                         uint32_t tenant) {
+  PendingWALReset reset{*wal, range, tenant};
+
+  *wal = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(reset_mtx_);
+    if (reset_worker_ && !reset_stop_) {
+      wal_resets_.push_back(reset);
+      reset_cv_.notify_one();
+      return IOStatus::OK();
+    }
+  }
+  return ResetWALZonesNow(&reset);
+}
+
+// APPEND-DOC, the zones stay owned by the WAL until they are reset
+IOStatus ZonedBlockDevice::ResetWALZonesNow(PendingWALReset *reset) {
+  IOStatus s;
+
+  if (reset->wal == nullptr) {
+    s = OpenWALZone(&reset->wal, reset->range, reset->tenant);
+    if (!s.ok()) {
+      CloseWALZone(&reset->wal);
+      return s;
+    }
+  }
+
+  s = reset->wal->ResetAll() == SZD::SZDStatus::Success
+          ? IOStatus::OK()
+          : IOStatus::IOError("WAL reset error");
+  CloseWALZone(&reset->wal);
+  if (!s.ok()) return s;
+
+  return ReleaseWALZones(reset->range);
+}
+
+void ZonedBlockDevice::StartResetWorker() {
+  std::lock_guard<std::mutex> lock(reset_mtx_);
+  if (reset_worker_) return;
+
+  reset_stop_ = false;
+  reset_kicked_ = true;
+  reset_worker_.reset(new std::thread(&ZonedBlockDevice::ResetWorker, this));
+}
+
+void ZonedBlockDevice::StopResetWorker() {
+  {
+    std::lock_guard<std::mutex> lock(reset_mtx_);
+    if (!reset_worker_) return;
+    reset_stop_ = true;
+  }
+  reset_cv_.notify_all();
+  reset_worker_->join();
+  {
+    std::lock_guard<std::mutex> lock(reset_mtx_);
+    reset_worker_.reset();
+  }
+
+  /* Return the reserved WAL ranges to the IO zones */
+  std::lock_guard<std::mutex> lock(zone_reserve_mtx_);
+  for (const auto &range : wal_range_reserve_) {
+    for (uint64_t nr = range.start; nr < range.start + range.nr; nr++) {
+      Zone *z = GetIOZone(nr * zbd_be_->GetZoneSize());
+      WaitAcquireZone(z);
+      z->wal_owned_ = false;
+      IOStatus s = z->CheckRelease();
+      if (!s.ok()) SetZoneDeferredStatus(s);
+      IndexEmptyZone(z);
+    }
+  }
+  wal_range_reserve_.clear();
+}
+
+// APPEND-DOC, resets the zones of deleted WALs and, when kicked by a delete,
+// the unused IO zones. Then it tops up the reserves. The WAL resets queued
+// before a stop are still done.
+void ZonedBlockDevice::ResetWorker() {
+  std::unique_lock<std::mutex> lock(reset_mtx_);
+
+  while (true) {
+    reset_cv_.wait_for(
+        lock, std::chrono::milliseconds(ZENFS_RESET_INTERVAL_MS),
+        [&] { return reset_stop_ || reset_kicked_ || !wal_resets_.empty(); });
+    std::vector<PendingWALReset> wal_resets;
+    wal_resets.swap(wal_resets_);
+    bool stop = reset_stop_;
+    bool kicked = reset_kicked_;
+    reset_kicked_ = false;
+    lock.unlock();
+
+    IOStatus s;
+    for (auto &reset : wal_resets) {
+      IOStatus reset_status = ResetWALZonesNow(&reset);
+      if (!reset_status.ok()) s = reset_status;
+    }
+    if (s.ok() && kicked) s = ResetUnusedIOZones();
+    if (s.ok() && !stop) s = FillZoneReserves();
+    if (!s.ok()) {
+      Error(logger_, "Background zone reset failed: %s", s.ToString().c_str());
+      SetZoneDeferredStatus(s);
+    }
+
+    lock.lock();
+    if (stop && wal_resets_.empty()) break;
+  }
+}
+
+// APPEND-DOC, WAL ranges are claimed (owned by no WAL yet). If there are too
+// few empty IO zones, the unused zones are reset.
+IOStatus ZonedBlockDevice::FillZoneReserves() {
+  IOStatus s;
+  {
+    std::lock_guard<std::mutex> lock(zone_reserve_mtx_);
+    while (wal_range_reserve_.size() < wal_options_.reserve_wal_ranges) {
+      Zone *first = nullptr;
+      WALZoneRange range;
+
+      s = ClaimFreeWALZoneRange(&first, &range, ZENFS_DEFAULT_TENANT);
+      if (!s.ok() || first == nullptr) break;
+      wal_range_reserve_.push_back(range);
+      s = first->CheckRelease();
+      if (!s.ok()) return s;
+    }
+    if (!s.ok()) return s;
+  }
+
+  size_t nr_empty;
+  {
+    std::lock_guard<std::mutex> lock(zone_index_mtx_);
+    nr_empty = empty_zones_.size();
+  }
+  if (nr_empty < wal_options_.reserve_io_zones) s = ResetUnusedIOZones();
+  return s;
+}
+
+void ZonedBlockDevice::IndexOpenZone(Zone *zone) {
+  std::lock_guard<std::mutex> lock(zone_index_mtx_);
+  int bucket = zone->lifetime_;
+
+  if (zone->open_bucket_ == bucket) return;
+  if (zone->open_bucket_ >= 0) {
+    auto &old_zones = open_zones_[zone->open_bucket_];
+    old_zones.erase(std::find(old_zones.begin(), old_zones.end(), zone));
+  }
+  open_zones_[bucket].push_back(zone);
+  zone->open_bucket_ = bucket;
+}
+
+void ZonedBlockDevice::IndexEmptyZone(Zone *zone) {
+  std::lock_guard<std::mutex> lock(zone_index_mtx_);
+  QueueEmptyZoneLocked(zone);
+}
+
+void ZonedBlockDevice::QueueEmptyZoneLocked(Zone *zone) {
+  if (zone->queued_empty_) return;
+  empty_zones_.push_back(zone);
+  zone->queued_empty_ = true;
+}
+
+// APPEND-DOC, the open zones in order of preference for file_lifetime (see
+// GetLifeTimeDiff): longer lifetimes from the closest one, the same lifetime,
+// then the rest. Zones that are no longer open are dropped from the index.
+std::vector<Zone *> ZonedBlockDevice::OpenZoneCandidates(
+    Env::WriteLifeTimeHint file_lifetime) {
+  std::lock_guard<std::mutex> lock(zone_index_mtx_);
+  std::vector<int> order;
+  std::vector<Zone *> candidates;
+
+  if (file_lifetime == Env::WLTH_NOT_SET || file_lifetime == Env::WLTH_NONE) {
+    order.push_back(file_lifetime);
+  } else {
+    for (int b = file_lifetime + 1; b <= Env::WLTH_EXTREME; b++)
+      order.push_back(b);
+    order.push_back(file_lifetime);
+  }
+  for (int b = Env::WLTH_NOT_SET; b <= Env::WLTH_EXTREME; b++) {
+    if (std::find(order.begin(), order.end(), b) == order.end())
+      order.push_back(b);
+  }
+
+  for (int b : order) {
+    auto &zones = open_zones_[b];
+    for (auto it = zones.begin(); it != zones.end();) {
+      Zone *z = *it;
+      if (z->Acquire()) {
+        bool stale = z->IsEmpty() || z->IsFull() || z->IsWALOwned() ||
+                     z->lifetime_ != b;
+        if (stale) {
+          if (z->IsEmpty() && !z->IsWALOwned()) QueueEmptyZoneLocked(z);
+          z->open_bucket_ = -1;
+          it = zones.erase(it);
+        } else {
+          it++;
+        }
+        IOStatus s = z->CheckRelease();
+        if (!s.ok()) SetZoneDeferredStatus(s);
+        if (stale) continue;
+      } else {
+        it++;
+      }
+      candidates.push_back(z);
+    }
+  }
+  return candidates;
+}
+
+IOStatus ZonedBlockDevice::PopEmptyZone(Zone **out_zone) {
+  std::lock_guard<std::mutex> lock(zone_index_mtx_);
+  IOStatus s;
+
+  *out_zone = nullptr;
+  /* Busy zones go to the back, they may be empty once released */
+  for (size_t n = empty_zones_.size(); n > 0; n--) {
+    Zone *z = empty_zones_.front();
+    empty_zones_.pop_front();
+    if (!z->Acquire()) {
+      empty_zones_.push_back(z);
+      continue;
+    }
+    if (z->IsEmpty() && !z->IsWALOwned()) {
+      z->queued_empty_ = false;
+      *out_zone = z;
+      break;
+    }
+    z->queued_empty_ = false;
+    s = z->CheckRelease();
+    if (!s.ok()) return s;
+  }
+  return s;
+}
+
+// APPEND-DOC, the tenant budget is already charged by the caller
+IOStatus ZonedBlockDevice::PopWALRangeReserve(Zone **out_zone,
+                                              WALZoneRange *range,
+                                              uint32_t tenant) {
+  std::lock_guard<std::mutex> lock(zone_reserve_mtx_);
+  IOStatus s;
+
+  *out_zone = nullptr;
+  if (wal_range_reserve_.empty()) return s;
+
+  *range = wal_range_reserve_.front();
+  wal_range_reserve_.pop_front();
+  for (uint64_t nr = range->start; nr < range->start + range->nr; nr++) {
+    Zone *z = GetIOZone(nr * zbd_be_->GetZoneSize());
+    WaitAcquireZone(z);
+    z->tenant_ = tenant;
+    if (nr == range->start) {
+      *out_zone = z;
+    } else {
+      s = z->CheckRelease();
+      if (!s.ok()) return s;
+    }
+  }
+  KickResetWorker();
+  return s;
+}
+
+// APPEND-DOC, the default tenant is only bound by the device limits
+bool ZonedBlockDevice::TenantOpenAvailable(uint32_t tenant, bool prioritized) {
+  if (tenant == ZENFS_DEFAULT_TENANT) return true;
+  const ZenFSTenant &t = tenants_[tenant];
+  long limit = t.options.max_open_zones;
+  if (limit == 0) return true;
+  /* Same WAL priority as for the device limit */
+  if (!prioritized && limit > 1) limit--;
+  return t.open_io_zones < limit;
+}
+
+bool ZonedBlockDevice::TenantActiveAvailable(uint32_t tenant) {
+  if (tenant == ZENFS_DEFAULT_TENANT) return true;
+  const ZenFSTenant &t = tenants_[tenant];
+  if (t.options.max_active_zones == 0) return true;
+  return t.active_io_zones < (long)t.options.max_active_zones;
+}
+
+bool ZonedBlockDevice::TakeOpenTokenLocked(bool prioritized, uint32_t tenant) {
   long allocator_open_limit;
 
   /* Avoid non-priortized allocators from starving prioritized ones */
@@ -618,48 +1137,183 @@ void ZonedBlockDevice::WaitForOpenIOZoneToken(bool prioritized) {
     allocator_open_limit = max_nr_open_io_zones_ - 1;
   }
 
+  if (open_io_zones_.load() < allocator_open_limit &&
+      TenantOpenAvailable(tenant, prioritized)) {
+    open_io_zones_++;
+    if (tenant != ZENFS_DEFAULT_TENANT) tenants_[tenant].open_io_zones++;
+    return true;
+  }
+  return false;
+}
+
+bool ZonedBlockDevice::TakeActiveTokenLocked(uint32_t tenant) {
+  if (active_io_zones_.load() < max_nr_active_io_zones_ &&
+      TenantActiveAvailable(tenant)) {
+    active_io_zones_++;
+    if (tenant != ZENFS_DEFAULT_TENANT) tenants_[tenant].active_io_zones++;
+    return true;
+  }
+  return false;
+}
+
+void ZonedBlockDevice::EnqueueTokenWaiterLocked(ZoneTokenWaiter *waiter) {
+  auto it = token_waiters_.begin();
+  while (it != token_waiters_.end() && (*it)->cls <= waiter->cls) it++;
+  token_waiters_.insert(it, waiter);
+  if (waiter->active) active_token_waiters_++;
+}
+
+// APPEND-DOC, serves the waiters in order. A waiter that does not fit does
+// not hold back the ones behind it: with tenants it may be blocked on its own
+// budget, and the device limit blocks the ones behind it as well (WALs only
+// can take the last open token).
+void ZonedBlockDevice::GrantZoneTokensLocked() {
+  for (auto it = token_waiters_.begin(); it != token_waiters_.end();) {
+    ZoneTokenWaiter *waiter = *it;
+    bool granted =
+        waiter->active
+            ? TakeActiveTokenLocked(waiter->tenant)
+            : TakeOpenTokenLocked(waiter->cls == ZoneTokenClass::kWAL,
+                                  waiter->tenant);
+    if (!granted) {
+      it++;
+      continue;
+    }
+    if (waiter->active) active_token_waiters_--;
+    waiter->granted = true;
+    it = token_waiters_.erase(it);
+    waiter->cv.notify_one();
+  }
+}
+
+void ZonedBlockDevice::ReportTokenWait(ZoneTokenClass cls, uint64_t begin_us) {
+  uint32_t label = ZENFS_COMPACTION_TOKEN_WAIT_LATENCY;
+  if (cls == ZoneTokenClass::kWAL)
+    label = ZENFS_WAL_TOKEN_WAIT_LATENCY;
+  else if (cls == ZoneTokenClass::kFlush)
+    label = ZENFS_FLUSH_TOKEN_WAIT_LATENCY;
+  metrics_->ReportLatency(label, Env::Default()->NowMicros() - begin_us);
+}
+
+// APPEND-DOC, L0 flushes have lifetime MEDIUM (see AllocateIOZone)
+ZoneTokenClass ZonedBlockDevice::TokenClass(IOType io_type,
+                                            Env::WriteLifeTimeHint lifetime) {
+  if (io_type == IOType::kWAL) return ZoneTokenClass::kWAL;
+  if (lifetime == Env::WLTH_MEDIUM) return ZoneTokenClass::kFlush;
+  return ZoneTokenClass::kCompaction;
+}
+
+void ZonedBlockDevice::WaitForOpenIOZoneToken(ZoneTokenClass cls,
+                                              uint32_t tenant) {
+  uint64_t begin_us = Env::Default()->NowMicros();
+  ZoneTokenWaiter waiter;
+
+  waiter.cls = cls;
+  waiter.tenant = tenant;
+  waiter.active = false;
+
   /* Wait for an open IO Zone token - after this function returns
    * the caller is allowed to write to a closed zone. The callee
    * is responsible for calling a PutOpenIOZoneToken to return the resource
    */
   std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-  zone_resources_.wait(lk, [this, allocator_open_limit] {
-    if (open_io_zones_.load() < allocator_open_limit) {
-      open_io_zones_++;
-      return true;
+  EnqueueTokenWaiterLocked(&waiter);
+  GrantZoneTokensLocked();
+  waiter.cv.wait(lk, [&waiter] { return waiter.granted; });
+  lk.unlock();
+
+  ReportTokenWait(cls, begin_us);
+}
+
+// APPEND-DOC, the waiter keeps its place in the queue while it finishes a
+// zone, the token freed by the finish goes to the first waiter
+IOStatus ZonedBlockDevice::WaitForActiveIOZoneToken(ZoneTokenClass cls,
+                                                    uint32_t tenant) {
+  uint64_t begin_us = Env::Default()->NowMicros();
+  ZoneTokenWaiter waiter;
+  IOStatus s;
+
+  waiter.cls = cls;
+  waiter.tenant = tenant;
+  waiter.active = true;
+
+  std::unique_lock<std::mutex> lk(zone_resources_mtx_);
+  EnqueueTokenWaiterLocked(&waiter);
+  GrantZoneTokensLocked();
+  while (!waiter.granted) {
+    bool finished = false;
+
+    lk.unlock();
+    s = FinishCheapestIOZone(tenant, &finished);
+    lk.lock();
+    if (!s.ok()) break;
+    /* All zones that could be finished are busy */
+    if (!waiter.granted && !finished)
+      waiter.cv.wait_for(lk, std::chrono::milliseconds(ZENFS_TOKEN_RETRY_MS));
+  }
+
+  if (!s.ok()) {
+    if (waiter.granted) {
+      /* Hand the token on */
+      active_io_zones_--;
+      if (tenant != ZENFS_DEFAULT_TENANT) tenants_[tenant].active_io_zones--;
     } else {
-      return false;
+      token_waiters_.remove(&waiter);
+      active_token_waiters_--;
     }
-  });
+    GrantZoneTokensLocked();
+    return s;
+  }
+  lk.unlock();
+
+  ReportTokenWait(cls, begin_us);
+  return s;
 }
 
-bool ZonedBlockDevice::GetActiveIOZoneTokenIfAvailable() {
+// APPEND-DOC, queued allocators go first
+bool ZonedBlockDevice::GetActiveIOZoneTokenIfAvailable(uint32_t tenant) {
   /* Grap an active IO Zone token if available - after this function returns
    * the caller is allowed to write to a closed zone. The callee
    * is responsible for calling a PutActiveIOZoneToken to return the resource
    */
   std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-  if (active_io_zones_.load() < max_nr_active_io_zones_) {
-    active_io_zones_++;
-    return true;
-  }
-  return false;
+  if (active_token_waiters_ > 0) return false;
+  return TakeActiveTokenLocked(tenant);
 }
 
-void ZonedBlockDevice::PutOpenIOZoneToken() {
-  {
-    std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-    open_io_zones_--;
-  }
-  zone_resources_.notify_one();
+void ZonedBlockDevice::PutOpenIOZoneToken(uint32_t tenant) {
+  std::unique_lock<std::mutex> lk(zone_resources_mtx_);
+  open_io_zones_--;
+  if (tenant != ZENFS_DEFAULT_TENANT) tenants_[tenant].open_io_zones--;
+  GrantZoneTokensLocked();
 }
 
-void ZonedBlockDevice::PutActiveIOZoneToken() {
-  {
-    std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-    active_io_zones_--;
-  }
-  zone_resources_.notify_one();
+void ZonedBlockDevice::PutActiveIOZoneToken(uint32_t tenant) {
+  std::unique_lock<std::mutex> lk(zone_resources_mtx_);
+  active_io_zones_--;
+  if (tenant != ZENFS_DEFAULT_TENANT) tenants_[tenant].active_io_zones--;
+  GrantZoneTokensLocked();
+}
+
+void Zone::NotifyReleased() { zbd_->NotifyZoneReleased(); }
+
+void ZonedBlockDevice::NotifyZoneReleased() {
+  if (zone_release_waiters_.load() == 0) return;
+  std::lock_guard<std::mutex> lock(zone_release_mtx_);
+  zone_release_cv_.notify_all();
+}
+
+void ZonedBlockDevice::WaitAcquireZone(Zone *zone) {
+  if (zone->Acquire()) return;
+
+  ZenFSMetricsLatencyGuard guard(metrics_, ZENFS_ZONE_ACQUIRE_WAIT_LATENCY,
+                                 Env::Default());
+  std::unique_lock<std::mutex> lock(zone_release_mtx_);
+  zone_release_waiters_++;
+  while (!zone->Acquire())
+    zone_release_cv_.wait_for(lock,
+                              std::chrono::milliseconds(ZENFS_TOKEN_RETRY_MS));
+  zone_release_waiters_--;
 }
 
 IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
@@ -667,13 +1321,15 @@ IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
 
   if (finish_threshold_ == 0) return IOStatus::OK();
 
-  for (const auto z : io_zones) {
+  for (const auto z : OpenZoneCandidates(Env::WLTH_NOT_SET)) {
     if (z->Acquire()) {
       bool within_finish_threshold =
           z->capacity_ < (z->max_capacity_ * finish_threshold_ / 100);
-      if (!(z->IsEmpty() || z->IsFull()) && within_finish_threshold) {
+      if (!(z->IsEmpty() || z->IsFull()) && within_finish_threshold &&
+          !z->IsWALOwned()) {
         /* If there is less than finish_threshold_% remaining capacity in a
          * non-open-zone, finish the zone */
+        uint32_t tenant = z->tenant_;
         s = z->Finish();
         if (!s.ok()) {
           z->Release();
@@ -682,7 +1338,7 @@ IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
         }
         s = z->CheckRelease();
         if (!s.ok()) return s;
-        PutActiveIOZoneToken();
+        PutActiveIOZoneToken(tenant);
       } else {
         s = z->CheckRelease();
         if (!s.ok()) return s;
@@ -693,13 +1349,24 @@ IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
   return IOStatus::OK();
 }
 
-IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
+IOStatus ZonedBlockDevice::FinishCheapestIOZone(uint32_t tenant,
+                                                bool *finished) {
   IOStatus s;
   Zone *finish_victim = nullptr;
+  bool own_zones;
 
-  for (const auto z : io_zones) {
+  if (finished != nullptr) *finished = false;
+
+  /* A tenant out of its own budget has to finish one of its own zones */
+  {
+    std::unique_lock<std::mutex> lk(zone_resources_mtx_);
+    own_zones = !TenantActiveAvailable(tenant);
+  }
+
+  for (const auto z : OpenZoneCandidates(Env::WLTH_NOT_SET)) {
     if (z->Acquire()) {
-      if (z->IsEmpty() || z->IsFull()) {
+      if (z->IsEmpty() || z->IsFull() || z->IsWALOwned() ||
+          (own_zones && z->tenant_ != tenant)) {
         s = z->CheckRelease();
         if (!s.ok()) return s;
         continue;
@@ -721,15 +1388,17 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
 
   // If all non-busy zones are empty or full, we should return success.
   if (finish_victim == nullptr) {
-    Info(logger_, "All non-busy zones are empty or full, skip.");
+    Debug(logger_, "All non-busy zones are empty or full, skip.");
     return IOStatus::OK();
   }
 
+  uint32_t victim_tenant = finish_victim->tenant_;
   s = finish_victim->Finish();
   IOStatus release_status = finish_victim->CheckRelease();
 
   if (s.ok()) {
-    PutActiveIOZoneToken();
+    PutActiveIOZoneToken(victim_tenant);
+    if (finished != nullptr) *finished = true;
   }
 
   if (!release_status.ok()) {
@@ -739,37 +1408,26 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
   return s;
 }
 
+// APPEND-DOC, the candidates come in order of preference, the first one that
+// fits is the best match
 IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
     Env::WriteLifeTimeHint file_lifetime, unsigned int *best_diff_out,
-    Zone **zone_out, uint32_t min_capacity) {
+    Zone **zone_out, uint32_t min_capacity, uint32_t tenant) {
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   Zone *allocated_zone = nullptr;
   IOStatus s;
 
-  for (const auto z : io_zones) {
+  for (const auto z : OpenZoneCandidates(file_lifetime)) {
     if (z->Acquire()) {
-      if ((z->used_capacity_ > 0) && !z->IsFull() &&
-          z->capacity_ >= min_capacity) {
-        unsigned int diff = GetLifeTimeDiff(z->lifetime_, file_lifetime);
-        if (diff <= best_diff) {
-          if (allocated_zone != nullptr) {
-            s = allocated_zone->CheckRelease();
-            if (!s.ok()) {
-              IOStatus s_ = z->CheckRelease();
-              if (!s_.ok()) return s_;
-              return s;
-            }
-          }
-          allocated_zone = z;
-          best_diff = diff;
-        } else {
-          s = z->CheckRelease();
-          if (!s.ok()) return s;
-        }
-      } else {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
+      /* APPEND-DOC, tenants do not share zones */
+      if ((z->used_capacity_ > 0) && !z->IsFull() && !z->IsWALOwned() &&
+          z->tenant_ == tenant && z->capacity_ >= min_capacity) {
+        allocated_zone = z;
+        best_diff = GetLifeTimeDiff(z->lifetime_, file_lifetime);
+        break;
       }
+      s = z->CheckRelease();
+      if (!s.ok()) return s;
     }
   }
 
@@ -782,17 +1440,34 @@ IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
 IOStatus ZonedBlockDevice::AllocateEmptyZone(Zone **zone_out) {
   IOStatus s;
   Zone *allocated_zone = nullptr;
-  for (const auto z : io_zones) {
-    if (z->Acquire()) {
-      if (z->IsEmpty()) {
-        allocated_zone = z;
-        break;
-      } else {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
+
+  s = PopEmptyZone(&allocated_zone);
+  if (!s.ok()) return s;
+
+  /* APPEND-DOC, the queue is empty, and the resets of the worker may be
+   * behind, reset the unused zones right away before giving up */
+  if (allocated_zone == nullptr) {
+    s = ResetUnusedIOZones();
+    if (!s.ok()) return s;
+    s = PopEmptyZone(&allocated_zone);
+    if (!s.ok()) return s;
+  }
+
+  /* A last scan, for empty zones that never made it into the queue */
+  if (allocated_zone == nullptr) {
+    for (const auto z : io_zones) {
+      if (z->Acquire()) {
+        if (z->IsEmpty() && !z->IsWALOwned()) {
+          allocated_zone = z;
+          break;
+        } else {
+          s = z->CheckRelease();
+          if (!s.ok()) return s;
+        }
       }
     }
   }
+  KickResetWorker();
   *zone_out = allocated_zone;
   return IOStatus::OK();
 }
@@ -806,6 +1481,43 @@ IOStatus ZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
   return IOStatus::OK();
 }
 
+void ZonedBlockDeviceBackend::SubmitReads(ZbdReadRequest **reqs, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    ZbdReadRequest *req = reqs[i];
+    req->result = Read(req->buf, req->size, req->pos, req->direct);
+    if (req->result < 0) req->result = -errno;
+    req->done_ = true;
+  }
+}
+
+void ZonedBlockDevice::WaitReads(ZbdReadRequest **reqs, size_t n) {
+  zbd_be_->WaitReads(reqs, n);
+
+  for (size_t i = 0; i < n; i++) {
+    ZbdReadRequest *req = reqs[i];
+    if (req->result <= 0 || req->result >= req->size) continue;
+
+    int r = Read(req->buf + req->result, req->pos + req->result,
+                 req->size - req->result, req->direct);
+    req->result = r < 0 ? -errno : req->result + r;
+  }
+}
+
+void ZonedBlockDevice::RegisterAsyncRead(void *handle) {
+  std::lock_guard<std::mutex> lock(async_reads_mtx_);
+  async_reads_.insert(handle);
+}
+
+void ZonedBlockDevice::UnregisterAsyncRead(void *handle) {
+  std::lock_guard<std::mutex> lock(async_reads_mtx_);
+  async_reads_.erase(handle);
+}
+
+bool ZonedBlockDevice::IsAsyncRead(void *handle) {
+  std::lock_guard<std::mutex> lock(async_reads_mtx_);
+  return async_reads_.count(handle) > 0;
+}
+
 int ZonedBlockDevice::Read(char *buf, uint64_t offset, int n, bool direct) {
   int ret = 0;
   int left = n;
@@ -833,8 +1545,8 @@ IOStatus ZonedBlockDevice::ReleaseMigrateZone(Zone *zone) {
   IOStatus s = IOStatus::OK();
   {
     std::unique_lock<std::mutex> lock(migrate_zone_mtx_);
-    migrating_ = false;
     if (zone != nullptr) {
+      migrations_--;
       s = zone->CheckRelease();
       Info(logger_, "ReleaseMigrateZone: %lu", zone->start_);
     }
@@ -843,28 +1555,51 @@ IOStatus ZonedBlockDevice::ReleaseMigrateZone(Zone *zone) {
   return s;
 }
 
+// APPEND-DOC, up to gc_threads migrations run at the same time, each into its
+// own zone
 IOStatus ZonedBlockDevice::TakeMigrateZone(Zone **out_zone,
                                            Env::WriteLifeTimeHint file_lifetime,
-                                           uint32_t min_capacity) {
+                                           uint32_t min_capacity,
+                                           uint32_t tenant) {
   std::unique_lock<std::mutex> lock(migrate_zone_mtx_);
-  migrate_resource_.wait(lock, [this] { return !migrating_; });
-
-  migrating_ = true;
+  migrate_resource_.wait(
+      lock, [this] {
+        return migrations_ < std::max(wal_options_.gc_threads, 1u);
+      });
 
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
-  auto s =
-      GetBestOpenZoneMatch(file_lifetime, &best_diff, out_zone, min_capacity);
+  auto s = GetBestOpenZoneMatch(file_lifetime, &best_diff, out_zone,
+                                min_capacity, tenant);
   if (s.ok() && (*out_zone) != nullptr) {
+    migrations_++;
     Info(logger_, "TakeMigrateZone: %lu", (*out_zone)->start_);
-  } else {
-    migrating_ = false;
   }
 
   return s;
 }
 
+void ZonedBlockDevice::ThrottleGC(uint64_t bytes) {
+  uint64_t budget = (uint64_t)wal_options_.gc_bandwidth_mb << 20;
+  uint64_t wait_us;
+
+  if (budget == 0) return;
+  {
+    std::lock_guard<std::mutex> lock(gc_throttle_mtx_);
+    uint64_t now = Env::Default()->NowMicros();
+    if (gc_throttle_next_us_ < now) gc_throttle_next_us_ = now;
+    wait_us = gc_throttle_next_us_ - now;
+    gc_throttle_next_us_ += bytes * 1000000 / budget;
+  }
+  if (wait_us == 0) return;
+
+  ZenFSMetricsLatencyGuard guard(metrics_, ZENFS_GC_THROTTLE_LATENCY,
+                                 Env::Default());
+  Env::Default()->SleepForMicroseconds((int)wait_us);
+}
+
 IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
-                                          IOType io_type, Zone **out_zone) {
+                                          IOType io_type, Zone **out_zone,
+                                          uint32_t tenant) {
   Zone *allocated_zone = nullptr;
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   int new_zone = 0;
@@ -881,6 +1616,8 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
   }
 
   ZenFSMetricsLatencyGuard guard(metrics_, tag, Env::Default());
+  ZenFSMetricsLatencyGuard alloc_guard(metrics_, ZENFS_IO_ALLOC_LATENCY,
+                                       Env::Default());
   metrics_->ReportQPS(ZENFS_IO_ALLOC_QPS, 1);
 
   // Check if a deferred IO error was set
@@ -896,19 +1633,21 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
     }
   }
 
-  WaitForOpenIOZoneToken(io_type == IOType::kWAL);
+  ZoneTokenClass token_class = TokenClass(io_type, file_lifetime);
+  WaitForOpenIOZoneToken(token_class, tenant);
 
   /* Try to fill an already open zone(with the best life time diff) */
-  s = GetBestOpenZoneMatch(file_lifetime, &best_diff, &allocated_zone);
+  s = GetBestOpenZoneMatch(file_lifetime, &best_diff, &allocated_zone, 0,
+                           tenant);
   if (!s.ok()) {
-    PutOpenIOZoneToken();
+    PutOpenIOZoneToken(tenant);
     return s;
   }
 
   // Holding allocated_zone if != nullptr
 
   if (best_diff >= LIFETIME_DIFF_COULD_BE_WORSE) {
-    bool got_token = GetActiveIOZoneTokenIfAvailable();
+    bool got_token = GetActiveIOZoneTokenIfAvailable(tenant);
 
     /* If we did not get a token, try to use the best match, even if the life
      * time diff not good but a better choice than to finish an existing zone
@@ -922,8 +1661,8 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
       } else {
         s = allocated_zone->CheckRelease();
         if (!s.ok()) {
-          PutOpenIOZoneToken();
-          if (got_token) PutActiveIOZoneToken();
+          PutOpenIOZoneToken(tenant);
+          if (got_token) PutActiveIOZoneToken(tenant);
           return s;
         }
         allocated_zone = nullptr;
@@ -933,27 +1672,29 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
     /* If we haven't found an open zone to fill, open a new zone */
     if (allocated_zone == nullptr) {
       /* We have to make sure we can open an empty zone */
-      while (!got_token && !GetActiveIOZoneTokenIfAvailable()) {
-        s = FinishCheapestIOZone();
+      if (!got_token) {
+        s = WaitForActiveIOZoneToken(token_class, tenant);
         if (!s.ok()) {
-          PutOpenIOZoneToken();
+          PutOpenIOZoneToken(tenant);
           return s;
         }
       }
 
       s = AllocateEmptyZone(&allocated_zone);
       if (!s.ok()) {
-        PutActiveIOZoneToken();
-        PutOpenIOZoneToken();
+        PutActiveIOZoneToken(tenant);
+        PutOpenIOZoneToken(tenant);
         return s;
       }
 
       if (allocated_zone != nullptr) {
         assert(allocated_zone->IsBusy());
         allocated_zone->lifetime_ = file_lifetime;
+        allocated_zone->tenant_ = tenant;
+        IndexOpenZone(allocated_zone);
         new_zone = true;
       } else {
-        PutActiveIOZoneToken();
+        PutActiveIOZoneToken(tenant);
       }
     }
   }
@@ -965,7 +1706,7 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
           new_zone, allocated_zone->start_, allocated_zone->wp_,
           allocated_zone->lifetime_, file_lifetime);
   } else {
-    PutOpenIOZoneToken();
+    PutOpenIOZoneToken(tenant);
   }
 
   if (io_type != IOType::kWAL) {
@@ -980,153 +1721,263 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
   return IOStatus::OK();
 }
 
-// APPEND-DOC, open a zone for the WAL
-IOStatus ZonedBlockDevice::OpenWALZone(SZD::SZDOnceLog **wal, Zone* active_zone) {
-    Zone *allocated_zone = nullptr;
-    IOStatus s;
+IOStatus ZonedBlockDevice::AllocateSharedIOZone(
+    Env::WriteLifeTimeHint file_lifetime, IOType io_type, Zone **out_zone,
+    uint32_t tenant) {
+  Zone *zone = nullptr;
+  IOStatus s;
 
-    WaitForOpenIOZoneToken(true);
-    while (!GetActiveIOZoneTokenIfAvailable())
-      ;
+  {
+    std::lock_guard<std::mutex> lock(shared_zones_mtx_);
+    for (Zone *z : shared_zones_) {
+      if (z->tenant_ == tenant && z->lifetime_ == file_lifetime &&
+          z->sharers_ < ZENFS_SST_ZONE_SHARERS && z->HasAppendCapacity()) {
+        z->sharers_++;
+        *out_zone = z;
+        return IOStatus::OK();
+      }
+    }
+  }
 
-    const auto z = wal_zones[active_zone->GetZoneNr() - ZENFS_META_ZONES - ZENFS_FLAKY_ZONES];
-    while (!z->Acquire())
-      ;
-    allocated_zone = z;
+  /* The zone keeps its busy flag and open token while it is shared */
+  s = AllocateIOZone(file_lifetime, io_type, &zone, tenant);
+  if (!s.ok() || zone == nullptr) {
+    *out_zone = nullptr;
+    return s;
+  }
 
-    if (allocated_zone == nullptr) {
-      PutActiveIOZoneToken();
-      PutOpenIOZoneToken();
-      return IOStatus::NoSpace("No WAL space left (during open)");
-    } 
+  std::lock_guard<std::mutex> lock(shared_zones_mtx_);
+  zone->sharers_ = 1;
+  shared_zones_.push_back(zone);
+  *out_zone = zone;
+  return IOStatus::OK();
+}
 
-    if (*wal) {
-      delete *wal;
-    }
-   
-    int old_ind = write_channel_ptr_;
-    int next_ind = (old_ind+1)  % write_channel_size_; 
-     while (!write_channel_ptr_.compare_exchange_weak(old_ind, next_ind, std::memory_order_release,
-                                        std::memory_order_relaxed)) {
-      old_ind = write_channel_ptr_;
-      next_ind = (old_ind+1)  % write_channel_size_; 
-     }
+IOStatus ZonedBlockDevice::ReleaseSharedIOZone(Zone *zone) {
+  {
+    std::lock_guard<std::mutex> lock(shared_zones_mtx_);
+    assert(zone->sharers_ > 0);
+    if (--zone->sharers_ > 0) return IOStatus::OK();
+    shared_zones_.erase(
+        std::find(shared_zones_.begin(), shared_zones_.end(), zone));
+  }
 
-    *wal = new SZD::SZDOnceLog(szd_factory_,
-      *di, z->GetZoneNr(), z->GetZoneNr() + ZENFS_ZONES_FOREACH_WAL,
-       write_channel_[next_ind]);
+  bool full = zone->IsFull();
+  uint32_t tenant = zone->tenant_;
+  IOStatus s = zone->Close();
+  IOStatus release_status = zone->CheckRelease();
+  if (!s.ok()) return s;
+  if (!release_status.ok()) return release_status;
 
-    s = (*wal)->RecoverPointers() == SZD::SZDStatus::Success ? IOStatus::OK() : IOStatus::IOError("WAL recover error");    
+  PutOpenIOZoneToken(tenant);
+  if (full) PutActiveIOZoneToken(tenant);
+  return IOStatus::OK();
+}
 
-    return s;
+// APPEND-DOC, open a zone for the WAL
+IOStatus ZonedBlockDevice::OpenWALZone(ZoneAppendLog **wal,
+                                       const WALZoneRange &range,
+                                       uint32_t tenant) {
+  if (range.nr == 0) return IOStatus::InvalidArgument("Empty WAL zone range");
+  if (!zbd_be_->OwnsAppendLogs() && !wal_channels_registered_)
+    return IOStatus::IOError("WAL channels are not registered");
+
+  if (*wal) {
+    CloseWALZone(wal);
+  }
+
+  if (zbd_be_->OwnsAppendLogs()) {
+    *wal = zbd_be_->NewAppendLog(range.start, range.start + range.nr);
+  } else {
+    WALChannelLease lease;
+    SZD::SZDChannel *channel = LeaseWALChannel(tenant, &lease);
+    // APPEND-DOC, the channel pools are registered with
+    // NAMELESS_WAL_PRESERVE_BUFFERS, the WAL writer only recycles its buffers
+    // right after an append if SZD copied them
+    *wal = new SZDAppendLog(szd_factory_, *di, range.start,
+                            range.start + range.nr, channel,
+                            NAMELESS_WAL_PRESERVE_BUFFERS);
+    std::lock_guard<std::mutex> lk(wal_channel_mtx_);
+    wal_channel_leases_[*wal] = lease;
+  }
+
+  return (*wal)->RecoverPointers() == SZD::SZDStatus::Success
+             ? IOStatus::OK()
+             : IOStatus::IOError("WAL recover error");
 }
 
-// APPEND-DOC, allocate a zone for the WAL
-IOStatus ZonedBlockDevice::AllocateWALZone(Zone **wal_zones_out, SZD::SZDOnceLog **wal, Zone* active_zone) {
-    Zone *allocated_zone = nullptr;
-    IOStatus s;
+void ZonedBlockDevice::CloseWALZone(ZoneAppendLog **wal) {
+  if (*wal == nullptr) return;
 
+  WALChannelLease lease;
+  bool leased = false;
+  {
+    std::lock_guard<std::mutex> lk(wal_channel_mtx_);
+    auto it = wal_channel_leases_.find(*wal);
+    if (it != wal_channel_leases_.end()) {
+      lease = it->second;
+      leased = true;
+      wal_channel_leases_.erase(it);
+    }
+  }
+  delete *wal;
+  *wal = nullptr;
+  if (leased) ReturnWALChannel(lease);
+}
 
-    s = ReleaseUnusedWALZones();
-    if (active_zone) {
-      //printf("WAL can still be used\n");
-      // printf("WAL can still be used, zidx WAL start: %lu, active zone: %lu, next zone: %lu \n", 
-        // (*wal)->GetWriteTail() / zbd_be_->GetZoneSize(), active_zone->GetZoneNr(), active_zone->GetZoneNr() + 1);
-      
-      uint64_t w_z = active_zone->GetZoneNr() - ZENFS_META_ZONES - ZENFS_FLAKY_ZONES;
-      w_z = (w_z % ZENFS_ZONES_FOREACH_WAL);
-      
-      //printf("zone %lu, wz == %lu, mod %u\n", 
-      //  active_zone->GetZoneNr(), w_z,  (ZENFS_ZONES_FOREACH_WAL - 1));
-
-      if ((w_z == ZENFS_ZONES_FOREACH_WAL - 1) ) {
-       // printf("WAL is already full \n");
-      } else {
-      //  printf("Reusing zone at %lu\n", active_zone->GetZoneNr() + 1);
-        allocated_zone = wal_zones[active_zone->GetZoneNr() + 1 - ZENFS_META_ZONES - ZENFS_FLAKY_ZONES];
-        *wal_zones_out = allocated_zone;
-        s = IOStatus::OK();
-
-        if (*wal == nullptr) {
-             // printf("Recreating WAL at %lu for %lu\n", w_z+ ZENFS_META_ZONES + ZENFS_FLAKY_ZONES,  active_zone->GetZoneNr());
-              
-              int old_ind = write_channel_ptr_;
-              int next_ind = (old_ind+1)  % write_channel_size_; 
-              while (!write_channel_ptr_.compare_exchange_weak(old_ind, next_ind, std::memory_order_release,
-                                                  std::memory_order_relaxed)) {
-                old_ind = write_channel_ptr_;
-                next_ind = (old_ind+1)  % write_channel_size_; 
-              }
-              
-              *wal = new SZD::SZDOnceLog(szd_factory_, *di, 
-              w_z + ZENFS_META_ZONES + ZENFS_FLAKY_ZONES,
-              w_z + ZENFS_META_ZONES + ZENFS_ZONES_FOREACH_WAL + ZENFS_FLAKY_ZONES,
-              write_channel_[next_ind]);
-            s = (*wal)->RecoverPointers() == SZD::SZDStatus::Success 
-              ? IOStatus::OK() 
-              : IOStatus::IOError("WAL recover error");    
-        }
+// APPEND-DOC, ZENFS_ZONES_FOREACH_WAL contiguous empty zones for a new WAL,
+// from the reserve of the reset worker if there is one. The first zone is
+// returned busy.
+IOStatus ZonedBlockDevice::AllocateWALZoneRange(Zone **out_zone,
+                                                WALZoneRange *range,
+                                                uint32_t tenant) {
+  IOStatus s;
 
-        return s;
+  *out_zone = nullptr;
+  if (!ReserveTenantWALZones(tenant, ZENFS_ZONES_FOREACH_WAL))
+    return IOStatus::OK();
+
+  s = PopWALRangeReserve(out_zone, range, tenant);
+  if (s.ok() && *out_zone == nullptr)
+    s = ClaimFreeWALZoneRange(out_zone, range, tenant);
+  if (!s.ok() || *out_zone == nullptr)
+    UnreserveTenantWALZones(tenant, ZENFS_ZONES_FOREACH_WAL);
+  return s;
+}
+
+// APPEND-DOC, claim ZENFS_ZONES_FOREACH_WAL contiguous empty zones. The range
+// is placed in the middle of the largest free gap, so that the WAL can chain
+// the zones after it while the first-fit IO allocator fills the gap from
+// below. The first zone is returned busy.
+IOStatus ZonedBlockDevice::ClaimFreeWALZoneRange(Zone **out_zone,
+                                                 WALZoneRange *range,
+                                                 uint32_t tenant) {
+  const size_t run = ZENFS_ZONES_FOREACH_WAL;
+  IOStatus s;
+
+  *out_zone = nullptr;
+  while (true) {
+    size_t best_start = 0, best_len = 0;
+    size_t gap_start = 0, gap_len = 0;
+
+    for (size_t i = 0; i < io_zones.size(); i++) {
+      Zone *z = io_zones[i];
+      bool free = z->IsEmpty() && !z->IsBusy() && !z->IsWALOwned();
+      bool contiguous = gap_len > 0 && z->GetZoneNr() ==
+                                           io_zones[i - 1]->GetZoneNr() + 1;
+      if (!free) {
+        gap_len = 0;
+        continue;
+      }
+      if (!contiguous) {
+        gap_start = i;
+        gap_len = 0;
+      }
+      gap_len++;
+      if (gap_len > best_len) {
+        best_start = gap_start;
+        best_len = gap_len;
       }
     }
 
+    if (best_len < run) return IOStatus::OK();
 
-    WaitForOpenIOZoneToken(true);
-    while (!GetActiveIOZoneTokenIfAvailable())
-      ;
+    size_t first = best_start + (best_len - run) / 2;
+    size_t acquired = 0;
+    for (; acquired < run; acquired++) {
+      Zone *z = io_zones[first + acquired];
+      if (!z->Acquire()) break;
+      if (!z->IsEmpty() || z->IsWALOwned()) {
+        s = z->CheckRelease();
+        if (!s.ok()) return s;
+        break;
+      }
+    }
 
-    size_t i=0;
-    for (; i < ZENFS_WAL_ZONES; i += ZENFS_ZONES_FOREACH_WAL) {
-      const auto z = wal_zones[i];
-      if (z->Acquire()) {
-        if (z->IsEmpty()) {
-          allocated_zone = z;
-          break;
-        } else {
+    if (acquired == run) {
+      for (size_t i = 0; i < run; i++) {
+        Zone *z = io_zones[first + i];
+        z->wal_owned_ = true;
+        z->tenant_ = tenant;
+        if (i > 0) {
           s = z->CheckRelease();
           if (!s.ok()) return s;
         }
-      } else {
-        // printf("Could not acquire zone %lu\n", z->GetZoneNr());
       }
+      range->start = io_zones[first]->GetZoneNr();
+      range->nr = run;
+      *out_zone = io_zones[first];
+      return IOStatus::OK();
     }
 
-    if (allocated_zone == nullptr) {
-      PutActiveIOZoneToken();
-      PutOpenIOZoneToken();
-      return IOStatus::NoSpace("No WAL space left (during alloc)");
-    } else {
-      // fprintf(stdout,
-      //     "Allocating WAL zone start: 0x%lx wp: 0x%lx\n",
-      //     allocated_zone->start_, allocated_zone->wp_);
+    /* Raced with another allocator, retry */
+    for (size_t i = 0; i < acquired; i++) {
+      s = io_zones[first + i]->CheckRelease();
+      if (!s.ok()) return s;
     }
+  }
+}
 
-    if (*wal) {
-      delete *wal;
-    }
-   
-    int old_ind = write_channel_ptr_;
-    int next_ind = (old_ind+1)  % write_channel_size_; 
-     while (!write_channel_ptr_.compare_exchange_weak(old_ind, next_ind, std::memory_order_release,
-                                        std::memory_order_relaxed)) {
-      old_ind = write_channel_ptr_;
-      next_ind = (old_ind+1)  % write_channel_size_; 
-     }
-    // printf("Ensure consistency %u %u %u \n", old_ind, next_ind, write_channel_ptr_.load());
+// APPEND-DOC, allocate a zone for the WAL
+IOStatus ZonedBlockDevice::AllocateWALZone(Zone **out_zone,
+                                           ZoneAppendLog **wal,
+                                           Zone *last_zone,
+                                           WALZoneRange *range,
+                                           uint32_t tenant) {
+  Zone *allocated_zone = nullptr;
+  bool new_range = (range->nr == 0);
+  IOStatus s;
 
-    *wal = new SZD::SZDOnceLog(szd_factory_,
-      *di, i + ZENFS_META_ZONES + ZENFS_FLAKY_ZONES, i + ZENFS_META_ZONES + ZENFS_ZONES_FOREACH_WAL + ZENFS_FLAKY_ZONES,
-       write_channel_[next_ind]);
+  WaitForOpenIOZoneToken(ZoneTokenClass::kWAL, tenant);
+  s = WaitForActiveIOZoneToken(ZoneTokenClass::kWAL, tenant);
+  if (!s.ok()) {
+    PutOpenIOZoneToken(tenant);
+    return s;
+  }
 
+  if (new_range) {
+    s = AllocateWALZoneRange(&allocated_zone, range, tenant);
+  } else {
+    uint64_t next = last_zone ? last_zone->GetZoneNr() + 1 : range->start;
+    Zone *z = GetIOZone(next * zbd_be_->GetZoneSize());
+
+    if (z != nullptr && next < range->start + range->nr) {
+      /* The next zone is already owned by the WAL */
+      WaitAcquireZone(z);
+      allocated_zone = z;
+    } else if (z != nullptr && z->Acquire()) {
+      /* Chain the next zone to the WAL, if it is free */
+      if (z->IsEmpty() && !z->IsWALOwned() &&
+          ReserveTenantWALZones(tenant, 1)) {
+        z->wal_owned_ = true;
+        z->tenant_ = tenant;
+        range->nr++;
+        allocated_zone = z;
+        new_range = true;
+      } else {
+        s = z->CheckRelease();
+      }
+    }
+  }
 
-    // printf("WAL to use %lu - %lu / %lu CHAN %u/%u \n", allocated_zone->GetZoneNr(), i + ZENFS_META_ZONES + ZENFS_FLAKY_ZONES,
-    //  i + ZENFS_META_ZONES + ZENFS_ZONES_FOREACH_WAL + ZENFS_FLAKY_ZONES, next_ind, write_channel_size_);
+  if (!s.ok() || allocated_zone == nullptr) {
+    PutActiveIOZoneToken(tenant);
+    PutOpenIOZoneToken(tenant);
+    if (!s.ok()) return s;
+    return IOStatus::NoSpace("No WAL space left (during alloc)");
+  }
 
-    s = (*wal)->RecoverPointers() == SZD::SZDStatus::Success ? IOStatus::OK() : IOStatus::IOError("WAL recover error");    
+  /* The once log has to span the (extended) zone range */
+  if (new_range || *wal == nullptr) {
+    if (*wal) {
+      zbd_be_->AppendSync(*wal);
+      (*wal)->Sync();
+    }
+    s = OpenWALZone(wal, *range, tenant);
+  }
 
-    *wal_zones_out = allocated_zone;
-    return s;
+  *out_zone = allocated_zone;
+  return s;
 }
 
 std::string ZonedBlockDevice::GetFilename() { return zbd_be_->GetFilename(); }
@@ -1167,15 +2018,18 @@ IOStatus ZonedBlockDevice::GetZoneDeferredStatus() {
   return zone_deferred_status_;
 }
 
+/* The first error is kept, it is returned by the next allocation and sync */
 void ZonedBlockDevice::SetZoneDeferredStatus(IOStatus status) {
   std::lock_guard<std::mutex> lk(zone_deferred_status_mutex_);
-  if (!zone_deferred_status_.ok()) {
+  if (zone_deferred_status_.ok()) {
     zone_deferred_status_ = status;
   }
 }
 
 void ZonedBlockDevice::GetZoneSnapshot(std::vector<ZoneSnapshot> &snapshot) {
   for (auto *zone : io_zones) {
+    // APPEND-DOC, WAL zones are reset by the once log, never migrated by GC
+    if (zone->IsWALOwned()) continue;
     snapshot.emplace_back(*zone);
   }
 }
@@ -18,9 +18,15 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -41,6 +47,37 @@
 #include <szd/szd_device.hpp>
 
 #define NAMELESS_WAL_DEPTH (128)
+/* APPEND-DOC, deepest WAL channel. An SZD channel has one passthrough command
+ * per queue entry in flight, the NVMe driver's default I/O queue is no deeper */
+#define NAMELESS_WAL_MAX_DEPTH (1024)
+/* APPEND-DOC, WAL channels are registered with preserve_async_buffer, SZD then
+ * copies the data of an async append into its own queue entry before
+ * AsyncAppend returns. Without it, the data of an append must stay untouched
+ * until the next Sync. */
+#define NAMELESS_WAL_PRESERVE_BUFFERS (true)
+/* APPEND-DOC, default number of WAL write channels */
+#define NAMELESS_WAL_CHANNELS (8)
+/* APPEND-DOC, number of zones a new WAL claims up front, it grows from there */
+#define ZENFS_ZONES_FOREACH_WAL (3)
+/* APPEND-DOC, tenants (e.g. DB shards) sharing one device, 0 is the default */
+#define ZENFS_MAX_TENANTS (16)
+#define ZENFS_DEFAULT_TENANT (0)
+/* APPEND-DOC, SST writers that zone append to the same open zone */
+#define ZENFS_SST_ZONE_SHARERS (8)
+/* APPEND-DOC, reserves of already reset zones kept by the reset worker,
+ * empty IO zones and WAL zone ranges (of ZENFS_ZONES_FOREACH_WAL zones) */
+#define ZENFS_RESERVE_IO_ZONES (4)
+#define ZENFS_RESERVE_WAL_RANGES (1)
+/* APPEND-DOC, the reset worker also checks the reserves this often */
+#define ZENFS_RESET_INTERVAL_MS (100)
+/* APPEND-DOC, an allocator waiting for an active token retries to finish a
+ * zone this often, if no token is returned before. Also the timeout of zone
+ * release waits. */
+#define ZENFS_TOKEN_RETRY_MS (1)
+/* APPEND-DOC, files migrated concurrently by GC, and the size of the reads
+ * and appends of a migration */
+#define ZENFS_GC_THREADS (4)
+#define ZENFS_GC_MIGRATE_STEP (1 << 20)
 
 namespace ROCKSDB_NAMESPACE {
 
@@ -49,6 +86,54 @@ class ZonedBlockDeviceBackend;
 class ZoneSnapshot;
 class ZenFSSnapshotOptions;
 
+// APPEND-DOC, the zone append log of a WAL, the part of the SZD once log
+// interface that ZWAL uses. Positions are device LBAs (blocks). An SZD once
+// log on a ZNS device, or a stand-in of a backend that emulates zones.
+class ZoneAppendLog {
+ public:
+  virtual ~ZoneAppendLog() {}
+  virtual SZD::SZDStatus AsyncAppend(const char *data, size_t size,
+                                     uint64_t *lbas) = 0;
+  virtual SZD::SZDStatus Sync() = 0;
+  virtual SZD::SZDStatus Read(uint64_t lba, char *data, uint64_t size,
+                              bool aligned) = 0;
+  virtual SZD::SZDStatus ResetAll() = 0;
+  virtual SZD::SZDStatus RecoverPointers() = 0;
+  virtual uint64_t GetWriteHead() = 0;
+  virtual uint64_t GetWriteTail() = 0;
+  /* True if the data of an append can be reused once AsyncAppend returns,
+   * otherwise only after the next Sync */
+  virtual bool CopiesAppends() = 0;
+};
+
+class SZDAppendLog : public ZoneAppendLog {
+  SZD::SZDOnceLog log_;
+  bool preserve_async_buffer_;
+
+ public:
+  /* preserve_async_buffer must match the registration of the channel */
+  SZDAppendLog(SZD::SZDChannelFactory *factory, const SZD::DeviceInfo &info,
+               uint64_t min_zone, uint64_t max_zone, SZD::SZDChannel *channel,
+               bool preserve_async_buffer)
+      : log_(factory, info, min_zone, max_zone, channel),
+        preserve_async_buffer_(preserve_async_buffer) {}
+
+  SZD::SZDStatus AsyncAppend(const char *data, size_t size,
+                             uint64_t *lbas) override {
+    return log_.AsyncAppend(data, size, lbas);
+  }
+  SZD::SZDStatus Sync() override { return log_.Sync(); }
+  SZD::SZDStatus Read(uint64_t lba, char *data, uint64_t size,
+                      bool aligned) override {
+    return log_.Read(lba, data, size, aligned);
+  }
+  SZD::SZDStatus ResetAll() override { return log_.ResetAll(); }
+  SZD::SZDStatus RecoverPointers() override { return log_.RecoverPointers(); }
+  uint64_t GetWriteHead() override { return log_.GetWriteHead(); }
+  uint64_t GetWriteTail() override { return log_.GetWriteTail(); }
+  bool CopiesAppends() override { return preserve_async_buffer_; }
+};
+
 class ZoneList {
  private:
   void *data_;
@@ -66,6 +151,7 @@ class Zone {
   ZonedBlockDevice *zbd_;
   ZonedBlockDeviceBackend *zbd_be_;
   std::atomic_bool busy_;
+  std::mutex append_mtx_;
 
  public:
   explicit Zone(ZonedBlockDevice *zbd, ZonedBlockDeviceBackend *zbd_be,
@@ -77,6 +163,17 @@ class Zone {
   uint64_t wp_;
   Env::WriteLifeTimeHint lifetime_;
   std::atomic<uint64_t> used_capacity_;
+  // APPEND-DOC, zone belongs to a WAL zone range, IO allocation skips it
+  std::atomic<bool> wal_owned_{false};
+  // APPEND-DOC, tenant that holds the active token of the zone
+  uint32_t tenant_{ZENFS_DEFAULT_TENANT};
+  // APPEND-DOC, SST writers sharing the (busy) zone in zone append mode,
+  // protected by the shared_zones_mtx_ of the device
+  uint32_t sharers_{0};
+  // APPEND-DOC, position in the zone index of the device, protected by its
+  // zone_index_mtx_. -1 if the zone is in no open zone bucket.
+  int open_bucket_{-1};
+  bool queued_empty_{false};
 
   IOStatus Reset();
   IOStatus Finish();
@@ -84,13 +181,20 @@ class Zone {
 
   IOStatus Append(char *data, uint32_t size);
   // APPEND-DOC, new method for zone appends
-  IOStatus ZoneAppend(char *data, uint32_t size, SZD::SZDOnceLog *wal);
+  IOStatus ZoneAppend(char *data, uint32_t size, ZoneAppendLog *wal);
+  // APPEND-DOC, zone append of a shared zone. Appends up to size bytes (less
+  // if the zone is almost full or the device limits appends), *appended is the
+  // number of bytes appended and *pos the position the device put them at.
+  IOStatus ZoneAppend(char *data, uint32_t size, uint32_t *appended,
+                      uint64_t *pos);
+  bool HasAppendCapacity();
   bool IsUsed();
   bool IsFull();
   bool IsEmpty();
   uint64_t GetZoneNr();
   uint64_t GetCapacityLeft();
   bool IsBusy() { return this->busy_.load(std::memory_order_relaxed); }
+  bool IsWALOwned() { return wal_owned_.load(std::memory_order_acquire); }
   bool Acquire() {
     bool expected = false;
     return this->busy_.compare_exchange_strong(expected, true,
@@ -98,15 +202,32 @@ class Zone {
   }
   bool Release() {
     bool expected = true;
-    return this->busy_.compare_exchange_strong(expected, false,
-                                               std::memory_order_acq_rel);
+    bool released = this->busy_.compare_exchange_strong(
+        expected, false, std::memory_order_acq_rel);
+    if (released) NotifyReleased();
+    return released;
   }
+  // APPEND-DOC, wakes up the allocators waiting for a zone to be released
+  void NotifyReleased();
 
   void EncodeJson(std::ostream &json_stream);
 
   inline IOStatus CheckRelease();
 };
 
+// APPEND-DOC, a device read that is submitted together with others
+// (MultiRead) or asynchronously (ReadAsync). Once done_ is set, result holds
+// the bytes read or -errno. done_ is owned by the backend until then.
+struct ZbdReadRequest {
+  char *buf = nullptr;
+  uint64_t pos = 0;
+  int size = 0;
+  bool direct = false;
+  int result = 0;
+  bool done_ = false;
+  int queue_ = -1;
+};
+
 class ZonedBlockDeviceBackend {
  public:
   uint32_t block_sz_ = 0;
@@ -125,9 +246,32 @@ class ZonedBlockDeviceBackend {
   virtual IOStatus Close(uint64_t start) = 0;
   virtual int Read(char *buf, int size, uint64_t pos, bool direct) = 0;
   virtual int Write(char *data, uint32_t size, uint64_t pos) = 0;
+  // APPEND-DOC, batched reads. SubmitReads may complete the reads right away,
+  // WaitReads returns once all of them are done. By default reads are
+  // synchronous.
+  virtual void SubmitReads(ZbdReadRequest **reqs, size_t n);
+  virtual void WaitReads(ZbdReadRequest ** /*reqs*/, size_t /*n*/) {}
+  // APPEND-DOC, zone appends of regular file data. The device places the data
+  // in the zone at zone_start and *pos returns where it landed, several
+  // threads may append to the same zone at once. size is block aligned and at
+  // most ZoneAppendMax(), 0 if the backend has no zone appends. Returns size,
+  // or -1 and errno.
+  virtual uint32_t ZoneAppendMax() { return 0; }
+  virtual int ZoneAppend(char * /*data*/, uint32_t /*size*/,
+                         uint64_t /*zone_start*/, uint64_t * /*pos*/) {
+    errno = ENOTSUP;
+    return -1;
+  }
   // APPEND-DOC, new append methods
-  virtual int Append(char *data, uint32_t size,  SZD::SZDOnceLog *wal) = 0;
-  virtual int AppendSync(SZD::SZDOnceLog *wal) = 0;
+  virtual int Append(char *data, uint32_t size,  ZoneAppendLog *wal) = 0;
+  virtual int AppendSync(ZoneAppendLog *wal) = 0;
+  // APPEND-DOC, backends that emulate zones also emulate the WAL logs, no SZD
+  // device is opened for them
+  virtual bool OwnsAppendLogs() { return false; }
+  virtual ZoneAppendLog *NewAppendLog(uint64_t /*min_zone*/,
+                                      uint64_t /*max_zone*/) {
+    return nullptr;
+  }
   virtual int InvalidateCache(uint64_t pos, uint64_t size) = 0;
   virtual bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones,
                          unsigned int idx) = 0;
@@ -152,17 +296,94 @@ class ZonedBlockDeviceBackend {
   virtual ~ZonedBlockDeviceBackend(){};
 };
 
+// APPEND-DOC, the contiguous zones owned by a WAL (an SZD once log spans a
+// contiguous zone range). Persisted in the file metadata.
+struct WALZoneRange {
+  uint64_t start = 0; /* first zone nr */
+  uint64_t nr = 0;    /* number of zones */
+};
+
 enum class ZbdBackendType {
   kBlockDev,
   kZoneFS,
+  kEmulated,
+};
+
+// APPEND-DOC, runtime ZWAL tunables. Persisted in the superblock at mkfs time
+// and optionally overridden per mount (zenfs:// URI or NewZenFS). A value of 0
+// selects the compile-time default.
+struct ZWALOptions {
+  uint32_t buffer_size_kb = 0;  /* sparse buffer per WAL (SPARSE_BUFFER_SIZE_IN_KB) */
+  uint32_t barrier_size_kb = 0; /* bytes between WAL barriers (WAL_BARRIER_SIZE_IN_KB) */
+  uint32_t barrier_min_kb = 0;  /* adaptive barrier bounds, max 0 = fixed barrier */
+  uint32_t barrier_max_kb = 0;
+  uint32_t depth = 0;           /* max QD of a WAL channel (NAMELESS_WAL_DEPTH) */
+  uint32_t channels = 0;        /* WAL write channels (NAMELESS_WAL_CHANNELS) */
+  bool sst_zone_appends = false; /* SSTs zone append to shared zones */
+  uint32_t reserve_io_zones = 0;   /* empty IO zones kept in reserve */
+  uint32_t reserve_wal_ranges = 0; /* empty WAL zone ranges kept in reserve */
+  uint32_t gc_threads = 0;         /* concurrent GC migrations (ZENFS_GC_THREADS) */
+  uint32_t gc_bandwidth_mb = 0;    /* GC copy budget in MiB/s, 0 = unlimited */
+};
+
+// APPEND-DOC, allocators waiting for zone tokens are served in this order,
+// then in order of arrival
+enum class ZoneTokenClass : uint32_t { kWAL = 0, kFlush = 1, kCompaction = 2 };
+
+// APPEND-DOC, an allocator waiting for an open or an active zone token,
+// protected by the zone_resources_mtx_ of the device
+struct ZoneTokenWaiter {
+  ZoneTokenClass cls;
+  uint32_t tenant;
+  bool active;        /* waits for an active token, else for an open token */
+  bool granted = false;
+  std::condition_variable cv;
+};
+
+// APPEND-DOC, the once log of a deleted WAL, reset by the reset worker
+struct PendingWALReset {
+  ZoneAppendLog *wal;  /* nullptr if the log is not open */
+  WALZoneRange range;
+  uint32_t tenant;
+};
+
+// APPEND-DOC, a set of SZD write channels. Every open WAL leases a channel
+// for itself, when all are leased the least used channel is shared.
+struct WALChannelPool {
+  std::vector<SZD::SZDChannel *> channels;
+  std::vector<uint32_t> users; /* WALs per channel */
+  uint32_t next = 0;           /* where the search for a free channel starts */
+};
+
+struct WALChannelLease {
+  WALChannelPool *pool = nullptr;
+  size_t idx = 0;
+};
+
+// APPEND-DOC, zone budget of a tenant, carved out of the device limits.
+// A value of 0 leaves the resource shared with the other tenants.
+struct ZenFSTenantOptions {
+  uint32_t max_open_zones = 0;
+  uint32_t max_active_zones = 0;
+  uint32_t max_wal_zones = 0;
+  uint32_t write_channels = 0; /* dedicated WAL channels */
+};
+
+struct ZenFSTenant {
+  ZenFSTenantOptions options;
+  /* Protected by zone_resources_mtx_ */
+  long open_io_zones = 0;
+  long active_io_zones = 0;
+  std::atomic<uint64_t> wal_zones{0};
+  /* Protected by wal_channel_mtx_ */
+  WALChannelPool channels;
 };
 
 class ZonedBlockDevice {
  private:
   std::unique_ptr<ZonedBlockDeviceBackend> zbd_be_;
+  // APPEND-DOC, WAL zones are taken from io_zones (see Zone::wal_owned_)
   std::vector<Zone *> io_zones;
-  // APPEND-DOC, new WAL zones
-  std::vector<Zone *> wal_zones;
   std::vector<Zone *> meta_zones;
   time_t start_time_;
   std::shared_ptr<Logger> logger_;
@@ -172,16 +393,24 @@ class ZonedBlockDevice {
 
   std::atomic<long> active_io_zones_;
   std::atomic<long> open_io_zones_;
-  /* Protects zone_resuorces_  condition variable, used
-     for notifying changes in open_io_zones_ */
+  /* Protects open_io_zones_, active_io_zones_, the tenant budgets and the
+     token waiters */
   std::mutex zone_resources_mtx_;
-  std::condition_variable zone_resources_;
+  // APPEND-DOC, token waiters in order of service, see GrantZoneTokensLocked
+  std::list<ZoneTokenWaiter *> token_waiters_;
+  std::atomic<uint32_t> active_token_waiters_{0};
+  // APPEND-DOC, waiters for a busy zone, woken up by Zone::Release
+  std::mutex zone_release_mtx_;
+  std::condition_variable zone_release_cv_;
+  std::atomic<uint32_t> zone_release_waiters_{0};
   std::mutex zone_deferred_status_mutex_;
   IOStatus zone_deferred_status_;
 
   std::condition_variable migrate_resource_;
   std::mutex migrate_zone_mtx_;
-  std::atomic<bool> migrating_{false};
+  uint32_t migrations_ = 0; /* zones taken for migration */
+  std::mutex gc_throttle_mtx_;
+  uint64_t gc_throttle_next_us_ = 0; /* when the GC budget allows the next copy */
 
   unsigned int max_nr_active_io_zones_;
   unsigned int max_nr_open_io_zones_;
@@ -192,11 +421,39 @@ class ZonedBlockDevice {
   SZD::SZDDevice *szd_device_{nullptr};
   SZD::SZDChannelFactory *szd_factory_{nullptr};
   SZD::DeviceInfo *di{nullptr};
-  SZD::SZDChannel **write_channel_{nullptr};
-  std::atomic<int> write_channel_ptr_{0};
-  // Some safity that no WAL uses the same channel concurrently...
-  const uint8_t write_channel_size_{8};
-
+  // APPEND-DOC, WAL channels, leased by open WALs (see LeaseWALChannel)
+  std::mutex wal_channel_mtx_;
+  WALChannelPool wal_channels_;
+  std::unordered_map<ZoneAppendLog *, WALChannelLease> wal_channel_leases_;
+  bool wal_channels_registered_{false};
+  uint32_t write_channel_depth_{0};
+  ZWALOptions wal_options_;
+  // APPEND-DOC, tenants, only added before the file system is mounted
+  ZenFSTenant tenants_[ZENFS_MAX_TENANTS];
+  std::atomic<uint32_t> nr_tenants_{1};
+  // APPEND-DOC, open zones shared by SST writers in zone append mode
+  std::mutex shared_zones_mtx_;
+  std::vector<Zone *> shared_zones_;
+  // APPEND-DOC, ReadAsync handles, see RegisterAsyncRead
+  std::mutex async_reads_mtx_;
+  std::unordered_set<void *> async_reads_;
+  // APPEND-DOC, allocation index of the IO zones. Open zones (written, not
+  // full) are bucketed by lifetime, empty zones are queued. Entries are hints,
+  // a zone is acquired and checked before it is used, and stale entries are
+  // dropped when they are found.
+  std::mutex zone_index_mtx_;
+  std::vector<Zone *> open_zones_[Env::WLTH_EXTREME + 1];
+  std::deque<Zone *> empty_zones_;
+  // APPEND-DOC, background zone resets and the reserve of reset WAL ranges.
+  // The reserved WAL ranges are owned (wal_owned_) by no WAL.
+  std::unique_ptr<std::thread> reset_worker_;
+  std::mutex reset_mtx_;
+  std::condition_variable reset_cv_;
+  bool reset_stop_ = false;
+  bool reset_kicked_ = false;
+  std::vector<PendingWALReset> wal_resets_;
+  std::mutex zone_reserve_mtx_;
+  std::deque<WALZoneRange> wal_range_reserve_;
 
   void EncodeJsonZone(std::ostream &json_stream,
                       const std::vector<Zone *> zones);
@@ -204,7 +461,7 @@ class ZonedBlockDevice {
  public:
 
   // APPEND-DOC
-  int AppendSync(SZD::SZDOnceLog *wal) {
+  int AppendSync(ZoneAppendLog *wal) {
     return zbd_be_->AppendSync(wal); 
   }    
 
@@ -218,17 +475,46 @@ class ZonedBlockDevice {
   IOStatus Open(bool readonly, bool exclusive);
 
   Zone *GetIOZone(uint64_t offset);
-  // APPEND-DOC
-  SZD::SZDOnceLog *GetWAL(uint64_t offset);
+  // APPEND-DOC, mark the zones of a recovered WAL as owned
+  IOStatus ClaimWALZones(const WALZoneRange &range,
+                         uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  // APPEND-DOC, charge a recovered zone of a file to its tenant
+  void ClaimTenantZone(Zone *zone, uint32_t tenant);
+
+  // APPEND-DOC, register a tenant with its own zone budget
+  IOStatus AddTenant(const ZenFSTenantOptions &options, uint32_t *tenant);
+  uint32_t GetNrTenants() { return nr_tenants_; }
 
   IOStatus AllocateIOZone(Env::WriteLifeTimeHint file_lifetime, IOType io_type,
-                          Zone **out_zone);
+                          Zone **out_zone,
+                          uint32_t tenant = ZENFS_DEFAULT_TENANT);
   IOStatus AllocateMetaZone(Zone **out_meta_zone);
+  // APPEND-DOC, open zone for an SST in zone append mode, shared with up to
+  // ZENFS_SST_ZONE_SHARERS writers of the same lifetime and tenant
+  IOStatus AllocateSharedIOZone(Env::WriteLifeTimeHint file_lifetime,
+                                IOType io_type, Zone **out_zone,
+                                uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  // APPEND-DOC, the last writer closes the zone and returns its tokens
+  IOStatus ReleaseSharedIOZone(Zone *zone);
+  bool SSTZoneAppends() {
+    return wal_options_.sst_zone_appends && zbd_be_->ZoneAppendMax() > 0;
+  }
   
-  // APPEND-DOC
-  IOStatus OpenWALZone(SZD::SZDOnceLog **wal, Zone* active_zone);
-  // APPEND-DOC
-  IOStatus AllocateWALZone(Zone **wal_zones, SZD::SZDOnceLog **wal, Zone* active_zone);
+  // APPEND-DOC, (re)open the once log of a WAL zone range
+  IOStatus OpenWALZone(ZoneAppendLog **wal, const WALZoneRange &range,
+                       uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  // APPEND-DOC, delete the once log and return its channel, the caller syncs
+  void CloseWALZone(ZoneAppendLog **wal);
+  // APPEND-DOC, next zone of a WAL, extends or allocates the zone range
+  IOStatus AllocateWALZone(Zone **out_zone, ZoneAppendLog **wal,
+                           Zone *last_zone, WALZoneRange *range,
+                           uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  // APPEND-DOC, return the (reset) zones of a WAL to the IO zones
+  IOStatus ReleaseWALZones(const WALZoneRange &range);
+  // APPEND-DOC, reset the zones of a deleted WAL and release them, on the
+  // reset worker if it runs. Takes over the once log.
+  IOStatus ResetWALZones(ZoneAppendLog **wal, const WALZoneRange &range,
+                         uint32_t tenant);
 
   uint64_t GetFreeSpace();
   uint64_t GetUsedSpace();
@@ -237,9 +523,18 @@ class ZonedBlockDevice {
   std::string GetFilename();
   uint32_t GetBlockSize();
 
-  // APPEND-DOC
-  IOStatus ReleaseUnusedWALZones();
   IOStatus ResetUnusedIOZones();
+  // APPEND-DOC, leaves the resets to the reset worker if it runs
+  IOStatus ResetUnusedIOZonesAsync();
+  // APPEND-DOC, zone releases wake up the waiters of WaitAcquireZone
+  void NotifyZoneReleased();
+  // APPEND-DOC, blocks until the zone is acquired
+  void WaitAcquireZone(Zone *zone);
+  static ZoneTokenClass TokenClass(IOType io_type,
+                                   Env::WriteLifeTimeHint lifetime);
+  // APPEND-DOC, background resets, started after mount
+  void StartResetWorker();
+  void StopResetWorker();
   void LogZoneStats();
   void LogZoneUsage();
   void LogGarbageInfo();
@@ -249,25 +544,49 @@ class ZonedBlockDevice {
   std::vector<Zone *> GetMetaZones() { return meta_zones; }
 
   void SetFinishTreshold(uint32_t threshold) { finish_threshold_ = threshold; }
+  // APPEND-DOC, expects resolved (non-zero) options, (re)registers channels
+  IOStatus SetWALOptions(const ZWALOptions &options);
+  const ZWALOptions &GetWALOptions() { return wal_options_; }
 
-  void PutOpenIOZoneToken();
-  void PutActiveIOZoneToken();
+  void PutOpenIOZoneToken(uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  void PutActiveIOZoneToken(uint32_t tenant = ZENFS_DEFAULT_TENANT);
 
   void EncodeJson(std::ostream &json_stream);
 
   void SetZoneDeferredStatus(IOStatus status);
+  IOStatus GetZoneDeferredStatus();
 
   std::shared_ptr<ZenFSMetrics> GetMetrics() { return metrics_; }
 
   void GetZoneSnapshot(std::vector<ZoneSnapshot> &snapshot);
 
   int Read(char *buf, uint64_t offset, int n, bool direct);
+  // APPEND-DOC, batched and asynchronous reads, short reads are completed
+  // synchronously by WaitReads
+  void SubmitReads(ZbdReadRequest **reqs, size_t n) {
+    zbd_be_->SubmitReads(reqs, n);
+  }
+  void WaitReads(ZbdReadRequest **reqs, size_t n);
+  void MultiRead(ZbdReadRequest **reqs, size_t n) {
+    SubmitReads(reqs, n);
+    WaitReads(reqs, n);
+  }
+  // APPEND-DOC, handles of reads in ReadAsync, from submission until the
+  // handle is deleted. ZenFS::Poll and AbortIO look them up by address.
+  void RegisterAsyncRead(void *handle);
+  void UnregisterAsyncRead(void *handle);
+  bool IsAsyncRead(void *handle);
   IOStatus InvalidateCache(uint64_t pos, uint64_t size);
 
   IOStatus ReleaseMigrateZone(Zone *zone);
 
   IOStatus TakeMigrateZone(Zone **out_zone, Env::WriteLifeTimeHint lifetime,
-                           uint32_t min_capacity);
+                           uint32_t min_capacity,
+                           uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  // APPEND-DOC, blocks a GC copy of bytes until the GC bandwidth budget
+  // allows it
+  void ThrottleGC(uint64_t bytes);
+  uint32_t GCThreads() { return wal_options_.gc_threads; }
 
   void AddBytesWritten(uint64_t written) { bytes_written_ += written; };
   void AddGCBytesWritten(uint64_t written) { gc_bytes_written_ += written; };
@@ -281,14 +600,60 @@ class ZonedBlockDevice {
   IOStatus CloseCharacterDevice();
   // APPEND-DOC
   IOStatus OpenCharacterDevice(std::string path);
-  IOStatus GetZoneDeferredStatus();
-  bool GetActiveIOZoneTokenIfAvailable();
-  void WaitForOpenIOZoneToken(bool prioritized);
+  // APPEND-DOC
+  IOStatus RegisterWALChannels(uint32_t nr, uint32_t depth);
+  // APPEND-DOC, must hold wal_channel_mtx_
+  IOStatus RegisterChannelPool(WALChannelPool *pool, uint32_t nr,
+                               uint32_t depth);
+  // APPEND-DOC
+  SZD::SZDChannel *LeaseWALChannel(uint32_t tenant, WALChannelLease *lease);
+  void ReturnWALChannel(const WALChannelLease &lease);
+  // APPEND-DOC, must hold wal_channel_mtx_
+  void ReportWALChannels();
+  // APPEND-DOC
+  IOStatus AllocateWALZoneRange(Zone **out_zone, WALZoneRange *range,
+                                uint32_t tenant);
+  IOStatus ClaimFreeWALZoneRange(Zone **out_zone, WALZoneRange *range,
+                                 uint32_t tenant);
+  // APPEND-DOC, reset worker
+  void ResetWorker();
+  IOStatus ResetWALZonesNow(PendingWALReset *reset);
+  IOStatus FillZoneReserves();
+  void KickResetWorker();
+  // APPEND-DOC, zone index
+  void IndexOpenZone(Zone *zone);
+  void IndexEmptyZone(Zone *zone);
+  /* Must hold zone_index_mtx_ */
+  void QueueEmptyZoneLocked(Zone *zone);
+  std::vector<Zone *> OpenZoneCandidates(Env::WriteLifeTimeHint file_lifetime);
+  IOStatus PopEmptyZone(Zone **out_zone);
+  IOStatus PopWALRangeReserve(Zone **out_zone, WALZoneRange *range,
+                              uint32_t tenant);
+  // APPEND-DOC, tenant budget checks, must hold zone_resources_mtx_
+  bool TenantOpenAvailable(uint32_t tenant, bool prioritized);
+  bool TenantActiveAvailable(uint32_t tenant);
+  // APPEND-DOC, take nr WAL zones from the tenant budget
+  bool ReserveTenantWALZones(uint32_t tenant, uint64_t nr);
+  void UnreserveTenantWALZones(uint32_t tenant, uint64_t nr);
+  bool GetActiveIOZoneTokenIfAvailable(uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  void WaitForOpenIOZoneToken(ZoneTokenClass cls,
+                              uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  // APPEND-DOC, finishes zones until an active token is granted
+  IOStatus WaitForActiveIOZoneToken(ZoneTokenClass cls,
+                                    uint32_t tenant = ZENFS_DEFAULT_TENANT);
+  // APPEND-DOC, token waiters, must hold zone_resources_mtx_
+  bool TakeOpenTokenLocked(bool prioritized, uint32_t tenant);
+  bool TakeActiveTokenLocked(uint32_t tenant);
+  void EnqueueTokenWaiterLocked(ZoneTokenWaiter *waiter);
+  void GrantZoneTokensLocked();
+  void ReportTokenWait(ZoneTokenClass cls, uint64_t begin_us);
   IOStatus ApplyFinishThreshold();
-  IOStatus FinishCheapestIOZone();
+  IOStatus FinishCheapestIOZone(uint32_t tenant = ZENFS_DEFAULT_TENANT,
+                                bool *finished = nullptr);
   IOStatus GetBestOpenZoneMatch(Env::WriteLifeTimeHint file_lifetime,
                                 unsigned int *best_diff_out, Zone **zone_out,
-                                uint32_t min_capacity = 0);
+                                uint32_t min_capacity = 0,
+                                uint32_t tenant = ZENFS_DEFAULT_TENANT);
   IOStatus AllocateEmptyZone(Zone **zone_out);
 };
 
@@ -11,12 +11,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libzbd/zbd.h>
+#include <linux/nvme_ioctl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
 #include <string>
+#include <thread>
 
 #include "rocksdb/env.h"
 #include "rocksdb/io_status.h"
@@ -27,7 +32,11 @@ ZbdlibBackend::ZbdlibBackend(std::string bdevname)
     : filename_("/dev/" + bdevname),
       read_f_(-1),
       read_direct_f_(-1),
-      write_f_(-1) {
+      write_f_(-1),
+      ng_f_(-1),
+      nsid_(0),
+      lba_sz_(0),
+      zone_append_max_(0) {
 // APPEND-DOC, used to debug if reordering works
 #ifdef REORDER_WAL_TEST
         for (size_t i = 0; i < 16; i++) {
@@ -115,9 +124,62 @@ IOStatus ZbdlibBackend::Open(bool readonly, bool exclusive,
   nr_zones_ = info.nr_zones;
   *max_active_zones = info.max_nr_active_zones;
   *max_open_zones = info.max_nr_open_zones;
+
+  /* Without io_uring, reads fall back to pread */
+  for (int i = 0; i < ZENFS_URING_QUEUES; i++) {
+    std::unique_ptr<UringQueue> q(new UringQueue());
+    if (io_uring_queue_init(ZENFS_URING_DEPTH, &q->ring, 0) < 0) break;
+    uring_queues_.push_back(std::move(q));
+  }
+
+  if (!readonly) OpenZoneAppends(info);
   return IOStatus::OK();
 }
 
+/* Zone appends go through the ng char device of the namespace, as the block
+ * device has no user interface for them. Any failure leaves the backend
+ * without zone appends. */
+void ZbdlibBackend::OpenZoneAppends(const zbd_info &info) {
+  std::string dev = filename_.substr(5);  // Remove "/dev/" from /dev/nvmeXnY
+  std::string ng = filename_;
+  std::fstream f;
+  uint64_t append_max = 0;
+  int ret;
+
+  if (ng.find("nvme") == std::string::npos) return;
+  ng.replace(ng.find("nvme"), std::string("nvme").size(), "ng");
+
+  f.open("/sys/block/" + dev + "/queue/zone_append_max_bytes",
+         std::fstream::in);
+  if (!f.is_open()) return;
+  f >> append_max;
+  f.close();
+  append_max -= append_max % block_sz_;
+  if (append_max == 0 || info.lblock_size == 0) return;
+
+  ng_f_ = open(ng.c_str(), O_RDWR);
+  if (ng_f_ < 0) return;
+  ret = ioctl(ng_f_, NVME_IOCTL_ID);
+  if (ret <= 0) {
+    close(ng_f_);
+    ng_f_ = -1;
+    return;
+  }
+  nsid_ = ret;
+
+  for (int i = 0; i < ZENFS_APPEND_QUEUES; i++) {
+    std::unique_ptr<AppendQueue> q(new AppendQueue());
+    if (io_uring_queue_init(ZENFS_APPEND_DEPTH, &q->ring,
+                            IORING_SETUP_SQE128 | IORING_SETUP_CQE32) < 0)
+      break;
+    append_queues_.push_back(std::move(q));
+  }
+  if (append_queues_.empty()) return;
+
+  lba_sz_ = info.lblock_size;
+  zone_append_max_ = std::min<uint64_t>(append_max, UINT32_MAX - block_sz_ + 1);
+}
+
 std::unique_ptr<ZoneList> ZbdlibBackend::ListZones() {
   int ret;
   void *zones;
@@ -195,8 +257,284 @@ int ZbdlibBackend::Write(char *data, uint32_t size, uint64_t pos) {
   return ret;
 }
 
+/* io_uring_enter errors that leave the ring usable. Unsubmitted entries stay
+ * in the submission queue and go out with the next submit, a full completion
+ * queue (EBUSY) drains when completions are reaped. */
+static bool UringRetry(int ret) {
+  return ret == -EINTR || ret == -EAGAIN || ret == -EBUSY;
+}
+
+/* The first n queued entries were consumed by the kernel at a submit */
+template <typename Queued>
+static void UringConsumed(Queued *queued, int n) {
+  size_t consumed = std::min<size_t>(n, queued->size());
+  queued->erase(queued->begin(), queued->begin() + consumed);
+}
+
+/* Must hold q->mtx. After an error the ring takes no new reads. Reads the
+ * kernel has not consumed are turned into no-ops and fail right away. The
+ * submitted ones are cancelled and only complete when their completions are
+ * reaped, the device may write into their buffers until then. If the ring
+ * fails again while they are reaped, it is torn down and they fail with it. */
+void ZbdlibBackend::FailReads(UringQueue *q, int err) {
+  struct io_uring_sqe *sqe;
+
+  if (q->error) {
+    io_uring_queue_exit(&q->ring);
+    q->exited = true;
+    for (ZbdReadRequest *req : q->pending) {
+      req->result = q->error;
+      req->done_ = true;
+    }
+    q->pending.clear();
+    q->inflight = 0;
+    return;
+  }
+
+  q->error = err;
+  for (auto &queued : q->queued) {
+    ZbdReadRequest *req = queued.first;
+    io_uring_prep_nop(queued.second);
+    io_uring_sqe_set_data(queued.second, nullptr);
+    req->result = err;
+    req->done_ = true;
+    q->pending.erase(req);
+    q->inflight--;
+  }
+  q->queued.clear();
+
+  if (!q->pending.empty() && (sqe = io_uring_get_sqe(&q->ring)) != nullptr) {
+    io_uring_prep_cancel64(sqe, 0, IORING_ASYNC_CANCEL_ANY);
+    io_uring_sqe_set_data(sqe, nullptr);
+    io_uring_submit(&q->ring);
+  }
+}
+
+/* Must hold q->mtx. Waits for at least one completion and marks the requests
+ * of all available completions done, whichever thread submitted them. After
+ * an error nothing new is submitted, only the reads in flight are reaped. */
+void ZbdlibBackend::ReapReads(UringQueue *q) {
+  struct io_uring_cqe *cqe;
+  int ret;
+
+  if (q->error) {
+    ret = io_uring_wait_cqe(&q->ring, &cqe);
+  } else {
+    ret = io_uring_submit_and_wait(&q->ring, 1);
+    if (ret > 0) UringConsumed(&q->queued, ret);
+  }
+
+  while (io_uring_peek_cqe(&q->ring, &cqe) == 0) {
+    ZbdReadRequest *req = (ZbdReadRequest *)io_uring_cqe_get_data(cqe);
+    io_uring_cqe_seen(&q->ring, cqe);
+    if (!req) continue; /* no-op or cancel */
+    req->result = cqe->res;
+    req->done_ = true;
+    q->pending.erase(req);
+    q->inflight--;
+  }
+
+  if (ret < 0 && !UringRetry(ret)) FailReads(q, ret);
+}
+
+void ZbdlibBackend::SubmitReads(ZbdReadRequest **reqs, size_t n) {
+  if (uring_queues_.empty()) {
+    ZonedBlockDeviceBackend::SubmitReads(reqs, n);
+    return;
+  }
+
+  size_t qi = std::hash<std::thread::id>()(std::this_thread::get_id()) %
+              uring_queues_.size();
+  UringQueue *q = uring_queues_[qi].get();
+  std::lock_guard<std::mutex> lock(q->mtx);
+
+  for (size_t i = 0; i < n; i++) {
+    ZbdReadRequest *req = reqs[i];
+    struct io_uring_sqe *sqe = nullptr;
+
+    if (q->inflight == ZENFS_URING_DEPTH) ReapReads(q);
+    if (!q->error) sqe = io_uring_get_sqe(&q->ring);
+    if (!sqe) {
+      ZonedBlockDeviceBackend::SubmitReads(&req, 1);
+      continue;
+    }
+
+    io_uring_prep_read(sqe, req->direct ? read_direct_f_ : read_f_, req->buf,
+                       req->size, req->pos);
+    io_uring_sqe_set_data(sqe, req);
+    req->done_ = false;
+    req->queue_ = qi;
+    q->pending.insert(req);
+    q->queued.emplace_back(req, sqe);
+    q->inflight++;
+  }
+
+  /* Reads that are not submitted now are submitted by WaitReads */
+  if (q->error) return;
+  int ret = io_uring_submit(&q->ring);
+  if (ret > 0) UringConsumed(&q->queued, ret);
+  if (ret < 0 && !UringRetry(ret)) FailReads(q, ret);
+}
+
+void ZbdlibBackend::WaitReads(ZbdReadRequest **reqs, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    ZbdReadRequest *req = reqs[i];
+    if (req->queue_ < 0) continue;
+
+    UringQueue *q = uring_queues_[req->queue_].get();
+    std::lock_guard<std::mutex> lock(q->mtx);
+    while (!req->done_) ReapReads(q);
+  }
+}
+
+/* Must hold q->mtx. Same as FailReads: appends the kernel has not consumed
+ * fail right away, the submitted ones stay pending until their completions
+ * are reaped, as the request and the data live on the appender's stack. Only
+ * the reaper tears the ring down, no other thread is in the ring then. */
+void ZbdlibBackend::FailAppends(AppendQueue *q, int err) {
+  struct io_uring_sqe *sqe;
+
+  if (q->error) {
+    io_uring_queue_exit(&q->ring);
+    q->exited = true;
+    for (AppendRequest *req : q->pending) {
+      req->result = q->error;
+      req->done = true;
+    }
+    q->pending.clear();
+    q->inflight = 0;
+    return;
+  }
+
+  q->error = err;
+  for (auto &queued : q->queued) {
+    AppendRequest *req = queued.first;
+    io_uring_prep_nop(queued.second);
+    io_uring_sqe_set_data(queued.second, nullptr);
+    req->result = err;
+    req->done = true;
+    q->pending.erase(req);
+    q->inflight--;
+  }
+  q->queued.clear();
+
+  if (!q->pending.empty() && (sqe = io_uring_get_sqe(&q->ring)) != nullptr) {
+    io_uring_prep_cancel64(sqe, 0, IORING_ASYNC_CANCEL_ANY);
+    io_uring_sqe_set_data(sqe, nullptr);
+    io_uring_submit(&q->ring);
+  }
+}
+
+/* Must hold q->mtx through lock and not be reaping already. Waits for a
+ * completion without the lock, so other threads keep submitting, and marks
+ * the requests of all available completions done. */
+void ZbdlibBackend::ReapAppends(AppendQueue *q,
+                                std::unique_lock<std::mutex> &lock) {
+  struct io_uring_cqe *cqe;
+  int ret;
+
+  q->reaping = true;
+  lock.unlock();
+  ret = io_uring_wait_cqe(&q->ring, &cqe);
+  lock.lock();
+
+  while (io_uring_peek_cqe(&q->ring, &cqe) == 0) {
+    AppendRequest *req = (AppendRequest *)io_uring_cqe_get_data(cqe);
+    io_uring_cqe_seen(&q->ring, cqe);
+    if (!req) continue; /* no-op or cancel */
+    req->result = cqe->res;
+    req->lba = cqe->big_cqe[0];
+    req->done = true;
+    q->pending.erase(req);
+    q->inflight--;
+  }
+
+  /* Appends the kernel did not take at submit (EBUSY) go out now */
+  if (ret >= 0 && !q->error && io_uring_sq_ready(&q->ring)) {
+    ret = io_uring_submit(&q->ring);
+    if (ret > 0) UringConsumed(&q->queued, ret);
+  }
+  if (ret < 0 && !UringRetry(ret)) FailAppends(q, ret);
+  q->reaping = false;
+  q->cv.notify_all();
+}
+
+/* NVMe zone append (opcode 0x7d), the completion carries the LBA the device
+ * wrote the data at */
+int ZbdlibBackend::ZoneAppend(char *data, uint32_t size, uint64_t zone_start,
+                              uint64_t *pos) {
+  if (append_queues_.empty()) {
+    errno = ENOTSUP;
+    return -1;
+  }
+
+  AppendQueue *q =
+      append_queues_[std::hash<std::thread::id>()(std::this_thread::get_id()) %
+                     append_queues_.size()]
+          .get();
+  std::unique_lock<std::mutex> lock(q->mtx);
+  AppendRequest req;
+  struct io_uring_sqe *sqe = nullptr;
+  int ret;
+
+  while (!q->error && q->inflight >= ZENFS_APPEND_DEPTH) {
+    if (q->reaping)
+      q->cv.wait(lock);
+    else
+      ReapAppends(q, lock);
+  }
+  if (!q->error) sqe = io_uring_get_sqe(&q->ring);
+  if (!sqe) {
+    errno = q->error ? -q->error : EBUSY;
+    return -1;
+  }
+
+  memset(sqe, 0, 2 * sizeof(*sqe));
+  sqe->opcode = IORING_OP_URING_CMD;
+  sqe->fd = ng_f_;
+  sqe->cmd_op = NVME_URING_CMD_IO;
+  struct nvme_uring_cmd *cmd = (struct nvme_uring_cmd *)sqe->cmd;
+  uint64_t zslba = zone_start / lba_sz_;
+  cmd->opcode = 0x7d;
+  cmd->nsid = nsid_;
+  cmd->addr = (uint64_t)(uintptr_t)data;
+  cmd->data_len = size;
+  cmd->cdw10 = zslba & 0xffffffff;
+  cmd->cdw11 = zslba >> 32;
+  cmd->cdw12 = size / lba_sz_ - 1;
+  io_uring_sqe_set_data(sqe, &req);
+  q->pending.insert(&req);
+  q->queued.emplace_back(&req, sqe);
+  q->inflight++;
+
+  do {
+    ret = io_uring_submit(&q->ring);
+  } while (ret == -EINTR || ret == -EAGAIN);
+  if (ret > 0) UringConsumed(&q->queued, ret);
+  if (ret < 0 && ret != -EBUSY) {
+    /* Fails the appends that did not go out, this one included */
+    FailAppends(q, ret);
+    q->cv.notify_all();
+  }
+
+  while (!req.done) {
+    if (q->reaping)
+      q->cv.wait(lock);
+    else
+      ReapAppends(q, lock);
+  }
+
+  if (req.result != 0) {
+    /* Negative errno from the kernel, positive NVMe status from the device */
+    errno = req.result < 0 ? -req.result : EIO;
+    return -1;
+  }
+  *pos = req.lba * lba_sz_;
+  return size;
+}
+
 // APPEND-DOC
-int ZbdlibBackend::AppendSync(SZD::SZDOnceLog *wal) {
+int ZbdlibBackend::AppendSync(ZoneAppendLog *wal) {
   int ret = 0;
 #ifdef REORDER_WAL_TEST
   for (size_t i = 16; i >= 1; i--) {
@@ -214,7 +552,7 @@ int ZbdlibBackend::AppendSync(SZD::SZDOnceLog *wal) {
 }
 
 // APPEND-DOC
-int ZbdlibBackend::Append(char *data, uint32_t size,  SZD::SZDOnceLog *wal) {
+int ZbdlibBackend::Append(char *data, uint32_t size,  ZoneAppendLog *wal) {
   int ret;
 
 #ifdef REORDER_WAL_TEST
@@ -12,12 +12,30 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
 #include "rocksdb/io_status.h"
 #include "zbd_zenfs.h"
 
 // APPEND-DOC, define to test if it also works with reordering
 //#define REORDER_WAL_TEST
 
+// APPEND-DOC, io_uring queues for batched and asynchronous reads. A thread
+// always submits to the same queue, 0 queues falls back to pread.
+#define ZENFS_URING_QUEUES (4)
+#define ZENFS_URING_DEPTH (64)
+
+// APPEND-DOC, io_uring queues for zone appends of shared SST zones, issued as
+// NVMe passthrough commands on the ng char device. Without the ng device the
+// backend has no zone appends and SSTs are written at the write pointer.
+#define ZENFS_APPEND_QUEUES (4)
+#define ZENFS_APPEND_DEPTH (64)
+
 namespace ROCKSDB_NAMESPACE {
 
 class ZbdlibBackend : public ZonedBlockDeviceBackend {
@@ -27,9 +45,52 @@ class ZbdlibBackend : public ZonedBlockDeviceBackend {
   int read_direct_f_;
   int write_f_;
 
+  struct UringQueue {
+    struct io_uring ring;
+    std::mutex mtx;
+    unsigned inflight = 0;
+    std::unordered_set<ZbdReadRequest *> pending;
+    /* prepared, not consumed by the kernel yet, in submission order */
+    std::vector<std::pair<ZbdReadRequest *, struct io_uring_sqe *>> queued;
+    int error = 0; /* once the ring failed, its reads fall back to pread */
+    bool exited = false;
+  };
+  std::vector<std::unique_ptr<UringQueue>> uring_queues_;
+
+  int ng_f_;
+  uint32_t nsid_;
+  uint32_t lba_sz_;
+  uint32_t zone_append_max_;
+
+  struct AppendRequest {
+    int result = 0;
+    uint64_t lba = 0;
+    bool done = false;
+  };
+
+  /* One thread at a time reaps completions, the others wait on cv */
+  struct AppendQueue {
+    struct io_uring ring;
+    std::mutex mtx;
+    std::condition_variable cv;
+    unsigned inflight = 0;
+    bool reaping = false;
+    std::unordered_set<AppendRequest *> pending;
+    /* prepared, not consumed by the kernel yet, in submission order */
+    std::vector<std::pair<AppendRequest *, struct io_uring_sqe *>> queued;
+    int error = 0; /* once the ring failed, appends fail */
+    bool exited = false;
+  };
+  std::vector<std::unique_ptr<AppendQueue>> append_queues_;
+
  public:
   explicit ZbdlibBackend(std::string bdevname);
   ~ZbdlibBackend() {
+    for (auto &q : uring_queues_)
+      if (!q->exited) io_uring_queue_exit(&q->ring);
+    for (auto &q : append_queues_)
+      if (!q->exited) io_uring_queue_exit(&q->ring);
+    if (ng_f_ >= 0) close(ng_f_);
     zbd_close(read_f_);
     zbd_close(read_direct_f_);
     zbd_close(write_f_);
@@ -43,10 +104,15 @@ class ZbdlibBackend : public ZonedBlockDeviceBackend {
   IOStatus Close(uint64_t start);
   int Read(char *buf, int size, uint64_t pos, bool direct);
   int Write(char *data, uint32_t size, uint64_t pos);
+  void SubmitReads(ZbdReadRequest **reqs, size_t n);
+  void WaitReads(ZbdReadRequest **reqs, size_t n);
+  uint32_t ZoneAppendMax() { return zone_append_max_; }
+  int ZoneAppend(char *data, uint32_t size, uint64_t zone_start,
+                 uint64_t *pos);
   // APPEND-DOC
-  int Append(char *data, uint32_t size,  SZD::SZDOnceLog *wal);
+  int Append(char *data, uint32_t size,  ZoneAppendLog *wal);
   // APPEND-DOC
-  int AppendSync(SZD::SZDOnceLog *wal);
+  int AppendSync(ZoneAppendLog *wal);
 
 
   int InvalidateCache(uint64_t pos, uint64_t size);
@@ -96,6 +162,11 @@ class ZbdlibBackend : public ZonedBlockDeviceBackend {
  private:
   IOStatus CheckScheduler();
   std::string ErrorToString(int err);
+  void ReapReads(UringQueue *q);
+  void FailReads(UringQueue *q, int err);
+  void OpenZoneAppends(const zbd_info &info);
+  void ReapAppends(AppendQueue *q, std::unique_lock<std::mutex> &lock);
+  void FailAppends(AppendQueue *q, int err);
 
 // APPEND-DOC
 #ifdef REORDER_WAL_TEST
@@ -95,7 +95,8 @@ ZoneFsBackend::ZoneFsBackend(std::string mountpoint)
       readonly_(false),
       rd_fds_(O_RDONLY),
       direct_rd_fds_(O_RDONLY | O_DIRECT),
-      wr_fds_(O_WRONLY | O_DIRECT) {}
+      wr_fds_(O_WRONLY | O_DIRECT),
+      app_fds_(O_WRONLY | O_DIRECT | O_APPEND) {}
 
 ZoneFsBackend::~ZoneFsBackend() {
   if (zone_zero_fd_ != -1) {
@@ -278,7 +279,9 @@ std::shared_ptr<ZoneFsFile> ZoneFsBackend::GetZoneFile(uint64_t start,
                                                        int flags) {
   std::shared_ptr<ZoneFsFile> zoneFsFile(nullptr);
 
-  if (flags & O_WRONLY) {
+  if (flags & O_APPEND) {
+    zoneFsFile = app_fds_.Get(start / zone_sz_, LBAToZoneFile(start));
+  } else if (flags & O_WRONLY) {
     zoneFsFile = wr_fds_.Get(start / zone_sz_, LBAToZoneFile(start));
   } else if (flags & O_DIRECT) {
     zoneFsFile = direct_rd_fds_.Get(start / zone_sz_, LBAToZoneFile(start));
@@ -291,8 +294,11 @@ std::shared_ptr<ZoneFsFile> ZoneFsBackend::GetZoneFile(uint64_t start,
 void ZoneFsBackend::PutZoneFile(uint64_t start, int flags) {
   uint64_t zone_nr = start / zone_sz_;
 
-  if (flags & O_WRONLY) {
+  if (flags & O_APPEND) {
+    app_fds_.Put(zone_nr);
+  } else if (flags & O_WRONLY) {
     wr_fds_.Put(zone_nr);
+    app_fds_.Put(zone_nr);
   }
 }
 
@@ -362,6 +368,22 @@ int ZoneFsBackend::Write(char *data, uint32_t size, uint64_t pos) {
   return written;
 }
 
+int ZoneFsBackend::Append(char *data, uint32_t size, ZoneAppendLog *wal) {
+  if (wal->AsyncAppend(data, size, nullptr) != SZD::SZDStatus::Success) {
+    errno = EIO;
+    return -1;
+  }
+  return size;
+}
+
+uint64_t ZoneFsBackend::ZoneWritePointer(uint64_t zone) {
+  struct stat file_stat;
+
+  if (stat(LBAToZoneFile(zone * zone_sz_).c_str(), &file_stat) < 0)
+    return zone * zone_sz_;
+  return zone * zone_sz_ + file_stat.st_size;
+}
+
 bool ZoneFsBackend::ZoneIsSwr(__attribute__((unused))
                               std::unique_ptr<ZoneList> &zones,
                               __attribute__((unused)) unsigned int idx) {
@@ -408,6 +430,142 @@ uint64_t ZoneFsBackend::ZoneWp(std::unique_ptr<ZoneList> &zones,
   return idx * zone_sz_ + z->st_size;
 };
 
+ZoneFsAppendLog::ZoneFsAppendLog(ZoneFsBackend *be, uint64_t min_zone,
+                                 uint64_t max_zone)
+    : be_(be),
+      min_lba_(min_zone * (be->GetZoneSize() / be->GetBlockSize())),
+      max_lba_(max_zone * (be->GetZoneSize() / be->GetBlockSize())),
+      head_(min_lba_),
+      tail_(min_lba_) {}
+
+ZoneFsAppendLog::~ZoneFsAppendLog() { free(buf_); }
+
+/* O_DIRECT needs block aligned buffers and sizes, appends that are not are
+ * copied to the bounce buffer and padded with zeros */
+const char *ZoneFsAppendLog::Align(const char *data, size_t *size) {
+  uint64_t bs = be_->GetBlockSize();
+  size_t padded = (*size + bs - 1) / bs * bs;
+
+  if (padded == *size && (uintptr_t)data % bs == 0) return data;
+
+  if (buf_sz_ < padded) {
+    free(buf_);
+    buf_ = nullptr;
+    buf_sz_ = 0;
+    if (posix_memalign((void **)&buf_, sysconf(_SC_PAGESIZE), padded))
+      return nullptr;
+    buf_sz_ = padded;
+  }
+  memcpy(buf_, data, *size);
+  memset(buf_ + *size, 0, padded - *size);
+  *size = padded;
+  return buf_;
+}
+
+/* Appends may cross into the next zone file. A zone file that is full is
+ * closed, so the log keeps at most one zone open. */
+SZD::SZDStatus ZoneFsAppendLog::AsyncAppend(const char *data, size_t size,
+                                            uint64_t *lbas) {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint64_t bs = be_->GetBlockSize();
+  uint64_t zone_sz = be_->GetZoneSize();
+
+  if (be_->readonly_) return SZD::SZDStatus::IOError;
+  data = Align(data, &size);
+  if (data == nullptr) return SZD::SZDStatus::IOError;
+  if (lbas) *lbas = head_;
+
+  while (size) {
+    if (head_ >= max_lba_) return SZD::SZDStatus::IOError;
+
+    uint64_t pos = head_ * bs;
+    size_t n = std::min((uint64_t)size, zone_sz - pos % zone_sz);
+    std::shared_ptr<ZoneFsFile> file =
+        be_->GetZoneFile(pos, O_WRONLY | O_DIRECT | O_APPEND);
+    if (file == nullptr) return SZD::SZDStatus::IOError;
+
+    ssize_t ret = write(file->GetFd(), data, n);
+    if (ret <= 0) {
+      /* Resync the head with the write pointer of the zone file */
+      head_ = be_->ZoneWritePointer(pos / zone_sz) / bs;
+      return SZD::SZDStatus::IOError;
+    }
+
+    head_ += ret / bs;
+    data += ret;
+    size -= ret;
+    if ((head_ * bs) % zone_sz == 0) be_->PutZoneFile(pos, O_APPEND);
+  }
+  return SZD::SZDStatus::Success;
+}
+
+/* The appends are direct writes, syncing flushes the write cache of the
+ * device. Any zonefs file does, zone 0 is always open. */
+SZD::SZDStatus ZoneFsAppendLog::Sync() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  if (be_->readonly_) return SZD::SZDStatus::Success;
+  return fdatasync(be_->zone_zero_fd_) ? SZD::SZDStatus::IOError
+                                       : SZD::SZDStatus::Success;
+}
+
+SZD::SZDStatus ZoneFsAppendLog::Read(uint64_t lba, char *data, uint64_t size,
+                                     bool /*aligned*/) {
+  uint64_t pos = lba * be_->GetBlockSize();
+  uint64_t done = 0;
+
+  while (done < size) {
+    int ret = be_->Read(data + done, size - done, pos + done, false);
+    if (ret <= 0) return SZD::SZDStatus::IOError;
+    done += ret;
+  }
+  return SZD::SZDStatus::Success;
+}
+
+SZD::SZDStatus ZoneFsAppendLog::ResetAll() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint64_t zone_sz = be_->GetZoneSize();
+  uint64_t zone_lbas = zone_sz / be_->GetBlockSize();
+  bool offline;
+  uint64_t max_capacity;
+
+  for (uint64_t zone = min_lba_ / zone_lbas; zone < max_lba_ / zone_lbas;
+       zone++) {
+    if (!be_->Reset(zone * zone_sz, &offline, &max_capacity).ok())
+      return SZD::SZDStatus::IOError;
+  }
+  head_ = tail_ = min_lba_;
+  return SZD::SZDStatus::Success;
+}
+
+/* The log fills its zones in order, the head is the size of the last zone
+ * file that was written to */
+SZD::SZDStatus ZoneFsAppendLog::RecoverPointers() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  uint64_t zone_sz = be_->GetZoneSize();
+  uint64_t bs = be_->GetBlockSize();
+  uint64_t zone_lbas = zone_sz / bs;
+
+  head_ = tail_ = min_lba_;
+  for (uint64_t zone = min_lba_ / zone_lbas; zone < max_lba_ / zone_lbas;
+       zone++) {
+    uint64_t wp = be_->ZoneWritePointer(zone);
+    if (wp == zone * zone_sz) break;
+    head_ = wp / bs;
+    if (wp < (zone + 1) * zone_sz) break;
+  }
+  return SZD::SZDStatus::Success;
+}
+
+uint64_t ZoneFsAppendLog::GetWriteHead() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return head_;
+}
+
+uint64_t ZoneFsAppendLog::GetWriteTail() {
+  std::lock_guard<std::mutex> lock(mtx_);
+  return tail_;
+}
+
 }  // Namespace ROCKSDB_NAMESPACE
 
 #endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -14,6 +14,7 @@
 
 #include <list>
 #include <map>
+#include <mutex>
 #include <string>
 
 #include "rocksdb/io_status.h"
@@ -56,6 +57,44 @@ class ZoneFsFileCache {
   void Prune(unsigned limit);
 };
 
+class ZoneFsBackend;
+
+// APPEND-DOC, the once log of a WAL on zonefs, it covers the sequential zone
+// files [min_zone, max_zone) and fills them in order. Appends are direct
+// O_APPEND writes, zonefs places them at the write pointer of the zone file
+// (the file size), so no SZD device is needed. LBAs are in blocks from the
+// start of the device, like the LBAs of the SZD logs.
+class ZoneFsAppendLog : public ZoneAppendLog {
+  ZoneFsBackend *be_;
+  uint64_t min_lba_;
+  uint64_t max_lba_;
+  uint64_t head_;
+  uint64_t tail_;
+  char *buf_ = nullptr; /* aligned bounce buffer for O_DIRECT */
+  size_t buf_sz_ = 0;
+  std::mutex mtx_;
+
+ public:
+  ZoneFsAppendLog(ZoneFsBackend *be, uint64_t min_zone, uint64_t max_zone);
+  ~ZoneFsAppendLog();
+
+  SZD::SZDStatus AsyncAppend(const char *data, size_t size,
+                             uint64_t *lbas) override;
+  SZD::SZDStatus Sync() override;
+  SZD::SZDStatus Read(uint64_t lba, char *data, uint64_t size,
+                      bool aligned) override;
+  SZD::SZDStatus ResetAll() override;
+  SZD::SZDStatus RecoverPointers() override;
+  uint64_t GetWriteHead() override;
+  uint64_t GetWriteTail() override;
+  /* Appends are written before AsyncAppend returns */
+  bool CopiesAppends() override { return true; }
+
+ private:
+  /* Must hold mtx_ */
+  const char *Align(const char *data, size_t *size);
+};
+
 class ZoneFsBackend : public ZonedBlockDeviceBackend {
  private:
   std::string mountpoint_;
@@ -64,6 +103,9 @@ class ZoneFsBackend : public ZonedBlockDeviceBackend {
   ZoneFsFileCache rd_fds_;
   ZoneFsFileCache direct_rd_fds_;
   ZoneFsFileCache wr_fds_;
+  ZoneFsFileCache app_fds_;
+
+  friend class ZoneFsAppendLog;
 
  public:
   explicit ZoneFsBackend(std::string mountpoint);
@@ -77,17 +119,12 @@ class ZoneFsBackend : public ZonedBlockDeviceBackend {
   IOStatus Close(uint64_t start);
   int Read(char *buf, int size, uint64_t pos, bool direct);
   int Write(char *data, uint32_t size, uint64_t pos);
-  int Append(char *data, uint32_t size,  SZD::SZDOnceLog *wal) {
-    (void)data;
-    (void)size;
-    (void)wal;
-    return -1;
-  };
-  int AppendSync(SZD::SZDOnceLog *wal) {
-    (void)wal;
-    return -1;
-  };
-
+  int Append(char *data, uint32_t size, ZoneAppendLog *wal);
+  int AppendSync(ZoneAppendLog * /*wal*/) { return 0; }
+  bool OwnsAppendLogs() { return true; }
+  ZoneAppendLog *NewAppendLog(uint64_t min_zone, uint64_t max_zone) {
+    return new ZoneFsAppendLog(this, min_zone, max_zone);
+  }
 
   int InvalidateCache(uint64_t pos, uint64_t size);
 
@@ -101,6 +138,9 @@ class ZoneFsBackend : public ZonedBlockDeviceBackend {
   uint64_t ZoneWp(std::unique_ptr<ZoneList> &zones, unsigned int idx);
   std::string GetFilename() { return mountpoint_; }
 
+  /* Write pointer of a zone, for the append logs */
+  uint64_t ZoneWritePointer(uint64_t zone);
+
  private:
   std::string ErrorToString(int err);
   uint64_t LBAToZoneOffset(uint64_t pos);
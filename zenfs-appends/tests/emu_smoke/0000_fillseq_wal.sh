@@ -0,0 +1,11 @@
+#!/bin/bash
+source emu_smoke/common.sh
+
+# Synced writes go through the WAL, so the emulated append log is exercised
+DB_BENCH_PARAMS="--benchmarks=fillseq --num=$NUM --value_size=$VALUE_SIZE --sync=1 --disable_wal=0 --histogram $FS_PARAMS $DB_BENCH_EXTRA_PARAMS"
+
+echo "# Running db_bench with parameters: $DB_BENCH_PARAMS" > $TEST_OUT
+$TOOLS_DIR/db_bench $DB_BENCH_PARAMS >> $TEST_OUT
+
+check_db_bench_workload_completion fillseq
+exit $?
@@ -0,0 +1,11 @@
+#!/bin/bash
+source emu_smoke/common.sh
+
+# Reopens the database written by the previous test
+DB_BENCH_PARAMS="--benchmarks=readseq --use_existing_db --num=$NUM --value_size=$VALUE_SIZE --histogram $FS_PARAMS $DB_BENCH_EXTRA_PARAMS"
+
+echo "# Running db_bench with parameters: $DB_BENCH_PARAMS" > $TEST_OUT
+$TOOLS_DIR/db_bench $DB_BENCH_PARAMS >> $TEST_OUT
+
+check_db_bench_workload_completion readseq
+exit $?
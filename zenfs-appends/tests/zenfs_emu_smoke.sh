@@ -0,0 +1,23 @@
+#!/bin/bash
+set -e
+
+# Runs the emu_smoke test set on an emulated zoned device, no zoned drive is
+# needed.
+# Example:
+#   ./zenfs_emu_smoke.sh [ <backing file> ]
+
+IMG=${1:-/tmp/zenfs-emu.img}
+AUXPATH=/tmp/zenfs-emu-aux
+
+MKFS_ARG="--emu=$IMG,zones=64,zone_mb=64"
+FS_URI="zenfs://emu:$IMG,append_us=20,write_us=30,reorder=8,seed=1"
+
+rm -rf $AUXPATH $IMG && ../util/zenfs mkfs $MKFS_ARG --aux_path=$AUXPATH --force
+
+echo "Using URI "$FS_URI
+
+NAME="zenfs-emu-smoke"
+
+echo "$(tput setaf 4)Running ZenFS emulated device smoke tests, results will be stored in results/$NAME $(tput sgr 0)"
+
+FS_PARAMS="--fs_uri=$FS_URI" ./run.sh $NAME emu_smoke
@@ -32,6 +32,8 @@ using GFLAGS_NAMESPACE::SetUsageMessage;
 
 DEFINE_string(zbd, "", "Path to a zoned block device.");
 DEFINE_string(zonefs, "", "Path to a zonefs mountpoint.");
+DEFINE_string(emu, "",
+              "Emulated zoned device: <backing file or mem>[,key=value...]");
 DEFINE_string(aux_path, "",
               "Path for auxiliary file storage (log and lock files).");
 DEFINE_bool(
@@ -48,6 +50,34 @@ DEFINE_string(backup_path, "", "Path to backup files");
 DEFINE_string(src_file, "", "Source file path");
 DEFINE_string(dest_file, "", "Destination file path");
 DEFINE_bool(enable_gc, false, "Enable garbage collection");
+DEFINE_uint32(wal_buffer_kb, 0,
+              "ZWAL buffer size in KiB (0 selects the build default)");
+DEFINE_uint32(wal_barrier_kb, 0,
+              "ZWAL barrier size in KiB (0 selects the build default)");
+DEFINE_uint32(wal_barrier_min_kb, 0,
+              "Lower bound of adaptive ZWAL barriers in KiB (0 selects the "
+              "buffer size)");
+DEFINE_uint32(wal_barrier_max_kb, 0,
+              "Upper bound of adaptive ZWAL barriers in KiB (0 keeps the "
+              "barrier fixed)");
+DEFINE_uint32(wal_depth, 0,
+              "ZWAL max queue depth (0 selects the build default)");
+DEFINE_uint32(wal_channels, 0,
+              "ZWAL write channels (0 selects the build default)");
+DEFINE_uint32(reserve_io_zones, 0,
+              "Empty IO zones kept in reserve by the zone reset worker (0 "
+              "selects the build default)");
+DEFINE_uint32(reserve_wal_ranges, 0,
+              "Empty WAL zone ranges kept in reserve by the zone reset worker "
+              "(0 selects the build default)");
+DEFINE_uint32(gc_threads, 0,
+              "Files migrated concurrently by garbage collection (0 selects "
+              "the build default)");
+DEFINE_uint32(gc_bandwidth_mb, 0,
+              "Garbage collection copy budget in MiB/s (0 is unlimited)");
+DEFINE_bool(sst_zone_appends, false,
+            "Write SSTs with zone appends to zones shared by writers of the "
+            "same lifetime");
 
 namespace ROCKSDB_NAMESPACE {
 
@@ -57,17 +87,24 @@ void AddDirSeparatorAtEnd(std::string &path) {
 
 std::unique_ptr<ZonedBlockDevice> zbd_open(bool readonly, bool exclusive) {
   printf("Make block device\n");
-  std::unique_ptr<ZonedBlockDevice> zbd{new ZonedBlockDevice(
-      FLAGS_zbd.empty() ? FLAGS_zonefs : FLAGS_zbd,
-      FLAGS_zbd.empty() ? ZbdBackendType::kZoneFS : ZbdBackendType::kBlockDev,
-      nullptr)};
+  std::string path = FLAGS_zbd;
+  ZbdBackendType backend = ZbdBackendType::kBlockDev;
+  if (!FLAGS_zonefs.empty()) {
+    path = FLAGS_zonefs;
+    backend = ZbdBackendType::kZoneFS;
+  } else if (!FLAGS_emu.empty()) {
+    path = FLAGS_emu;
+    backend = ZbdBackendType::kEmulated;
+  }
+  std::unique_ptr<ZonedBlockDevice> zbd{
+      new ZonedBlockDevice(path, backend, nullptr)};
   printf("Made block device\n");
 
   IOStatus open_status = zbd->Open(readonly, exclusive);
 
   if (!open_status.ok()) {
     fprintf(stderr, "Failed to open zoned block device: %s, error: %s\n",
-            FLAGS_zbd.c_str(), open_status.ToString().c_str());
+            path.c_str(), open_status.ToString().c_str());
     zbd.reset();
   }
 
@@ -186,7 +223,21 @@ int zenfs_tool_mkfs() {
 
   AddDirSeparatorAtEnd(FLAGS_aux_path);
 
-  s = zenFS->MkFS(FLAGS_aux_path, FLAGS_finish_threshold, FLAGS_enable_gc);
+  ZWALOptions wal_options;
+  wal_options.buffer_size_kb = FLAGS_wal_buffer_kb;
+  wal_options.barrier_size_kb = FLAGS_wal_barrier_kb;
+  wal_options.barrier_min_kb = FLAGS_wal_barrier_min_kb;
+  wal_options.barrier_max_kb = FLAGS_wal_barrier_max_kb;
+  wal_options.depth = FLAGS_wal_depth;
+  wal_options.channels = FLAGS_wal_channels;
+  wal_options.sst_zone_appends = FLAGS_sst_zone_appends;
+  wal_options.reserve_io_zones = FLAGS_reserve_io_zones;
+  wal_options.reserve_wal_ranges = FLAGS_reserve_wal_ranges;
+  wal_options.gc_threads = FLAGS_gc_threads;
+  wal_options.gc_bandwidth_mb = FLAGS_gc_bandwidth_mb;
+
+  s = zenFS->MkFS(FLAGS_aux_path, FLAGS_finish_threshold, FLAGS_enable_gc,
+                  wal_options);
   if (!s.ok()) {
     fprintf(stderr, "Failed to create file system, error: %s\n",
             s.ToString().c_str());
@@ -797,16 +848,18 @@ int main(int argc, char **argv) {
   std::string subcmd(argv[1]);
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
-  if (FLAGS_zonefs.empty() && FLAGS_zbd.empty() && subcmd != "ls-uuid") {
-    fprintf(
-        stderr,
-        "You need to specify a zoned block device using --zbd or --zonefs\n");
+  int nr_devices =
+      !FLAGS_zonefs.empty() + !FLAGS_zbd.empty() + !FLAGS_emu.empty();
+  if (nr_devices == 0 && subcmd != "ls-uuid") {
+    fprintf(stderr,
+            "You need to specify a zoned block device using --zbd, --zonefs "
+            "or --emu\n");
     return 1;
   }
-  if (!FLAGS_zonefs.empty() && !FLAGS_zbd.empty()) {
+  if (nr_devices > 1) {
     fprintf(stderr,
-            "You need to specify a zoned block device using either "
-            "--zbd or --zonefs - not both\n");
+            "You need to specify a zoned block device using one of "
+            "--zbd, --zonefs or --emu\n");
     return 1;
   }
   if (subcmd == "mkfs") {
@@ -4,7 +4,8 @@ zenfs_SOURCES-y = \
 	fs/zbd_zenfs.cc \
 	fs/io_zenfs.cc \
 	fs/zonefs_zenfs.cc \
-	fs/zbdlib_zenfs.cc
+	fs/zbdlib_zenfs.cc \
+	fs/emu_zenfs.cc
 
 zenfs_HEADERS-y = \
 	fs/fs_zenfs.h \
@@ -15,7 +16,8 @@ zenfs_HEADERS-y = \
 	fs/snapshot.h \
 	fs/filesystem_utility.h \
 	fs/zonefs_zenfs.h \
-	fs/zbdlib_zenfs.h
+	fs/zbdlib_zenfs.h \
+	fs/emu_zenfs.h
 
 
 PKG_CONFIG_PATH = $(SPDK_DIR)/build/lib/pkgconfig